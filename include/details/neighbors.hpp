@@ -0,0 +1,214 @@
+#ifndef NEIGHBORS_HPP
+#define NEIGHBORS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+namespace kdtree_index
+{
+	namespace details
+	{
+		/**
+		 *  Filter that accepts all values and all sub-trees.
+		 */
+		struct accept_all
+		{
+			template<typename Value>
+			bool operator()(const Value&) const noexcept { return true; }
+		};
+
+		/**
+		 *  When the filter names a monoid as summary_type and augment caches
+		 *  its aggregate for the sub-tree at position p, whose children are at
+		 *  offset o in a tree of dist elements, calls filter.subtree() with
+		 *  that aggregate. Otherwise assumes the sub-tree may hold matching
+		 *  values. Call with 0 as last argument to prefer the first overload.
+		 */
+		template<typename Filter, typename Augment>
+		inline auto subtree_may_match(const Filter& filter, const Augment& augment,
+		                              std::ptrdiff_t p, std::ptrdiff_t o,
+		                              std::ptrdiff_t dist, int)
+			-> decltype(static_cast<bool>(filter.subtree
+				(std::declval<const typename Filter::summary_type::result_type&>())))
+		{
+			const typename Filter::summary_type::result_type* summary
+				= augment.aggregate(p, o, dist, typename Filter::summary_type());
+			return summary == nullptr || static_cast<bool>(filter.subtree(*summary));
+		}
+
+		template<typename Filter, typename Augment>
+		inline bool subtree_may_match(const Filter&, const Augment&,
+		                              std::ptrdiff_t, std::ptrdiff_t,
+		                              std::ptrdiff_t, long) noexcept
+		{ return true; }
+
+		/**
+		 *  A value found during a nearest neighbor search with its distance to
+		 *  the origin of the search.
+		 */
+		template<typename Distance, typename Iterator>
+		struct neighbor
+		{
+			Distance distance;
+			Iterator node;
+		};
+
+		template<typename Distance, typename Iterator>
+		inline bool operator<(const neighbor<Distance, Iterator>& a,
+		                      const neighbor<Distance, Iterator>& b) noexcept
+		{ return a.distance < b.distance; }
+
+		/**
+		 *  Holds the single best candidate of a nearest neighbor search. Never
+		 *  allocates.
+		 */
+		template<typename Distance, typename Iterator>
+		struct nearest_one
+		{
+			explicit nearest_one() noexcept : _found(false), _best() { }
+
+			bool full() const noexcept { return _found; }
+			std::size_t size() const noexcept { return _found ? 1 : 0; }
+			const Distance& worst() const noexcept { return _best.distance; }
+
+			void push(const Distance& d, const Iterator& i) noexcept
+			{
+				if (!_found || d < _best.distance)
+				{
+					_best.distance = d;
+					_best.node = i;
+					_found = true;
+				}
+			}
+
+			const neighbor<Distance, Iterator>& best() const noexcept
+			{ return _best; }
+
+		private:
+			bool _found;
+			neighbor<Distance, Iterator> _best;
+		};
+
+		/**
+		 *  Holds the k best candidates of a nearest neighbor search in a max-heap,
+		 *  so that the worst candidate is always available in O(1). The search
+		 *  finds at most n candidates, so no more than n are reserved, whatever
+		 *  k is.
+		 */
+		template<typename Distance, typename Iterator>
+		struct nearest_k
+		{
+			using neighbor_type = neighbor<Distance, Iterator>;
+
+			explicit nearest_k(std::size_t k, std::size_t n) : _k(k), _heap()
+			{ _heap.reserve(std::min(k, n)); }
+
+			bool full() const noexcept { return _heap.size() == _k; }
+			std::size_t size() const noexcept { return _heap.size(); }
+			const Distance& worst() const noexcept
+			{ return _heap.front().distance; }
+
+			void push(const Distance& d, const Iterator& i)
+			{
+				if (_k == 0) { return; }
+				if (full())
+				{
+					if (!(d < worst())) { return; }
+					std::pop_heap(_heap.begin(), _heap.end());
+					_heap.back().distance = d;
+					_heap.back().node = i;
+				}
+				else
+				{ _heap.push_back(neighbor_type{d, i}); }
+				std::push_heap(_heap.begin(), _heap.end());
+			}
+
+			/**
+			 *  Sort the candidates by increasing distance; after this call, the
+			 *  object can no longer accept new candidates.
+			 */
+			std::vector<neighbor_type>& sorted()
+			{
+				std::sort_heap(_heap.begin(), _heap.end());
+				return _heap;
+			}
+
+			/**
+			 *  Remove all candidates, to start another search.
+			 */
+			void clear() noexcept { _heap.clear(); }
+
+		private:
+			std::size_t _k;
+			std::vector<neighbor_type> _heap;
+		};
+
+		/**
+		 *  Filter that rejects a single value, identified by its address.
+		 */
+		template<typename Value>
+		struct other_than
+		{
+			const Value* self;
+
+			bool operator()(const Value& val) const noexcept
+			{ return &val != self; }
+		};
+
+		/**
+		 *  A sub-tree waiting to be explored during a best-bin-first search, with
+		 *  the lower bound of the distance between its values and the origin.
+		 */
+		template<typename Distance, typename Iterator>
+		struct pending_node
+		{
+			Distance bound;
+			Iterator node;
+			typename Iterator::difference_type offset;
+			std::size_t dim;
+		};
+
+		/**
+		 *  An entry in the priority queue of an incremental nearest neighbor
+		 *  search: either a sub-tree with the lower bound of its distance to the
+		 *  origin, or a single value with its exact distance.
+		 */
+		template<typename Distance, typename Iterator>
+		struct browse_entry
+		{
+			Distance bound;
+			Iterator node;
+			typename Iterator::difference_type offset;
+			std::size_t dim;
+			bool is_value;
+		};
+
+		/**
+		 *  Ordering for std::push_heap that puts the smallest bound on top and,
+		 *  between a value and a sub-tree with the same bound, the value first.
+		 */
+		struct farther_entry
+		{
+			template<typename Entry>
+			bool operator()(const Entry& a, const Entry& b) const noexcept
+			{
+				return b.bound < a.bound
+					|| (!(a.bound < b.bound) && b.is_value && !a.is_value);
+			}
+		};
+
+		/**
+		 *  Ordering for std::push_heap that puts the smallest bound on top.
+		 */
+		struct farther_bound
+		{
+			template<typename Pending>
+			bool operator()(const Pending& a, const Pending& b) const noexcept
+			{ return b.bound < a.bound; }
+		};
+	}
+}
+
+#endif
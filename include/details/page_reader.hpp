@@ -0,0 +1,380 @@
+#ifndef PAGE_READER_HPP
+#define PAGE_READER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+#include <vector>
+#include "posix_file.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>) && !defined(KDTREE_INDEX_NO_IO_URING)
+#    define KDTREE_INDEX_IO_URING 1
+#  endif
+#endif
+
+#ifdef KDTREE_INDEX_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace kdtree_index
+{
+	namespace details
+	{
+		/**
+		 *  Reads pages for a batch of queries. read() queues a request
+		 *  identified by tag; wait() performs the queued requests, or waits for
+		 *  at least one of them to complete, and calls completed(tag) for each
+		 *  completed request. At most capacity() requests are pending at once.
+		 *
+		 *  This one reads synchronously with pread(); see \ref io_uring_reader.
+		 */
+		class pread_reader
+		{
+		public:
+			explicit pread_reader(unsigned depth) : _capacity(depth), _queue()
+			{ _queue.reserve(depth); }
+
+			unsigned capacity() const noexcept { return _capacity; }
+			std::size_t pending() const noexcept { return _queue.size(); }
+
+			void read(const posix_file& file, void* buffer, std::size_t n,
+			          off_t offset, std::size_t tag)
+			{ _queue.push_back(request{&file, buffer, n, offset, tag}); }
+
+			template<typename Completed>
+			void wait(Completed completed)
+			{
+				while (!_queue.empty())
+				{
+					request r = _queue.back();
+					_queue.pop_back();
+					r.file->read_at(r.buffer, r.n, r.offset);
+					completed(r.tag);
+				}
+			}
+
+			void drain() noexcept { _queue.clear(); }
+
+		private:
+			struct request
+			{
+				const posix_file* file;
+				void* buffer;
+				std::size_t n;
+				off_t offset;
+				std::size_t tag;
+			};
+
+			unsigned _capacity;
+			std::vector<request> _queue;
+		};
+
+#ifdef KDTREE_INDEX_IO_URING
+		/**
+		 *  \ref pread_reader on a Linux io_uring: the requests queued between two
+		 *  calls to wait() are submitted together, so that the device works on
+		 *  all of them while the caller is blocked only until the first one
+		 *  completes. When the kernel does not allow io_uring, or does not
+		 *  support IORING_OP_READ (before Linux 5.6), it reads with pread()
+		 *  instead.
+		 */
+		class io_uring_reader
+		{
+		public:
+			explicit io_uring_reader(unsigned depth)
+				: _fallback(depth), _ring(-1), _sq(MAP_FAILED), _cq(MAP_FAILED),
+				  _sqes(MAP_FAILED), _sq_size(), _cq_size(), _sqes_size(),
+				  _sq_tail(), _sq_mask(), _sq_array(), _cq_head(), _cq_tail(),
+				  _cq_mask(), _cqes(), _to_submit(), _requests(), _free(), _done()
+			{
+				io_uring_params p;
+				std::memset(&p, 0, sizeof(p));
+				int fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &p));
+				if (fd < 0) { return; }
+				_ring = fd;
+				if (!_supported(IORING_OP_READ))
+				{
+					_unmap();
+					return;
+				}
+				_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+				_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+				if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0)
+				{
+					if (_cq_size > _sq_size) { _sq_size = _cq_size; }
+					_cq_size = 0;
+				}
+				_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+				_sq = ::mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE,
+				             MAP_SHARED | MAP_POPULATE, _ring,
+				             static_cast<off_t>(IORING_OFF_SQ_RING));
+				_cq = (_cq_size == 0) ? _sq
+					: ::mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE,
+					         MAP_SHARED | MAP_POPULATE, _ring,
+					         static_cast<off_t>(IORING_OFF_CQ_RING));
+				_sqes = ::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+				               MAP_SHARED | MAP_POPULATE, _ring,
+				               static_cast<off_t>(IORING_OFF_SQES));
+				if (_sq == MAP_FAILED || _cq == MAP_FAILED || _sqes == MAP_FAILED)
+				{
+					_unmap();
+					return;
+				}
+				unsigned char* sq = static_cast<unsigned char*>(_sq);
+				unsigned char* cq = static_cast<unsigned char*>(_cq);
+				_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+				_sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+				_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+				_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+				_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+				_cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+				_cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+				try
+				{
+					_requests.resize(p.sq_entries);
+					_free.reserve(p.sq_entries);
+					_done.reserve(p.sq_entries);
+				}
+				catch (...) { _unmap(); throw; }
+				for (unsigned i = p.sq_entries; i-- != 0;) { _free.push_back(i); }
+			}
+
+			~io_uring_reader()
+			{
+				drain();
+				_unmap();
+			}
+
+			io_uring_reader(const io_uring_reader&) = delete;
+			io_uring_reader& operator=(const io_uring_reader&) = delete;
+
+			/**
+			 *  False if the kernel refused to set up the ring.
+			 */
+			bool available() const noexcept { return _ring >= 0; }
+
+			unsigned capacity() const noexcept
+			{
+				return available() ? static_cast<unsigned>(_requests.size())
+					: _fallback.capacity();
+			}
+
+			std::size_t pending() const noexcept
+			{
+				return available() ? _requests.size() - _free.size()
+					: _fallback.pending();
+			}
+
+			void read(const posix_file& file, void* buffer, std::size_t n,
+			          off_t offset, std::size_t tag)
+			{
+				if (!available())
+				{
+					_fallback.read(file, buffer, n, offset, tag);
+					return;
+				}
+				unsigned slot = _free.back();
+				_free.pop_back();
+				_requests[slot] = request{&file, buffer, n, offset, tag};
+				unsigned tail = *_sq_tail;
+				unsigned index = tail & _sq_mask;
+				io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_sqes) + index;
+				std::memset(sqe, 0, sizeof(*sqe));
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = file.descriptor();
+				sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+				sqe->len = static_cast<std::uint32_t>(n);
+				sqe->off = static_cast<std::uint64_t>(offset);
+				sqe->user_data = slot;
+				_sq_array[index] = index;
+				__atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+				++_to_submit;
+			}
+
+			/**
+			 *  Submit the queued requests and wait for at least one completion.
+			 *  A request that failed throws std::system_error once all available
+			 *  completions are processed, as does a ring that cannot be entered,
+			 *  since no completion would ever arrive.
+			 */
+			template<typename Completed>
+			void wait(Completed completed)
+			{
+				if (!available())
+				{
+					_fallback.wait(completed);
+					return;
+				}
+				if (pending() == 0) { return; }
+				if (!_enter(1))
+				{
+					throw std::system_error(errno, std::generic_category(),
+					                        "io_uring_enter");
+				}
+				int error = 0;
+				unsigned head = *_cq_head;
+				unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+				for (; head != tail; ++head)
+				{
+					const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+					unsigned slot = static_cast<unsigned>(cqe.user_data);
+					request r = _requests[slot];
+					_free.push_back(slot);
+					if (cqe.res < 0) { error = -cqe.res; continue; }
+					std::size_t done = static_cast<std::size_t>(cqe.res);
+					try
+					{
+						// regular files only return short reads at their end
+						if (done < r.n)
+						{
+							r.file->read_at(static_cast<char*>(r.buffer) + done,
+							                r.n - done,
+							                r.offset + static_cast<off_t>(done));
+						}
+					}
+					catch (const std::system_error& e)
+					{ error = e.code().value(); continue; }
+					catch (...) { error = EIO; continue; }
+					_done.push_back(r.tag);
+				}
+				__atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+				if (error != 0)
+				{
+					_done.clear();
+					throw std::system_error(error, std::generic_category(), "io_uring");
+				}
+				for (std::size_t tag : _done) { completed(tag); }
+				_done.clear();
+			}
+
+			/**
+			 *  Wait for all submitted requests, ignoring their results, so that
+			 *  the kernel no longer writes to their buffers.
+			 */
+			void drain() noexcept
+			{
+				if (!available())
+				{
+					_fallback.drain();
+					return;
+				}
+				while (pending() != 0)
+				{
+					if (!_enter(1)) { return; }
+					unsigned head = *_cq_head;
+					unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+					for (; head != tail; ++head)
+					{
+						_free.push_back(static_cast<unsigned>
+						                (_cqes[head & _cq_mask].user_data));
+					}
+					__atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+				}
+			}
+
+		private:
+			struct request
+			{
+				const posix_file* file;
+				void* buffer;
+				std::size_t n;
+				off_t offset;
+				std::size_t tag;
+			};
+
+			/**
+			 *  True if the ring supports opcode. Kernels that cannot be probed
+			 *  predate the probe, and IORING_OP_READ with it.
+			 */
+			bool _supported(unsigned opcode) const
+			{
+				constexpr unsigned ops = 256;
+				// io_uring_probe is followed by its ops, and as large as two of them
+				static_assert(sizeof(io_uring_probe) == 2 * sizeof(io_uring_probe_op),
+				              "unexpected io_uring_probe layout");
+				std::vector<io_uring_probe_op> buffer(2 + ops);
+				io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+				if (::syscall(__NR_io_uring_register, _ring, IORING_REGISTER_PROBE,
+				              probe, ops) < 0)
+				{ return false; }
+				return opcode < probe->ops_len
+					&& (buffer[2 + opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+			}
+
+			/**
+			 *  Submit the queued requests and wait for min_complete completions.
+			 *  While the kernel is short of resources (EAGAIN, EBUSY), return
+			 *  early if there are completions to reap, which frees them, or
+			 *  retry with an exponential backoff. False, with errno set, on
+			 *  failure or once the backoff gives up.
+			 */
+			bool _enter(unsigned min_complete) noexcept
+			{
+				long backoff = 1000; // nanoseconds
+				for (;;)
+				{
+					long r = ::syscall(__NR_io_uring_enter, _ring, _to_submit,
+					                   min_complete, IORING_ENTER_GETEVENTS,
+					                   nullptr, 0);
+					if (r >= 0)
+					{
+						_to_submit -= static_cast<unsigned>(r);
+						return true;
+					}
+					int error = errno;
+					if (error == EINTR) { continue; }
+					if (error != EAGAIN && error != EBUSY) { return false; }
+					if (*_cq_head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+					{ return true; }
+					if (backoff > 100000000) { return false; }
+					timespec pause = {0, backoff};
+					::nanosleep(&pause, nullptr);
+					backoff *= 2;
+				}
+			}
+
+			void _unmap() noexcept
+			{
+				if (_sqes != MAP_FAILED) { ::munmap(_sqes, _sqes_size); }
+				if (_cq != MAP_FAILED && _cq != _sq) { ::munmap(_cq, _cq_size); }
+				if (_sq != MAP_FAILED) { ::munmap(_sq, _sq_size); }
+				if (_ring >= 0) { ::close(_ring); }
+				_sq = _cq = _sqes = MAP_FAILED;
+				_ring = -1;
+			}
+
+			pread_reader _fallback;
+			int _ring;
+			void* _sq;
+			void* _cq;
+			void* _sqes;
+			std::size_t _sq_size;
+			std::size_t _cq_size;
+			std::size_t _sqes_size;
+			unsigned* _sq_tail;
+			unsigned _sq_mask;
+			unsigned* _sq_array;
+			unsigned* _cq_head;
+			unsigned* _cq_tail;
+			unsigned _cq_mask;
+			io_uring_cqe* _cqes;
+			unsigned _to_submit;
+			std::vector<request> _requests;
+			std::vector<unsigned> _free;
+			std::vector<std::size_t> _done;
+		};
+
+		typedef io_uring_reader default_page_reader;
+#else
+		typedef pread_reader default_page_reader;
+#endif
+	}
+}
+
+#endif
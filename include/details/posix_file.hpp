@@ -0,0 +1,81 @@
+#ifndef POSIX_FILE_HPP
+#define POSIX_FILE_HPP
+
+#include <cstddef>
+#include <cerrno>
+#include <system_error>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+namespace kdtree_index
+{
+	namespace details
+	{
+		/**
+		 *  Owns a POSIX file descriptor. Reads and writes are positional, so
+		 *  they do not share a file offset. Failures throw std::system_error.
+		 */
+		class posix_file
+		{
+		public:
+			explicit posix_file(const char* path, int flags, mode_t mode = 0644)
+				: _fd(::open(path, flags | O_CLOEXEC, mode))
+			{
+				if (_fd < 0)
+				{ throw std::system_error(errno, std::generic_category(), path); }
+			}
+
+			~posix_file() { ::close(_fd); }
+
+			posix_file(const posix_file&) = delete;
+			posix_file& operator=(const posix_file&) = delete;
+
+			int descriptor() const noexcept { return _fd; }
+
+			/**
+			 *  Read exactly n bytes at offset, or throw if the file is shorter.
+			 */
+			void read_at(void* buffer, std::size_t n, off_t offset) const
+			{
+				char* p = static_cast<char*>(buffer);
+				while (n != 0)
+				{
+					ssize_t r = ::pread(_fd, p, n, offset);
+					if (r < 0)
+					{
+						if (errno == EINTR) { continue; }
+						throw std::system_error(errno, std::generic_category(), "pread");
+					}
+					if (r == 0) { throw std::runtime_error("pread: file is truncated"); }
+					p += r;
+					n -= static_cast<std::size_t>(r);
+					offset += static_cast<off_t>(r);
+				}
+			}
+
+			void write_at(const void* buffer, std::size_t n, off_t offset) const
+			{
+				const char* p = static_cast<const char*>(buffer);
+				while (n != 0)
+				{
+					ssize_t r = ::pwrite(_fd, p, n, offset);
+					if (r < 0)
+					{
+						if (errno == EINTR) { continue; }
+						throw std::system_error(errno, std::generic_category(), "pwrite");
+					}
+					p += r;
+					n -= static_cast<std::size_t>(r);
+					offset += static_cast<off_t>(r);
+				}
+			}
+
+		private:
+			int _fd;
+		};
+	}
+}
+
+#endif
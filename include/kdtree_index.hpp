@@ -4,17 +4,27 @@
 #include <type_traits>
 #include <memory>
 #include <iterator>
+#include <utility>
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <vector>
 #include "details/bitwise.hpp"
+#include "details/neighbors.hpp"
 
 namespace kdtree_index
 {
 	typedef std::size_t dimension_type;
 
 	template<dimension_type K>
-	dimension_type inc(dimension_type d) noexcept { return (d + 1) % K; }
+	dimension_type inc(dimension_type d) noexcept { return (d + 1 == K) ? 0 : d + 1; }
 
 	struct null_type { };
 
@@ -123,6 +133,257 @@ namespace kdtree_index
 	               const Indexable& i) noexcept
 	{ return i.compare()(i.accessor()(d, a), i.accessor()(d, b)); }
 
+	/**
+	 *  Difference of the coordinates of a and b along dimension d, for values
+	 *  that are accessed with an accessor returning an arithmetic type.
+	 */
+	template<typename Accessor, typename Distance>
+	struct accessor_minus
+		: private Accessor
+	{
+		explicit accessor_minus(Accessor a = Accessor()) noexcept
+			: Accessor(a) { }
+
+		template<typename Value>
+		Distance operator()(dimension_type d, const Value& a, const Value& b)
+			const noexcept
+		{
+			return static_cast<Distance>(Accessor::operator()(d, a))
+				- static_cast<Distance>(Accessor::operator()(d, b));
+		}
+	};
+
+	/**
+	 *  Difference of the coordinates of a and b along dimension d, for values
+	 *  that can be accessed with the bracket operator.
+	 */
+	template<typename Distance>
+	struct bracket_minus
+	{
+		template<typename Value>
+		Distance operator()(dimension_type d, const Value& a, const Value& b)
+			const noexcept
+		{ return static_cast<Distance>(a[d]) - static_cast<Distance>(b[d]); }
+	};
+
+	/**
+	 *  The square of the euclidean distance. It is cheaper to compute than the
+	 *  euclidean distance and sorts values in the same order, so it should be
+	 *  prefered when the actual distance is not needed.
+	 *
+	 *  A metric must provide distance_to_key(), the distance between two values,
+	 *  and distance_to_plane(), the distance between a value and the plane
+	 *  orthogonal to dimension d that contains another value. The latter must
+	 *  never be greater than the former.
+	 */
+	template<typename Indexable, typename Distance, typename Diff>
+	class quadrance
+		: private Diff
+	{
+	public:
+		typedef typename Indexable::value_type value_type;
+		typedef Distance distance_type;
+		typedef Diff diff_type;
+
+		explicit quadrance(Diff d = Diff()) noexcept : Diff(d) { }
+
+		distance_type distance_to_key(const value_type& origin,
+		                              const value_type& key) const noexcept
+		{
+			distance_type sum = distance_to_plane(0, origin, key);
+			for (dimension_type d = 1; d < Indexable::kth(); ++d)
+			{ sum += distance_to_plane(d, origin, key); }
+			return sum;
+		}
+
+		distance_type distance_to_plane(dimension_type d,
+		                                const value_type& origin,
+		                                const value_type& key) const noexcept
+		{
+			distance_type diff = Diff::operator()(d, origin, key);
+			return diff * diff;
+		}
+
+		/**
+		 *  Distance between origin and the box bounded by the coordinates of
+		 *  low[d] and high[d] along each dimension d. Optional for a metric; used
+		 *  to prune sub-trees when the tree has a \ref box_cache.
+		 */
+		distance_type distance_to_box(const value_type& origin,
+		                              const value_type* low,
+		                              const value_type* high) const noexcept
+		{
+			distance_type sum = distance_type();
+			for (dimension_type d = 0; d < Indexable::kth(); ++d)
+			{
+				distance_type diff = Diff::operator()(d, origin, low[d]);
+				if (!(diff < distance_type()))
+				{
+					diff = Diff::operator()(d, origin, high[d]);
+					if (!(distance_type() < diff)) { continue; }
+				}
+				sum += diff * diff;
+			}
+			return sum;
+		}
+	};
+
+	/**
+	 *  The euclidean distance. See \ref quadrance for the requirements of a
+	 *  metric.
+	 */
+	template<typename Indexable, typename Distance, typename Diff>
+	class euclidean
+		: private Diff
+	{
+	public:
+		typedef typename Indexable::value_type value_type;
+		typedef Distance distance_type;
+		typedef Diff diff_type;
+
+		explicit euclidean(Diff d = Diff()) noexcept : Diff(d) { }
+
+		distance_type distance_to_key(const value_type& origin,
+		                              const value_type& key) const noexcept
+		{
+			using std::sqrt;
+			distance_type diff = Diff::operator()(0, origin, key);
+			distance_type sum = diff * diff;
+			for (dimension_type d = 1; d < Indexable::kth(); ++d)
+			{
+				diff = Diff::operator()(d, origin, key);
+				sum += diff * diff;
+			}
+			return sqrt(sum);
+		}
+
+		distance_type distance_to_plane(dimension_type d,
+		                                const value_type& origin,
+		                                const value_type& key) const noexcept
+		{
+			using std::abs;
+			return abs(Diff::operator()(d, origin, key));
+		}
+
+		distance_type distance_to_box(const value_type& origin,
+		                              const value_type* low,
+		                              const value_type* high) const noexcept
+		{
+			using std::sqrt;
+			distance_type sum = distance_type();
+			for (dimension_type d = 0; d < Indexable::kth(); ++d)
+			{
+				distance_type diff = Diff::operator()(d, origin, low[d]);
+				if (!(diff < distance_type()))
+				{
+					diff = Diff::operator()(d, origin, high[d]);
+					if (!(distance_type() < diff)) { continue; }
+				}
+				sum += diff * diff;
+			}
+			return sqrt(sum);
+		}
+	};
+
+	/**
+	 *  The manhattan distance, or taxicab distance. See \ref quadrance for the
+	 *  requirements of a metric.
+	 */
+	template<typename Indexable, typename Distance, typename Diff>
+	class manhattan
+		: private Diff
+	{
+	public:
+		typedef typename Indexable::value_type value_type;
+		typedef Distance distance_type;
+		typedef Diff diff_type;
+
+		explicit manhattan(Diff d = Diff()) noexcept : Diff(d) { }
+
+		distance_type distance_to_key(const value_type& origin,
+		                              const value_type& key) const noexcept
+		{
+			distance_type sum = distance_to_plane(0, origin, key);
+			for (dimension_type d = 1; d < Indexable::kth(); ++d)
+			{ sum += distance_to_plane(d, origin, key); }
+			return sum;
+		}
+
+		distance_type distance_to_plane(dimension_type d,
+		                                const value_type& origin,
+		                                const value_type& key) const noexcept
+		{
+			using std::abs;
+			return abs(Diff::operator()(d, origin, key));
+		}
+
+		distance_type distance_to_box(const value_type& origin,
+		                              const value_type* low,
+		                              const value_type* high) const noexcept
+		{
+			using std::abs;
+			distance_type sum = distance_type();
+			for (dimension_type d = 0; d < Indexable::kth(); ++d)
+			{
+				distance_type diff = Diff::operator()(d, origin, low[d]);
+				if (!(diff < distance_type()))
+				{
+					diff = Diff::operator()(d, origin, high[d]);
+					if (!(distance_type() < diff)) { continue; }
+				}
+				sum += abs(diff);
+			}
+			return sum;
+		}
+	};
+
+	/**
+	 *  Strategy for nearest neighbor searches: explore the closest side of each
+	 *  node first, then backtrack to the far side if it may still hold closer
+	 *  values. Does not allocate memory when looking for a single neighbor.
+	 */
+	struct depth_first { };
+
+	/**
+	 *  Strategy for nearest neighbor searches: always expand the pending
+	 *  sub-tree with the smallest lower bound distance to the origin, using a
+	 *  priority queue. Good results are found earlier than with \ref
+	 *  depth_first, which matters when \ref checks is used to bound the search.
+	 *
+	 *  If checks is not 0, the search stops after examining that many values
+	 *  and returns the best candidates found so far, which may not be exact.
+	 */
+	struct best_bin_first
+	{
+		explicit best_bin_first(std::size_t c = 0) noexcept : checks(c) { }
+		std::size_t checks;
+	};
+
+	/**
+	 *  Strategy for \ref kdtree::find(): descend a single path, moving left or
+	 *  right with arithmetic on the position of the node rather than with
+	 *  branches, and compare the value for equality once at the end. Only when
+	 *  the path goes through a node equivalent to the value along its dimension
+	 *  but not equal to it are both sides of that node searched, as with the
+	 *  default strategy. Pays off on random queries against keys with few
+	 *  duplicates along each dimension, such as floating point coordinates.
+	 */
+	struct branchless { };
+
+	/**
+	 *  Strategy for looking up a sequence of values with \ref kdtree::find():
+	 *  the values are taken group by group and the \ref branchless descents of
+	 *  a group advance in turn, one level at a time. The next node of each
+	 *  descent is prefetched while the other descents of the group move, so
+	 *  that the cache misses of the group overlap instead of stalling each
+	 *  lookup in turn. Pays off once the tree no longer fits in the cache.
+	 */
+	struct interleaved
+	{
+		explicit interleaved(std::size_t g = 16) noexcept : group(g) { }
+		std::size_t group;
+	};
+
 	/**
 	 *  State is based on unsigned char; the smallest directly addressable
 	 *  type. This leads to good balance between waste of memory (6 bits per
@@ -324,25 +585,277 @@ namespace kdtree_index
 	{ return (d + 1) / 4; }
 
 	/**
-	 *  find the sub-tree with the maximum root value along dimension k.
+	 *  First element of the sub-tree rooted at x, whose children are at offset
+	 *  o. Sub-trees are contiguous in the in-order layout of the tree.
 	 */
-	template<typename ValuePtr, typename StatePtr, typename Indexable>
+	template<typename ValuePtr, typename StatePtr>
+	inline kdtree_iterator<ValuePtr, StatePtr>
+	subtree_begin(const kdtree_iterator<ValuePtr, StatePtr>& x,
+	              typename kdtree_iterator<ValuePtr, StatePtr>::difference_type o)
+		noexcept
+	{ return x - ((o == 0) ? 0 : 2 * o - 1); }
+
+	/**
+	 *  Past-the-end element of the sub-tree rooted at x, whose children are at
+	 *  offset o.
+	 */
+	template<typename ValuePtr, typename StatePtr>
+	inline kdtree_iterator<ValuePtr, StatePtr>
+	subtree_end(const kdtree_iterator<ValuePtr, StatePtr>& x,
+	            typename kdtree_iterator<ValuePtr, StatePtr>::difference_type o)
+		noexcept
+	{ return x + ((o == 0) ? 1 : 2 * o); }
+
+	namespace details
+	{
+		/**
+		 *  The dimension of a child node in a tree that splits dimensions in
+		 *  turn, given the dimension of its parent.
+		 */
+		template<dimension_type K>
+		struct next_dim
+		{
+			template<typename Iterator>
+			dimension_type operator()(const Iterator&, dimension_type parent_dim)
+				const noexcept
+			{ return inc<K>(parent_dim); }
+		};
+
+		/**
+		 *  The dimension of a child node in a tree that stores the dimension of
+		 *  each node in a side array, parallel to the states of the nodes. Falls
+		 *  back on \ref next_dim when there is no side array.
+		 */
+		template<dimension_type K, typename Dim>
+		struct stored_dim
+		{
+			const Dim* dims;
+			const State* base;
+
+			template<typename Iterator>
+			dimension_type operator()(const Iterator& child,
+			                          dimension_type parent_dim) const noexcept
+			{
+				return (dims == nullptr) ? inc<K>(parent_dim)
+					: static_cast<dimension_type>
+					(dims[std::addressof(child->state()) - base]);
+			}
+		};
+
+		/**
+		 *  Tells whether a node holds a value that was not erased, for iterators
+		 *  over trees without tombstones.
+		 */
+		struct all_live
+		{
+			template<typename Iterator>
+			bool operator()(const Iterator&) const noexcept { return true; }
+		};
+
+		/**
+		 *  \ref all_live for a tree that marks its erased values in a side
+		 *  array, parallel to the states of the nodes; see \ref tombstones.
+		 */
+		struct live_node
+		{
+			const unsigned char* marks;
+			const State* base;
+
+			template<typename Iterator>
+			bool operator()(const Iterator& node) const noexcept
+			{
+				return marks == nullptr
+					|| marks[std::addressof(node->state()) - base] == 0;
+			}
+		};
+	}
+
+	namespace details
+	{
+		/**
+		 *  True when the dimension of every node is known at compile time from
+		 *  the dimension of its root and K is small enough for the kernels below,
+		 *  which instantiate one function per dimension.
+		 */
+		template<typename ChildDim, dimension_type K>
+		struct unrolled
+			: std::integral_constant<bool, std::is_same<ChildDim, next_dim<K>>::value
+			                         && (K <= 4)> { };
+
+		template<dimension_type D>
+		using dim_constant = std::integral_constant<dimension_type, D>;
+
+		/**
+		 *  Call f with d as a \ref dim_constant; d must be less than K, and K at
+		 *  most 4.
+		 */
+		template<dimension_type K, typename Function>
+		inline auto with_dim(dimension_type d, Function&& f)
+			-> decltype(f(dim_constant<0>()))
+		{
+			switch (d)
+			{
+			case 1: return f(dim_constant<1 % K>());
+			case 2: return f(dim_constant<2 % K>());
+			case 3: return f(dim_constant<3 % K>());
+			default: return f(dim_constant<0>());
+			}
+		}
+
+		/**
+		 *  True if a and b are equivalent along all dimensions from I to K
+		 *  excluded, except D.
+		 */
+		template<dimension_type D, dimension_type K, dimension_type I = 0>
+		struct equal_except
+		{
+			template<typename Value, typename Indexable>
+			static bool test(const Value& a, const Value& b,
+			                 const Indexable& index) noexcept
+			{
+				return (I == D || (!select_compare(I, a, b, index)
+				                   && !select_compare(I, b, a, index)))
+					&& equal_except<D, K, I + 1>::test(a, b, index);
+			}
+		};
+
+		template<dimension_type D, dimension_type K>
+		struct equal_except<D, K, K>
+		{
+			template<typename Value, typename Indexable>
+			static bool test(const Value&, const Value&, const Indexable&) noexcept
+			{ return true; }
+		};
+
+		/**
+		 *  Hint that the memory at p will be read soon.
+		 */
+		inline void prefetch(const void* p) noexcept
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			__builtin_prefetch(p);
+#else
+			static_cast<void>(p);
+#endif
+		}
+
+		/**
+		 *  \ref minimum for a sub-tree whose root splits dimension D, with both
+		 *  dimensions known at compile time.
+		 */
+		template<dimension_type F, dimension_type D, typename Iterator,
+		         typename Indexable>
+		inline Iterator
+		minimum_at(typename Iterator::difference_type node_offset, Iterator node,
+		           const Indexable& index) noexcept
+		{
+			constexpr dimension_type next = (D + 1) % Indexable::kth();
+			Iterator best = node;
+			if (node_offset > 1)
+			{
+				auto child_offset = node_offset / 2;
+				Iterator child = minimum_at<F, next>(child_offset,
+				                                     left(node, node_offset), index);
+				if (!select_compare(F, best->value(), child->value(), index))
+				{ best = child; }
+				if (D == F) { return best; }
+				child = minimum_at<F, next>(child_offset, right(node, node_offset),
+				                            index);
+				if (!select_compare(F, best->value(), child->value(), index))
+				{ best = child; }
+			}
+			else if (node_offset == 1)
+			{
+				Iterator child = left(node, node_offset);
+				if (child->is_valid()
+				    && !select_compare(F, best->value(), child->value(), index))
+				{ best = child; }
+				child = right(node, node_offset);
+				if (child->is_valid()
+				    && !select_compare(F, best->value(), child->value(), index))
+				{ best = child; }
+			}
+			return best;
+		}
+
+		/**
+		 *  \ref maximum for a sub-tree whose root splits dimension D, with both
+		 *  dimensions known at compile time.
+		 */
+		template<dimension_type F, dimension_type D, typename Iterator,
+		         typename Indexable>
+		inline Iterator
+		maximum_at(typename Iterator::difference_type node_offset, Iterator node,
+		           const Indexable& index) noexcept
+		{
+			constexpr dimension_type next = (D + 1) % Indexable::kth();
+			Iterator best = node;
+			if (node_offset > 1)
+			{
+				auto child_offset = node_offset / 2;
+				Iterator child = maximum_at<F, next>(child_offset,
+				                                     right(node, node_offset), index);
+				if (!select_compare(F, child->value(), best->value(), index))
+				{ best = child; }
+				if (D == F) { return best; }
+				child = maximum_at<F, next>(child_offset, left(node, node_offset),
+				                            index);
+				if (!select_compare(F, child->value(), best->value(), index))
+				{ best = child; }
+			}
+			else if (node_offset == 1)
+			{
+				Iterator child = left(node, node_offset);
+				if (child->is_valid()
+				    && !select_compare(F, child->value(), best->value(), index))
+				{ best = child; }
+				child = right(node, node_offset);
+				if (child->is_valid()
+				    && !select_compare(F, child->value(), best->value(), index))
+				{ best = child; }
+			}
+			return best;
+		}
+	}
+
+	template<typename ValuePtr, typename StatePtr, typename Indexable,
+	         typename ChildDim>
+	inline kdtree_iterator<ValuePtr, StatePtr>
+	minimum(dimension_type fixed_dim, dimension_type node_dim,
+	        typename kdtree_iterator<ValuePtr, StatePtr>
+	        ::difference_type node_offset,
+	        kdtree_iterator<ValuePtr, StatePtr> node,
+	        const Indexable& index, const ChildDim&, std::true_type) noexcept
+	{
+		using iterator = kdtree_iterator<ValuePtr, StatePtr>;
+		constexpr dimension_type K = Indexable::kth();
+		return details::with_dim<K>(fixed_dim, [&](auto f)
+		{
+			return details::with_dim<K>(node_dim, [&](auto d)
+			{
+				return details::minimum_at<decltype(f)::value, decltype(d)::value,
+				                           iterator>(node_offset, node, index);
+			});
+		});
+	}
+
+	template<typename ValuePtr, typename StatePtr, typename Indexable,
+	         typename ChildDim>
 	inline kdtree_iterator<ValuePtr, StatePtr>
 	minimum(dimension_type fixed_dim, dimension_type node_dim,
 	        typename kdtree_iterator<ValuePtr, StatePtr>
 	        ::difference_type node_offset,
 	        kdtree_iterator<ValuePtr, StatePtr> node,
-	        const Indexable& index) noexcept
+	        const Indexable& index, const ChildDim& dims, std::false_type) noexcept
 	{
 		using iterator = kdtree_iterator<ValuePtr, StatePtr>;
 		iterator best = node;
 		while (node_offset > 1)
 		{
-			iterator child;
-			dimension_type child_dim = inc<Indexable::kth()>(node_dim);
 			typename iterator::difference_type child_offset = node_offset / 2;
-			child = minimum(fixed_dim, child_dim, child_offset,
-			                left(node, node_offset), index);
+			iterator child = left(node, node_offset);
+			child = minimum(fixed_dim, dims(child, node_dim), child_offset,
+			                child, index, dims, std::false_type());
 			if (!select_compare(fixed_dim, best->value(), child->value(), index))
 			{ best = child; }
 			if (node_dim == fixed_dim)
@@ -350,8 +863,8 @@ namespace kdtree_index
 			child = right(node, node_offset);
 			if (!select_compare(fixed_dim, best->value(), child->value(), index))
 			{ best = child; }
+			node_dim = dims(child, node_dim);
 			node = child;
-			node_dim = child_dim;
 			node_offset = child_offset;
 		}
 		if (node_offset == 1)
@@ -368,26 +881,44 @@ namespace kdtree_index
 		return best;
 	}
 
-	/**
-	 *  find the sub-tree with the maximum root value along dimension k.
-	 */
-	template<typename ValuePtr, typename StatePtr, typename Indexable>
+	template<typename ValuePtr, typename StatePtr, typename Indexable,
+	         typename ChildDim>
+	inline kdtree_iterator<ValuePtr, StatePtr>
+	maximum(dimension_type fixed_dim, dimension_type node_dim,
+	        typename kdtree_iterator<ValuePtr, StatePtr>
+	        ::difference_type node_offset,
+	        kdtree_iterator<ValuePtr, StatePtr> node,
+	        const Indexable& index, const ChildDim&, std::true_type) noexcept
+	{
+		using iterator = kdtree_iterator<ValuePtr, StatePtr>;
+		constexpr dimension_type K = Indexable::kth();
+		return details::with_dim<K>(fixed_dim, [&](auto f)
+		{
+			return details::with_dim<K>(node_dim, [&](auto d)
+			{
+				return details::maximum_at<decltype(f)::value, decltype(d)::value,
+				                           iterator>(node_offset, node, index);
+			});
+		});
+	}
+
+	template<typename ValuePtr, typename StatePtr, typename Indexable,
+	         typename ChildDim>
 	inline kdtree_iterator<ValuePtr, StatePtr>
 	maximum(dimension_type fixed_dim, dimension_type node_dim,
 	        typename kdtree_iterator<ValuePtr, StatePtr>
 	        ::difference_type node_offset,
 	        kdtree_iterator<ValuePtr, StatePtr> node,
-	        const Indexable& index) noexcept
+	        const Indexable& index, const ChildDim& dims, std::false_type) noexcept
 	{
 		using iterator = kdtree_iterator<ValuePtr, StatePtr>;
 		iterator best = node;
 		while (node_offset > 1)
 		{
-			iterator child;
-			dimension_type child_dim = inc<Indexable::kth()>(node_dim);
 			typename iterator::difference_type child_offset = node_offset / 2;
-			child = maximum(fixed_dim, child_dim, child_offset,
-			                right(node, node_offset), index);
+			iterator child = right(node, node_offset);
+			child = maximum(fixed_dim, dims(child, node_dim), child_offset,
+			                child, index, dims, std::false_type());
 			if (!select_compare(fixed_dim, child->value(), best->value(), index))
 			{ best = child; }
 			if (node_dim == fixed_dim)
@@ -395,8 +926,8 @@ namespace kdtree_index
 			child = left(node, node_offset);
 			if (!select_compare(fixed_dim, child->value(), best->value(), index))
 			{ best = child; }
+			node_dim = dims(child, node_dim);
 			node = child;
-			node_dim = child_dim;
 			node_offset = child_offset;
 		}
 		if (node_offset == 1)
@@ -413,725 +944,4940 @@ namespace kdtree_index
 		return best;
 	}
 
-	template<typename Index,
-	         typename Alloc = std::allocator<typename Index::value_type>>
-	class kdtree
+	/**
+	 *  find the sub-tree with the minimum root value along dimension k.
+	 */
+	template<typename ValuePtr, typename StatePtr, typename Indexable,
+	         typename ChildDim = details::next_dim<Indexable::kth()>>
+	inline kdtree_iterator<ValuePtr, StatePtr>
+	minimum(dimension_type fixed_dim, dimension_type node_dim,
+	        typename kdtree_iterator<ValuePtr, StatePtr>
+	        ::difference_type node_offset,
+	        kdtree_iterator<ValuePtr, StatePtr> node,
+	        const Indexable& index, const ChildDim& dims = ChildDim()) noexcept
 	{
-	public:
-		using indexable_type = Index;
-		using value_type = typename indexable_type::value_type;
-		using state_type = State;
-		using allocator_type = Alloc;
+		return minimum(fixed_dim, node_dim, node_offset, node, index, dims,
+		               details::unrolled<ChildDim, Indexable::kth()>());
+	}
 
-	private:
-		using value_alloc_type = typename std::allocator_traits<Alloc>
-			::template rebind_alloc<value_type>;
-		using state_alloc_type = typename std::allocator_traits<Alloc>
-			::template rebind_alloc<state_type>;
-		using value_alloc_traits = std::allocator_traits<value_alloc_type>;
-		using state_alloc_traits = std::allocator_traits<state_alloc_type>;
-		using value_pointer = typename value_alloc_traits::pointer;
-		using const_value_pointer = typename value_alloc_traits::const_pointer;
-		using state_pointer = typename state_alloc_traits::pointer;
-		using const_state_pointer = typename state_alloc_traits::const_pointer;
+	/**
+	 *  find the sub-tree with the maximum root value along dimension k.
+	 */
+	template<typename ValuePtr, typename StatePtr, typename Indexable,
+	         typename ChildDim = details::next_dim<Indexable::kth()>>
+	inline kdtree_iterator<ValuePtr, StatePtr>
+	maximum(dimension_type fixed_dim, dimension_type node_dim,
+	        typename kdtree_iterator<ValuePtr, StatePtr>
+	        ::difference_type node_offset,
+	        kdtree_iterator<ValuePtr, StatePtr> node,
+	        const Indexable& index, const ChildDim& dims = ChildDim()) noexcept
+	{
+		return maximum(fixed_dim, node_dim, node_offset, node, index, dims,
+		               details::unrolled<ChildDim, Indexable::kth()>());
+	}
 
-	public:
-		using iterator = kdtree_iterator<value_pointer, state_pointer>;
-		using const_iterator = kdtree_iterator<const_value_pointer, const_state_pointer>;
+	/**
+	 *  Augmentation policy for \ref kdtree: keep the bounding box of each
+	 *  sub-tree in the Levels top levels of the tree, or of every sub-tree by
+	 *  default. Range and nearest neighbor queries skip the sub-trees whose box
+	 *  is outside the query, which prunes much more than the splitting planes
+	 *  alone on clustered data.
+	 *
+	 *  Boxes grow when values are inserted in a sub-tree but do not shrink when
+	 *  values leave it during rebalancing, so they may become loose; they are
+	 *  recomputed each time the tree expands. Each box holds 2 * K copies of
+	 *  values.
+	 */
+	template<std::size_t Levels = ~std::size_t(0)>
+	struct box_cache { };
 
-	private:
-		struct _kdtree_members
-			: indexable_type, value_alloc_type, state_alloc_type
-		{
-			iterator _start;          // first of value & state
-			iterator _finish;         // last of value & state
-			std::size_t _capacity;    // total storage capacity
-			std::size_t _count;       // fast count for O(1) access
-			state_type _full_state;   // State indicating a perfectly balanced tree
+	/**
+	 *  Augmentation policy for \ref kdtree: keep the aggregate of the values
+	 *  of each sub-tree in the Levels top levels of the tree, or of every
+	 *  sub-tree by default, so that \ref kdtree::aggregate_in_range() answers
+	 *  for sub-trees fully contained in the range in O(1).
+	 *
+	 *  Monoid must provide:
+	 *  - result_type, the type of the aggregate,
+	 *  - identity(), the aggregate of no value,
+	 *  - operator()(value), the aggregate of a single value,
+	 *  - combine(a, b), the aggregate of the union of a and b,
+	 *  - remove(a, b), the aggregate of a without b, where b is part of a.
+	 *
+	 *  remove() is used to maintain the cache when values leave a sub-tree, so
+	 *  only invertible aggregates such as counts and sums can be cached.
+	 */
+	template<typename Monoid, std::size_t Levels = ~std::size_t(0)>
+	struct aggregate_cache { };
 
-			explicit _kdtree_members()
-			noexcept(std::is_nothrow_default_constructible<value_alloc_type>::value
-			         && std::is_nothrow_default_constructible<state_alloc_type>::value)
-			: indexable_type(), value_alloc_type(), state_alloc_type(),
-			  _start(), _finish(_start), _capacity(), _count(),
-			  _full_state(State::Heads) { }
+	/**
+	 *  Augmentation policy for \ref kdtree: keep, next to the values, a
+	 *  quantized copy of each coordinate as a Key, an unsigned integer type
+	 *  such as std::uint16_t. \ref kdtree::find() and \ref kdtree::range()
+	 *  then descend on the keys, which are denser in cache than the values,
+	 *  and only compare the values themselves when the keys are equal, and to
+	 *  confirm a match. Nearest neighbor searches need exact distances, so
+	 *  they do not use the keys.
+	 *
+	 *  Diff computes the difference between two values along a dimension as a
+	 *  Distance, a floating point type, like \ref bracket_minus. It must grow
+	 *  with the order of the values along that dimension.
+	 *
+	 *  The keys span the range of the values at the time the tree last
+	 *  expanded; values inserted outside of that range get the first or last
+	 *  key and are always compared exactly. The number of nodes visited and
+	 *  refined is available from \ref kdtree::augmentation().
+	 */
+	template<typename Key, typename Distance, typename Diff>
+	struct quantized_keys { };
 
-			explicit _kdtree_members(const indexable_type& i,
-			                         const value_alloc_type& a,
-			                         const state_alloc_type& s)
-				noexcept(std::is_nothrow_copy_constructible<value_alloc_type>::value
-				         && std::is_nothrow_copy_constructible<state_alloc_type>::value)
-				: indexable_type(i), value_alloc_type(a), state_alloc_type(s),
-				  _start(), _finish(_start), _capacity(), _count(),
-				  _full_state(State::Heads) { }
+	namespace details
+	{
+		/**
+		 *  Maps the sub-trees in the Levels top levels of a tree to consecutive
+		 *  indexes in breadth-first order. A sub-tree is identified by the
+		 *  position p of its root, the offset o of its children and the number of
+		 *  elements dist in the tree. Leaves are never mapped.
+		 */
+		template<std::size_t Levels>
+		class top_levels
+		{
+		public:
+			typedef std::ptrdiff_t difference_type;
 
-			_kdtree_members(const _kdtree_members& x)
-				noexcept(std::is_nothrow_copy_constructible<value_alloc_type>::value
-				         && std::is_nothrow_copy_constructible<state_alloc_type>::value)
-				: indexable_type(static_cast<const indexable_type&>(x)),
-				  value_alloc_type(static_cast<const value_alloc_type&>(x)),
-				  state_alloc_type(static_cast<const state_alloc_type&>(x)),
-				  _start(), _finish(_start), _capacity(), _count(),
-				  _full_state(x._full_state) { }
+			explicit top_levels() noexcept : _dist(), _min_offset(), _size() { }
 
-			_kdtree_members(_kdtree_members&& x)
-				noexcept(std::is_nothrow_move_constructible<value_alloc_type>::value
-				         && std::is_nothrow_move_constructible<state_alloc_type>::value)
-				: indexable_type(static_cast<indexable_type&&>(x)),
-				  value_alloc_type(static_cast<value_alloc_type&&>(x)),
-				  state_alloc_type(static_cast<state_alloc_type&&>(x)),
-				  _start(), _finish(_start), _capacity(), _count(),
-				  _full_state(State::Heads)
+			std::size_t size() const noexcept { return _size; }
+
+			/**
+			 *  Map the sub-trees of a tree of dist elements and return how many
+			 *  are mapped.
+			 */
+			std::size_t reset(difference_type dist) noexcept
 			{
-				std::swap(_start, x._start);
-				std::swap(_finish, x._finish);
-				std::swap(_capacity, x._capacity);
-				std::swap(_count, x._count);
-				std::swap(_full_state, x._full_state);
+				clear();
+				difference_type offset = root_offset(dist);
+				if (offset == 0) { return 0; }
+				std::size_t levels = 1;
+				for (; (offset >> levels) != 0 && levels < Levels; ++levels) { }
+				_dist = dist;
+				_min_offset = offset >> (levels - 1);
+				_size = (std::size_t(1) << levels) - 1;
+				return _size;
 			}
-		} _impl;
 
-		value_alloc_type& _get_value_alloc() noexcept
-		{ return static_cast<value_alloc_type&>(_impl); }
-		const value_alloc_type& _get_value_alloc() const noexcept
-		{ return static_cast<value_alloc_type&>(_impl); }
-		state_alloc_type& _get_state_alloc() noexcept
-		{ return static_cast<state_alloc_type&>(_impl); }
-		const state_alloc_type& _get_state_alloc() const noexcept
-		{ return static_cast<state_alloc_type&>(_impl); }
+			void clear() noexcept
+			{
+				_dist = 0;
+				_min_offset = 0;
+				_size = 0;
+			}
 
-		/**
-		 *  Create initial storage for the flat tree. Always allocate the smallest
-		 *  power of 2 that fits the requested size so that a perfectly balanced
-		 *  tree fits in.
-		 *
-		 *  _alloc_storage may throw but will leave the tree in a consistent state
-		 *  if it does.
-		 */
-		void _alloc_storage(std::size_t n)
-		{
-			if (n == 0) { return; }
-			n = details::bitwise<std::size_t>::ftz(n);
-			value_pointer v = value_alloc_traits::allocate(_get_value_alloc(), n);
-			state_pointer s;
-			try
-			{ s = state_alloc_traits::allocate(_get_state_alloc(), n); }
-			catch(...)
+			/**
+			 *  The index of a sub-tree, or size() if it is not mapped.
+			 */
+			std::size_t index(difference_type p, difference_type o,
+			                  difference_type dist) const noexcept
 			{
-				value_alloc_traits::deallocate(_get_value_alloc(), v, n);
-				throw;
+				if (o == 0 || o < _min_offset || dist != _dist) { return _size; }
+				return static_cast<std::size_t>
+					((dist + 1) / (4 * o) - 1 + (p + 1) / (4 * o));
 			}
-			_impl._capacity = n;
-			_impl._start.reset(v, s);
-			_impl._finish = _impl._start;
-		}
 
-		void _dealloc_storage() noexcept
-		{
-			value_alloc_traits::deallocate
-				(_get_value_alloc(), _impl._start->value_ptr(), _impl._capacity);
-			state_alloc_traits::deallocate
-				(_get_state_alloc(), _impl._start->state_ptr(), _impl._capacity);
-			_impl._capacity = 0;
-		}
+			/**
+			 *  The position of the sub-tree at index i; its offset is stored in o.
+			 */
+			difference_type position(std::size_t i, difference_type& o)
+				const noexcept
+			{
+				std::size_t width = 1;
+				for (; width * 2 <= i + 1; width *= 2) { }
+				o = root_offset(_dist) / static_cast<difference_type>(width);
+				return 4 * o * static_cast<difference_type>(i + 1 - width) + 2 * o - 1;
+			}
+
+			/**
+			 *  True if the sub-tree is in the deepest mapped level; the children of
+			 *  other mapped sub-trees at index i are at 2 * i + 1 and 2 * i + 2.
+			 */
+			bool deepest(difference_type o) const noexcept
+			{ return o == _min_offset; }
+
+		private:
+			difference_type _dist;
+			difference_type _min_offset;
+			std::size_t _size;
+		};
 
 		/**
-		 *  Expand the tree by inserting a Invalid value between each exisiting values. Can
-		 *  expand with overlapping memory segments.
+		 *  Storage for the augmentation of a tree. The tree notifies it when a
+		 *  value enters or leaves the sub-tree rooted at position p, whose
+		 *  children are at offset o, in a tree of dist elements. rebuild() is
+		 *  called when all values have moved, moved() when a single one has, and
+		 *  clear() when they are destroyed. Erased values neither enter nor
+		 *  leave sub-trees, and rebuild() is given a predicate that is false for
+		 *  the nodes holding them.
+		 *  Augmentations derive from this one, which does nothing.
 		 */
-		void _expand(value_pointer vp, state_pointer cp) noexcept
+		template<typename Indexable>
+		struct no_augment
 		{
-			auto offset = (_impl._finish - _impl._start) * 2;
-			iterator slow(_impl._finish);
-			iterator first(vp, cp);
-			iterator last(vp + offset, cp + offset);
-			last->state() = State::Invalid;
-			while (last != first)
+			typedef std::ptrdiff_t difference_type;
+			typedef typename Indexable::value_type value_type;
+
+			void enter(difference_type, difference_type, difference_type,
+			           const value_type&, const Indexable&) noexcept { }
+			void leave(difference_type, difference_type, difference_type,
+			           const value_type&, const Indexable&) noexcept { }
+			template<typename Iterator, typename Live>
+			void rebuild(Iterator, difference_type, const Indexable&, Live) noexcept
+			{ }
+			void clear() noexcept { }
+
+			/**
+			 *  The value at position p has changed to v while the tree was not
+			 *  rebuilt.
+			 */
+			void moved(difference_type, const value_type&,
+			           const Indexable&) noexcept { }
+
+			/**
+			 *  The bounding box of a sub-tree, as K values holding the lower bounds
+			 *  followed by K values holding the higher bounds, or nullptr.
+			 */
+			const value_type* box(difference_type, difference_type,
+			                      difference_type) const noexcept
+			{ return nullptr; }
+
+			/**
+			 *  The aggregate of a sub-tree for monoid, or nullptr.
+			 */
+			template<typename Monoid>
+			const typename Monoid::result_type*
+			aggregate(difference_type, difference_type, difference_type,
+			          const Monoid&) const noexcept
+			{ return nullptr; }
+		};
+
+		template<typename Augment, typename Indexable, typename Alloc>
+		struct augment_data : no_augment<Indexable> { };
+
+		template<std::size_t Levels, typename Indexable, typename Alloc>
+		class augment_data<box_cache<Levels>, Indexable, Alloc>
+			: public no_augment<Indexable>
+		{
+		public:
+			typedef std::ptrdiff_t difference_type;
+			typedef typename Indexable::value_type value_type;
+
+			explicit augment_data() noexcept : _bounds(), _levels() { }
+
+			void enter(difference_type p, difference_type o, difference_type dist,
+			           const value_type& v, const Indexable& index) noexcept
 			{
-				--last; --slow;
-				last->state() = slow->state();
-				std::memcpy(last->value_ptr(), slow->value_ptr(), sizeof(value_type));
-				--last;
-				last->state() = State::Invalid;
+				value_type* b = _find(p, o, dist);
+				if (b == nullptr) { return; }
+				_expand(b, v, index);
 			}
-			_impl._finish.reset(vp + offset + 1, cp + offset + 1);
-		}
 
-		void _alloc_expand()
-		{
-			std::size_t n = (_impl._capacity * 2) + 1;
-			value_pointer vp = value_alloc_traits::allocate(_get_value_alloc(), n);
-			state_pointer cp;
-			try
-			{ cp = state_alloc_traits::allocate(_get_state_alloc(), n); }
-			catch (...)
+			/**
+			 *  Compute all boxes bottom-up: the deepest cached sub-trees are
+			 *  scanned, the others merge the boxes of their children.
+			 */
+			template<typename Iterator, typename Live>
+			void rebuild(Iterator start, difference_type dist,
+			             const Indexable& index, Live live)
 			{
-				value_alloc_traits::deallocate(_get_value_alloc(), vp, n);
-				throw;
+				clear();
+				std::size_t n = _levels.reset(dist);
+				if (n == 0) { return; }
+				constexpr dimension_type K = Indexable::kth();
+				try { _bounds.assign(n * 2 * K, root(start, dist)->value()); }
+				catch (...) { _levels.clear(); throw; }
+				for (std::size_t i = n; i-- != 0;)
+				{
+					difference_type o;
+					Iterator node = start + _levels.position(i, o);
+					value_type* b = &_bounds[i * 2 * K];
+					std::fill(b, b + 2 * K, node->value());
+					if (_levels.deepest(o))
+					{
+						Iterator last = subtree_end(node, o);
+						for (Iterator it = subtree_begin(node, o); it != last; ++it)
+						{
+							if (it->is_valid() && live(it))
+							{ _expand(b, it->value(), index); }
+						}
+					}
+					else
+					{
+						for (std::size_t c = 2 * i + 1; c != 2 * i + 3; ++c)
+						{
+							const value_type* cb = &_bounds[c * 2 * K];
+							for (dimension_type d = 0; d < K; ++d)
+							{
+								if (select_compare(d, cb[d], b[d], index)) { b[d] = cb[d]; }
+								if (select_compare(d, b[K + d], cb[K + d], index))
+								{ b[K + d] = cb[K + d]; }
+							}
+						}
+					}
+				}
 			}
-			// code above may throw but will leave the tree in a consistent state
-			_expand(vp, cp);
-			value_alloc_traits::deallocate(_get_value_alloc(),
-			                               _impl._start->value_ptr(), _impl._capacity);
-			state_alloc_traits::deallocate(_get_state_alloc(),
-			                               _impl._start->state_ptr(), _impl._capacity);
-			_impl._start.reset(vp, cp);
-			_impl._capacity = n;
-		}
 
-		iterator _alloc_insert(const value_type& val)
-		{
-			if (_impl._count == 0)
+			void clear() noexcept
 			{
-				if (_impl._capacity == 0)
-				{ _alloc_storage(1); }
-				_impl._finish = _impl._start + 1;
+				_bounds.clear();
+				_levels.clear();
 			}
-			else
-				if (_impl._count == static_cast<std::size_t>(_impl._finish - _impl._start))
+
+			const value_type* box(difference_type p, difference_type o,
+			                      difference_type dist) const noexcept
+			{ return const_cast<augment_data*>(this)->_find(p, o, dist); }
+
+		private:
+			value_type* _find(difference_type p, difference_type o,
+			                  difference_type dist) noexcept
+			{
+				std::size_t i = _levels.index(p, o, dist);
+				return (i == _levels.size()) ? nullptr
+					: &_bounds[i * 2 * Indexable::kth()];
+			}
+
+			static void _expand(value_type* b, const value_type& v,
+			                    const Indexable& index) noexcept
+			{
+				constexpr dimension_type K = Indexable::kth();
+				for (dimension_type d = 0; d < K; ++d)
 				{
-					if (_impl._count == _impl._capacity) { _alloc_expand(); }
-					else { _expand(_impl._start->value_ptr(), _impl._start->state_ptr()); }
-					_impl._full_state = ~_impl._full_state;
+					if (select_compare(d, v, b[d], index)) { b[d] = v; }
+					if (select_compare(d, b[K + d], v, index)) { b[K + d] = v; }
 				}
-			// code above may throw but will leave the tree in a consistent state
-			++_impl._count;
-			auto dist = _impl._finish - _impl._start;
-			return _place_insert(0, root_offset(dist), root(_impl._start, dist), val);
-		}
+			}
 
-		/**
-		 *  Collapse the tree by removing all leaves of the tree. The leaves' parent
-		 *  will become the new leaves. This operation corresponds exactly to
-		 *  removing one item between each item, collapsing the tree to half of its
-		 *  size.
-		 */
-		void _collapse() noexcept
+			std::vector<value_type, Alloc> _bounds;
+			top_levels<Levels> _levels;
+		};
+
+		template<typename Monoid, std::size_t Levels, typename Indexable,
+		         typename Alloc>
+		class augment_data<aggregate_cache<Monoid, Levels>, Indexable, Alloc>
+			: public no_augment<Indexable>
 		{
-			auto offset = (_impl.finish() - _impl.start()) / 2;
-			iterator fast(_impl._start->value_ptr(), _impl._start->state_ptr());
-			iterator first(fast);
-			iterator last(_impl._start->value_ptr() + offset,
-			              _impl._start->state_ptr() + offset);
-			++fast; // skip first;
-			while (last != first)
+			using result_alloc_type = typename std::allocator_traits<Alloc>
+				::template rebind_alloc<typename Monoid::result_type>;
+
+		public:
+			typedef std::ptrdiff_t difference_type;
+			typedef typename Indexable::value_type value_type;
+			typedef typename Monoid::result_type result_type;
+			using no_augment<Indexable>::aggregate;
+
+			explicit augment_data() noexcept : _aggregates(), _levels() { }
+
+			void enter(difference_type p, difference_type o, difference_type dist,
+			           const value_type& v, const Indexable&) noexcept
 			{
-				std::memcpy(first->value_ptr(), fast->value_ptr(), sizeof(value_type));
-				first->state() = fast->state();
-				++first;
-				fast += 2; // skip invalid states;
+				std::size_t i = _levels.index(p, o, dist);
+				if (i == _levels.size()) { return; }
+				_aggregates[i] = _monoid.combine(_aggregates[i], _monoid(v));
 			}
-			_impl._finish.reset(_impl._start->value_ptr() + offset,
-			                    _impl._start->state_ptr() + offset);
-		}
 
-		/**
-		 *  Destroy all items in the flat tree, calling the destructor for each
-		 *  value_type.
-		 *
-		 *  @note If a call to ~value_type() throws an exception, the program will
-		 *  terminate since it will violate the noexcept condition. Simply stated,
-		 *  value_type destructor is not allowed to throw.
-		 */
-		void _destroy() noexcept
-		{
-			for (iterator i = _impl._start; i != _impl._finish; ++i)
-			{ if (i->is_valid()) { i->value_ptr()->~value_type(); } }
-			_impl._finish = _impl._start;
-			_impl._count = 0;
-		}
+			void leave(difference_type p, difference_type o, difference_type dist,
+			           const value_type& v, const Indexable&) noexcept
+			{
+				std::size_t i = _levels.index(p, o, dist);
+				if (i == _levels.size()) { return; }
+				_aggregates[i] = _monoid.remove(_aggregates[i], _monoid(v));
+			}
+
+			/**
+			 *  Compute all aggregates bottom-up, in the same way as the boxes of
+			 *  \ref box_cache.
+			 */
+			template<typename Iterator, typename Live>
+			void rebuild(Iterator start, difference_type dist, const Indexable&,
+			             Live live)
+			{
+				clear();
+				std::size_t n = _levels.reset(dist);
+				if (n == 0) { return; }
+				try { _aggregates.assign(n, _monoid.identity()); }
+				catch (...) { _levels.clear(); throw; }
+				for (std::size_t i = n; i-- != 0;)
+				{
+					difference_type o;
+					Iterator node = start + _levels.position(i, o);
+					if (_levels.deepest(o))
+					{
+						result_type r = _monoid.identity();
+						Iterator last = subtree_end(node, o);
+						for (Iterator it = subtree_begin(node, o); it != last; ++it)
+						{
+							if (it->is_valid() && live(it))
+							{ r = _monoid.combine(r, _monoid(it->value())); }
+						}
+						_aggregates[i] = r;
+					}
+					else
+					{
+						result_type r = live(node)
+							? _monoid.combine(_aggregates[2 * i + 1], _monoid(node->value()))
+							: _aggregates[2 * i + 1];
+						_aggregates[i] = _monoid.combine(r, _aggregates[2 * i + 2]);
+					}
+				}
+			}
+
+			void clear() noexcept
+			{
+				_aggregates.clear();
+				_levels.clear();
+			}
+
+			const result_type* aggregate(difference_type p, difference_type o,
+			                             difference_type dist, const Monoid&)
+				const noexcept
+			{
+				std::size_t i = _levels.index(p, o, dist);
+				return (i == _levels.size()) ? nullptr : &_aggregates[i];
+			}
+
+		private:
+			Monoid _monoid;
+			std::vector<result_type, result_alloc_type> _aggregates;
+			top_levels<Levels> _levels;
+		};
+
+		template<typename Augment>
+		struct is_quantized : std::false_type { };
+
+		template<typename Key, typename Distance, typename Diff>
+		struct is_quantized<quantized_keys<Key, Distance, Diff>> : std::true_type
+		{ };
 
 		/**
-		 *  List initialization works with the average O(n.log(n)) algorithm. This
-		 *  algorithm may have worst case performance of O(n^2).
+		 *  The nodes visited by a query on quantized keys, and among them the
+		 *  ones whose values had to be compared.
 		 */
-		void _uninitialized_insert
-		(typename std::initializer_list<value_type>::iterator,
-		 typename std::initializer_list<value_type>::iterator)
-			noexcept(std::is_nothrow_copy_constructible<value_type>::value)
+		struct refine_count
 		{
-		}
+			std::size_t visited;
+			std::size_t refined;
+		};
 
 		/**
-		 *  This function is to be called only when node is free. It will find the
-		 *  position to insert value and set all nodes on the way to Unsure.
+		 *  A counter that concurrent queries on a const tree may increment.
 		 */
-		iterator _insert_when_free(dimension_type node_dim,
-		                           typename iterator::difference_type node_offset,
-		                           iterator node, const value_type& val)
-			const noexcept
+		class relaxed_counter
 		{
-			while (node_offset != 0)
+		public:
+			explicit relaxed_counter() noexcept : _n(0) { }
+			relaxed_counter(const relaxed_counter& x) noexcept : _n(x.get()) { }
+			relaxed_counter& operator=(const relaxed_counter& x) noexcept
 			{
-				node->state() = State::Neither;
-				if (select_compare(node_dim, val, node->value(), get_index()))
-				{ node = left(node, node_offset); }
-				else
-				{ node = right(node, node_offset); }
-				node_dim = inc<indexable_type::kth()>(node_dim);
-				node_offset = node_offset / 2;
+				_n.store(x.get(), std::memory_order_relaxed);
+				return *this;
 			}
-			node->state() = _impl._full_state;
-			return node;
-		}
 
-		/**
-		 *  Remove the node pointed to by \ref erase from the tree.
-		 *
-		 *  @note If @ref val throws during the call to its destructor, the program
-		 *  will terminate since it violates the noexcept policy. Simply stated,
-		 *  @ref value_type destructor should not throw.
-		 */
-		iterator _erase_iter(dimension_type node_dim,
-		                     typename iterator::difference_type offset,
-		                     const iterator& node,
-		                     const iterator& erase) const noexcept
+			void add(std::size_t n) noexcept
+			{ _n.fetch_add(n, std::memory_order_relaxed); }
+			std::size_t get() const noexcept
+			{ return _n.load(std::memory_order_relaxed); }
+			void reset() noexcept { _n.store(0, std::memory_order_relaxed); }
+
+		private:
+			std::atomic<std::size_t> _n;
+		};
+
+		template<typename Key, typename Distance, typename Diff,
+		         typename Indexable, typename Alloc>
+		class augment_data<quantized_keys<Key, Distance, Diff>, Indexable, Alloc>
+			: public no_augment<Indexable>
 		{
-			iterator moved_erase;
-			if (offset > 1)
+			static_assert(std::is_integral<Key>::value
+			              && std::is_unsigned<Key>::value,
+			              "Key must be an unsigned integer type");
+			static constexpr dimension_type K = Indexable::kth();
+			using key_alloc_type = typename std::allocator_traits<Alloc>
+				::template rebind_alloc<Key>;
+
+		public:
+			typedef std::ptrdiff_t difference_type;
+			typedef typename Indexable::value_type value_type;
+			typedef Key key_type;
+
+			explicit augment_data() noexcept
+				: _keys(), _origin(), _scale(), _dist(), _visited(), _refined() { }
+
+			void moved(difference_type p, const value_type& v,
+			           const Indexable&) noexcept
 			{
-				iterator lnode = left(node, offset);
-				iterator rnode = right(node, offset);
-				dimension_type child_dim = inc<indexable_type::kth()>(node_dim);
-				typename iterator::difference_type child_offset = offset / 2;
-				if (erase != node)
+				if (p < _dist)
+				{ quantize(v, &_keys[static_cast<std::size_t>(p) * K]); }
+			}
+
+			/**
+			 *  Span the keys over the range of the values along each dimension,
+			 *  then quantize all values, erased ones included since queries still
+			 *  descend through them.
+			 */
+			template<typename Iterator, typename Live>
+			void rebuild(Iterator start, difference_type dist,
+			             const Indexable& index, Live)
+			{
+				clear();
+				Iterator last = start + dist;
+				Iterator first = start;
+				for (; first != last && !first->is_valid(); ++first) { }
+				if (first == last) { return; }
+				const value_type* high[K];
+				std::fill(high, high + K, &first->value());
+				try
 				{
-					// go to erase by memory locality
-					if (erase < node)
+					_origin.assign(K, first->value());
+					_keys.assign(static_cast<std::size_t>(dist) * K, Key());
+				}
+				catch (...) { clear(); throw; }
+				for (Iterator it = first; it != last; ++it)
+				{
+					if (!it->is_valid()) { continue; }
+					for (dimension_type d = 0; d < K; ++d)
 					{
-						if (lnode->state() == ~_impl._full_state)
-						{
-							// Cannot erase in a free tree
-							_insert_when_free(child_dim, child_offset, lnode, node);
-							iterator tmp = minimum(node_dim, child_dim, child_offset,
-							                       rnode, get_index());
-							std::memcpy(node->value_ptr(), tmp->value_ptr(), sizeof(value_type));
-							_erase_iter(child_dim, child_offset, rnode, tmp);
-						}
-						else
-						{
-
-						}
+						if (select_compare(d, it->value(), _origin[d], index))
+						{ _origin[d] = it->value(); }
+						if (select_compare(d, *high[d], it->value(), index))
+						{ high[d] = &it->value(); }
 					}
 				}
-				else
+				const Distance top = static_cast<Distance>
+					(std::numeric_limits<Key>::max());
+				for (dimension_type d = 0; d < K; ++d)
 				{
+					Distance span = static_cast<Distance>
+						(Diff()(d, *high[d], _origin[d]));
+					_scale[d] = (span > Distance()) ? top / span : Distance();
 				}
-				node->state() = lnode->state() + rnode->state();
+				_dist = dist;
+				for (Iterator it = first; it != last; ++it)
+				{ if (it->is_valid()) { moved(it - start, it->value(), index); } }
 			}
-			else if (offset == 1)
+
+			void clear() noexcept
 			{
-				// If the line below throws, the program terminates
-				erase->value_ptr()->~value_type();
-				node->state() = (node->state() == State::Neither)
-					? ~_impl._full_state : State::Neither;
-				if (node != erase)
-				{ erase->state() = State::Invalid; }
-				else
+				_keys.clear();
+				_origin.clear();
+				_dist = 0;
+			}
+
+			/**
+			 *  The keys of the nodes of a tree of dist elements, K per node, or
+			 *  nullptr if they are not up to date.
+			 */
+			const Key* keys(difference_type dist) const noexcept
+			{ return (dist == _dist && dist != 0) ? _keys.data() : nullptr; }
+
+			/**
+			 *  Write the K keys of v to out. Values below or above the range of
+			 *  the keys get the first or last key.
+			 */
+			void quantize(const value_type& v, Key* out) const noexcept
+			{
+				const Distance top = static_cast<Distance>
+					(std::numeric_limits<Key>::max());
+				for (dimension_type d = 0; d < K; ++d)
 				{
-					iterator rnode = right(node, offset);
-					if (rnode->is_valid())
-					{
-						std::memcpy(node->value_ptr(), rnode->value_ptr(), sizeof(value_type));
-						rnode->state_ptr() = State::Invalid;
-					}
-					else
-					{
-						iterator lnode = left(node, offset);
-						std::memcpy(node->value_ptr(), lnode->value_ptr(), sizeof(value_type));
-						lnode->state_ptr() = State::Invalid;
-					}
+					Distance x = static_cast<Distance>(Diff()(d, v, _origin[d]))
+						* _scale[d];
+					out[d] = !(x > Distance()) ? Key()
+						: !(x < top) ? std::numeric_limits<Key>::max()
+						: static_cast<Key>(x);
 				}
 			}
-			else
+
+			void count(const refine_count& c) const noexcept
 			{
-				// Node is necessarily equal to erase in this case
-				node->state() = State::Invalid;
-				// If the line below throw, the program terminates
-				node->value_ptr()->~value_type();
+				_visited.add(c.visited);
+				_refined.add(c.refined);
+			}
+
+			/**
+			 *  The number of nodes visited by queries on the keys.
+			 */
+			std::size_t visited() const noexcept { return _visited.get(); }
+
+			/**
+			 *  The number of nodes visited by queries on the keys whose values
+			 *  had to be compared.
+			 */
+			std::size_t refinements() const noexcept { return _refined.get(); }
+
+			void reset_counts() const noexcept
+			{
+				_visited.reset();
+				_refined.reset();
 			}
+
+		private:
+			std::vector<Key, key_alloc_type> _keys;
+			std::vector<value_type, Alloc> _origin;
+			Distance _scale[K];
+			difference_type _dist;
+			mutable relaxed_counter _visited;
+			mutable relaxed_counter _refined;
+		};
+
+		/**
+		 *  The monoid used by \ref kdtree::count_in_range().
+		 */
+		struct count_monoid
+		{
+			typedef std::size_t result_type;
+
+			result_type identity() const noexcept { return 0; }
+			template<typename Value>
+			result_type operator()(const Value&) const noexcept { return 1; }
+			result_type combine(result_type a, result_type b) const noexcept
+			{ return a + b; }
+			result_type remove(result_type a, result_type b) const noexcept
+			{ return a - b; }
+		};
+
+		/**
+		 *  The region of space covered by a sub-tree: along each dimension, its
+		 *  values are not less than low[d] and not greater than high[d]. A null
+		 *  bound is unknown.
+		 */
+		template<typename Value, dimension_type K>
+		struct cell
+		{
+			const Value* low[K];
+			const Value* high[K];
+		};
+
+		/**
+		 *  Lower bound of the distance between origin and a box, when the metric
+		 *  provides distance_to_box(). Call with 0 as last argument to prefer the
+		 *  first overload.
+		 */
+		template<typename Metric, typename Value>
+		inline auto box_bound(const Metric& metric, const Value& origin,
+		                      const Value* low, const Value* high,
+		                      typename Metric::distance_type& bound, int)
+			noexcept
+			-> decltype(metric.distance_to_box(origin, low, high), bool())
+		{
+			bound = metric.distance_to_box(origin, low, high);
+			return true;
+		}
+
+		template<typename Metric, typename Value>
+		inline bool box_bound(const Metric&, const Value&, const Value*,
+		                      const Value*, typename Metric::distance_type&, long)
+			noexcept
+		{ return false; }
+	}
+
+	/**
+	 *  Iterates over the values of a tree by increasing distance to an origin.
+	 *  The next value is only searched on increment, so the cost of browsing is
+	 *  proportional to the number of values actually consumed. The iterator
+	 *  keeps a priority queue of the sub-trees and values seen so far; copying
+	 *  it copies the queue.
+	 *
+	 *  The iterator is invalidated by any modification of the tree. ChildDim
+	 *  gives the dimension of a node from the dimension of its parent, and Live
+	 *  tells whether a node holds a value that was not erased.
+	 */
+	template<typename Iterator, typename Indexable, typename Metric,
+	         typename ChildDim = details::next_dim<Indexable::kth()>,
+	         typename Live = details::all_live>
+	class nearest_iterator
+	{
+		using key_type = typename Indexable::value_type;
+		using distance_type = typename Metric::distance_type;
+		using entry_type = details::browse_entry<distance_type, Iterator>;
+
+	public:
+		typedef typename Iterator::value_type value_type;
+		typedef typename Iterator::pointer pointer;
+		typedef typename Iterator::reference reference;
+		typedef typename Iterator::difference_type difference_type;
+		typedef std::forward_iterator_tag iterator_category;
+
+		explicit nearest_iterator(Iterator end, const key_type& origin,
+		                          const Metric& metric,
+		                          const Indexable& index,
+		                          const ChildDim& dims = ChildDim(),
+		                          const Live& live = Live())
+			: _index(&index), _metric(metric), _dims(dims), _live(live),
+			  _origin(origin), _pending(), _current(end), _end(end), _distance()
+		{ }
+
+		explicit nearest_iterator(Iterator end, const key_type& origin,
+		                          const Metric& metric,
+		                          const Indexable& index,
+		                          Iterator node, difference_type offset,
+		                          const ChildDim& dims = ChildDim(),
+		                          const Live& live = Live())
+			: _index(&index), _metric(metric), _dims(dims), _live(live),
+			  _origin(origin), _pending(), _current(end), _end(end), _distance()
+		{
+			_pending.push_back(entry_type{distance_type(), node, offset,
+			                              _dims(node, Indexable::kth() - 1),
+			                              false});
+			_advance();
 		}
 
+		reference operator*() const noexcept { return *_current; }
+		pointer operator->() const noexcept { return _current.operator->(); }
+
 		/**
-		 *  This function is to be called only when node is full. It will not
-		 *  proceed to actual detruction of "erased", so it is important that the
-		 *  caller destroys "erased" before calling the function.
+		 *  The distance between the origin and the current value. Undefined if
+		 *  the iterator is past the end.
 		 */
-		void _erase_when_full(dimension_type node_dim,
-		                      typename iterator::difference_type node_offset,
-		                      iterator node, iterator erased) const noexcept
+		const distance_type& distance() const noexcept { return _distance; }
+
+		/**
+		 *  The iterator to the current value, in the tree.
+		 */
+		Iterator base() const noexcept { return _current; }
+
+		nearest_iterator& operator++()
 		{
-			while (node_offset > 1)
+			_advance();
+			return *this;
+		}
+
+		nearest_iterator operator++(int)
+		{
+			nearest_iterator tmp(*this);
+			_advance();
+			return tmp;
+		}
+
+		bool operator==(const nearest_iterator& x) const noexcept
+		{ return _current == x._current; }
+		bool operator!=(const nearest_iterator& x) const noexcept
+		{ return _current != x._current; }
+
+	private:
+		void _push(const entry_type& e)
+		{
+			_pending.push_back(e);
+			std::push_heap(_pending.begin(), _pending.end(),
+			               details::farther_entry());
+		}
+
+		/**
+		 *  Expand sub-trees from the queue until a value reaches the top.
+		 */
+		void _advance()
+		{
+			while (!_pending.empty())
 			{
-				dimension_type child_dim = inc<indexable_type::kth()>(node_dim);
-				typename iterator::difference_type child_offset = node_offset / 2;
-				node->state() = State::Neither;
-				if (node == erased)
+				std::pop_heap(_pending.begin(), _pending.end(),
+				              details::farther_entry());
+				entry_type e = _pending.back();
+				_pending.pop_back();
+				if (e.is_value)
 				{
-					iterator rnode = right(node, node_offset);
-					iterator tmp = minimum(node_dim, child_dim, child_offset,
-					                       rnode, get_index());
-					std::memcpy(erased->value_ptr(), tmp->value_ptr(),
-					            sizeof(value_type));
-					erased = tmp;
-					node = rnode;
+					_current = e.node;
+					_distance = e.bound;
+					return;
 				}
-				// find erased node by memory locality
-				else if (node->value_ptr() < erased->value_ptr())
-				{ node = right(node, node_offset); }
-				else
-				{ node = left(node, node_offset); }
-				node_dim = child_dim;
-				node_offset = child_offset;
-			}
-			if (node_offset == 1)
-			{
-				iterator rnode = right(node, node_offset);
-				if (node == erased)
+				if (!e.node->is_valid()) { continue; }
+				if (_live(e.node))
 				{
-					std::memcpy(node->value_ptr(), rnode->value_ptr(),
-					            sizeof(value_type));
-					rnode->state() = State::Invalid;
+					_push(entry_type{_metric.distance_to_key(_origin, e.node->value()),
+					                 e.node, 0, 0, true});
 				}
-				else { erased->state() = State::Invalid; }
-				node->state() = State::Neither;
+				if (e.offset == 0) { continue; }
+				difference_type child_offset = e.offset / 2;
+				Iterator near_node = left(e.node, e.offset);
+				Iterator far_node = right(e.node, e.offset);
+				if (select_compare(e.dim, e.node->value(), _origin, *_index))
+				{ std::swap(near_node, far_node); }
+				distance_type bound
+					= _metric.distance_to_plane(e.dim, _origin, e.node->value());
+				if (bound < e.bound) { bound = e.bound; }
+				_push(entry_type{e.bound, near_node, child_offset,
+				                 _dims(near_node, e.dim), false});
+				_push(entry_type{bound, far_node, child_offset,
+				                 _dims(far_node, e.dim), false});
 			}
-			else
-			{ node->state() = State::Invalid; }
-			return;
+			_current = _end;
+		}
+
+		const Indexable* _index;
+		Metric _metric;
+		ChildDim _dims;
+		Live _live;
+		key_type _origin;
+		std::vector<entry_type> _pending;
+		Iterator _current;
+		Iterator _end;
+		distance_type _distance;
+	};
+
+	/**
+	 *  Key policy for \ref kdtree: the tree may hold several values equal
+	 *  along all dimensions, as std::multiset. Values equivalent to a node
+	 *  along its dimension may be on either side of it, since the tree stays
+	 *  perfectly balanced; \ref kdtree::equal_range() only descends on both
+	 *  sides of such nodes.
+	 */
+	struct duplicate_keys { };
+
+	/**
+	 *  Key policy for \ref kdtree: the tree holds at most one value equal to
+	 *  any other along all dimensions, as std::set. Inserting a value that is
+	 *  already in the tree returns the existing element, and building a tree
+	 *  from a range keeps only the first of equal values.
+	 */
+	struct unique_keys { };
+
+	/**
+	 *  Iterates over the values of a tree equal to a key along all dimensions,
+	 *  in no particular order. Only the sides of a node that may hold the key
+	 *  are visited, so the cost is proportional to the number of values
+	 *  equivalent to the key along the dimension of their parent, plus the
+	 *  height of the tree. The iterator keeps a stack of the sub-trees left to
+	 *  visit; copying it copies the stack.
+	 *
+	 *  The iterator is invalidated by any modification of the tree. ChildDim
+	 *  and Live are the same as for \ref nearest_iterator.
+	 */
+	template<typename Iterator, typename Indexable,
+	         typename ChildDim = details::next_dim<Indexable::kth()>,
+	         typename Live = details::all_live>
+	class equal_iterator
+	{
+		using key_type = typename Indexable::value_type;
+
+	public:
+		typedef typename Iterator::value_type value_type;
+		typedef typename Iterator::pointer pointer;
+		typedef typename Iterator::reference reference;
+		typedef typename Iterator::difference_type difference_type;
+		typedef std::forward_iterator_tag iterator_category;
+
+		explicit equal_iterator(Iterator end, const key_type& key,
+		                        const Indexable& index,
+		                        const ChildDim& dims = ChildDim(),
+		                        const Live& live = Live())
+			: _index(&index), _dims(dims), _live(live), _key(key), _pending(),
+			  _current(end), _end(end) { }
+
+		explicit equal_iterator(Iterator end, const key_type& key,
+		                        const Indexable& index,
+		                        Iterator node, difference_type offset,
+		                        const ChildDim& dims = ChildDim(),
+		                        const Live& live = Live())
+			: _index(&index), _dims(dims), _live(live), _key(key), _pending(),
+			  _current(end), _end(end)
+		{
+			_pending.push_back(entry_type{node, offset,
+			                              _dims(node, Indexable::kth() - 1)});
+			_advance();
 		}
 
+		reference operator*() const noexcept { return *_current; }
+		pointer operator->() const noexcept { return _current.operator->(); }
+
 		/**
-		 *  Find a position to insert v into the subtree (start, root) and balance
-		 *  all items along the way to make way for v.
+		 *  The iterator to the current value, in the tree.
 		 */
-		iterator _place_insert(dimension_type node_dim,
-		                       typename iterator::difference_type offset,
-		                       const iterator& node,
-		                       const value_type& val) const noexcept
+		Iterator base() const noexcept { return _current; }
+
+		equal_iterator& operator++()
 		{
-			if (offset == 1)
+			_advance();
+			return *this;
+		}
+
+		equal_iterator operator++(int)
+		{
+			equal_iterator tmp(*this);
+			_advance();
+			return tmp;
+		}
+
+		bool operator==(const equal_iterator& x) const noexcept
+		{ return _current == x._current; }
+		bool operator!=(const equal_iterator& x) const noexcept
+		{ return _current != x._current; }
+
+	private:
+		struct entry_type
+		{
+			Iterator node;
+			difference_type offset;
+			dimension_type dim;
+		};
+
+		void _advance()
+		{
+			while (!_pending.empty())
 			{
-				iterator lnode = left(node, offset);
-				iterator rnode = right(node, offset);
-				iterator insert;
-				if (select_compare(node_dim, val, node->value(), get_index()))
+				entry_type e = _pending.back();
+				_pending.pop_back();
+				if (!e.node->is_valid()) { continue; }
+				bool left_only
+					= select_compare(e.dim, _key, e.node->value(), *_index);
+				bool right_only
+					= select_compare(e.dim, e.node->value(), _key, *_index);
+				if (e.offset != 0)
 				{
-					if (lnode->is_valid())
+					difference_type child_offset = e.offset / 2;
+					if (!left_only)
 					{
-						std::memcpy(rnode->value_ptr(), node->value_ptr(), sizeof(value_type));
-						rnode->state() = _impl._full_state;
-						node->state() = _impl._full_state;
-						if (select_compare(node_dim, val, lnode->value(), get_index()))
-						{
-							std::memcpy(node->value_ptr(), lnode->value_ptr(), sizeof(value_type));
-							insert = lnode;
-						}
-						else
-						{ insert = node; }
+						Iterator child = right(e.node, e.offset);
+						_pending.push_back(entry_type{child, child_offset,
+						                              _dims(child, e.dim)});
 					}
-					else
+					if (!right_only)
 					{
-						lnode->state() = _impl._full_state;
-						if (rnode->is_valid()) { node->state() = _impl._full_state; }
-						insert = lnode;
+						Iterator child = left(e.node, e.offset);
+						_pending.push_back(entry_type{child, child_offset,
+						                              _dims(child, e.dim)});
 					}
 				}
-				else
+				if (!left_only && !right_only
+				    && details::equal_except<Indexable::kth(), Indexable::kth()>
+				    ::test(e.node->value(), _key, *_index)
+				    && _live(e.node))
 				{
-					if (rnode->is_valid())
-					{
-						std::memcpy(lnode->value_ptr(), node->value_ptr(), sizeof(value_type));
-						lnode->state() = _impl._full_state;
-						node->state() = _impl._full_state;
-						if (select_compare(node_dim, rnode->value(), val, get_index()))
-						{
-							std::memcpy(node->value_ptr(), rnode->value_ptr(), sizeof(value_type));
-							insert = rnode;
-						}
-						else
-						{ insert = node; }
-					}
-					else
-					{
-						rnode->state() = _impl._full_state;
-						if (lnode->is_valid()) { node->state() = _impl._full_state; }
-						insert = rnode;
-					}
+					_current = e.node;
+					return;
 				}
-				return insert;
 			}
-			else if (offset > 1)
+			_current = _end;
+		}
+
+		const Indexable* _index;
+		ChildDim _dims;
+		Live _live;
+		key_type _key;
+		std::vector<entry_type> _pending;
+		Iterator _current;
+		Iterator _end;
+	};
+
+	/**
+	 *  Splitting policy for \ref kdtree: the dimension of each node is the
+	 *  next dimension after the one of its parent, starting with 0 at the root.
+	 */
+	struct cyclic_split { };
+
+	/**
+	 *  Splitting policy for \ref kdtree: when the tree is built from a range
+	 *  of values, each node splits the dimension along which its values have
+	 *  the largest spread, measured with Diff, which returns a Distance like
+	 *  the Diff of \ref quadrance. Suits data whose dimensions have very
+	 *  different ranges. The dimension of each node is kept in a side array of
+	 *  one byte per node when K is at most 256. Nodes added by later
+	 *  expansions of the tree fall back on \ref cyclic_split.
+	 */
+	template<typename Distance, typename Diff>
+	struct max_spread_split { };
+
+	/**
+	 *  Splitting policy for \ref kdtree: as \ref max_spread_split, but each
+	 *  node splits the dimension along which its values have the largest
+	 *  variance, which is less sensitive to outliers.
+	 */
+	template<typename Distance, typename Diff>
+	struct max_variance_split { };
+
+	namespace details
+	{
+		/**
+		 *  Storage for the splitting policy of a tree. choose() returns the
+		 *  dimension of a node built from the values in [first, last), given the
+		 *  dimension \ref cyclic_split would use; set() records it. The tree
+		 *  calls reserve() before it expands, which may throw, and expand()
+		 *  once it has expanded.
+		 */
+		template<typename Split, typename Indexable, typename Alloc>
+		struct split_data
+		{
+			typedef std::ptrdiff_t difference_type;
+			typedef typename Indexable::value_type value_type;
+			typedef next_dim<Indexable::kth()> child_dim_type;
+
+			template<typename Iterator>
+			child_dim_type child_dim(const Iterator&) const noexcept
+			{ return child_dim_type(); }
+
+			dimension_type choose(const value_type* const*,
+			                      const value_type* const*,
+			                      dimension_type fallback,
+			                      const Indexable&) const noexcept
+			{ return fallback; }
+
+			void assign(difference_type) { }
+			void set(difference_type, dimension_type) noexcept { }
+			void reserve(difference_type) { }
+			void expand(difference_type) noexcept { }
+			void clear() noexcept { }
+		};
+
+		template<typename Indexable, typename Alloc>
+		class stored_split
+		{
+			using dim_type = typename std::conditional
+				<(Indexable::kth() <= 256), unsigned char, dimension_type>::type;
+			using dim_alloc_type = typename std::allocator_traits<Alloc>
+				::template rebind_alloc<dim_type>;
+
+		public:
+			typedef std::ptrdiff_t difference_type;
+			typedef typename Indexable::value_type value_type;
+			typedef stored_dim<Indexable::kth(), dim_type> child_dim_type;
+
+			template<typename Iterator>
+			child_dim_type child_dim(const Iterator& start) const noexcept
 			{
-				dimension_type child_dim = inc<indexable_type::kth()>(node_dim);
-				typename iterator::difference_type child_offset = offset / 2;
-				iterator lnode = left(node, offset);
-				iterator rnode = right(node, offset);
-				iterator insert;
-				if (select_compare(node_dim, val, node->value(), get_index()))
+				return _dims.empty() ? child_dim_type{nullptr, nullptr}
+					: child_dim_type{_dims.data(), std::addressof(start->state())};
+			}
+
+			void assign(difference_type dist)
+			{ _dims.assign(static_cast<std::size_t>(dist), dim_type()); }
+
+			void set(difference_type p, dimension_type d) noexcept
+			{ _dims[static_cast<std::size_t>(p)] = static_cast<dim_type>(d); }
+
+			void reserve(difference_type dist)
+			{ if (!_dims.empty()) { _dims.reserve(static_cast<std::size_t>(dist)); } }
+
+			/**
+			 *  Interleave the side array as the tree does with its nodes. The new
+			 *  leaves take the next dimension after the one of their parent.
+			 */
+			void expand(difference_type dist) noexcept
+			{
+				if (_dims.empty()) { return; }
+				std::size_t n = static_cast<std::size_t>(dist);
+				_dims.resize(2 * n + 1);
+				for (std::size_t i = n; i-- != 0;) { _dims[2 * i + 1] = _dims[i]; }
+				for (std::size_t q = 0; q < 2 * n + 1; q += 2)
 				{
-					if (lnode->state() == _impl._full_state)
-					{
-						iterator tmp
-							= _place_insert(child_dim, child_offset, rnode, node->value());
-						std::memcpy(tmp->value_ptr(), node->value_ptr(), sizeof(value_type));
-						tmp = maximum(node_dim, child_dim, child_offset, lnode, get_index());
-						if (select_compare(node_dim, val, tmp->value(), get_index()))
-						{
-							std::memcpy(node->value_ptr(), tmp->value_ptr(), sizeof(value_type));
-							_erase_when_full(child_dim, child_offset, lnode, tmp);
-							insert = _place_insert(child_dim, child_offset, lnode, val);
-						}
-						else
-						{ insert = node; }
-					}
+					std::size_t parent = (q % 4 == 0) ? q + 1 : q - 1;
+					_dims[q] = static_cast<dim_type>
+						(inc<Indexable::kth()>(_dims[parent]));
+				}
+			}
+
+			void clear() noexcept { _dims.clear(); }
+
+		private:
+			std::vector<dim_type, dim_alloc_type> _dims;
+		};
+
+		template<typename Distance, typename Diff, typename Indexable,
+		         typename Alloc>
+		struct split_data<max_spread_split<Distance, Diff>, Indexable, Alloc>
+			: stored_split<Indexable, Alloc>
+		{
+			typedef typename Indexable::value_type value_type;
+
+			dimension_type choose(const value_type* const* first,
+			                      const value_type* const* last,
+			                      dimension_type fallback,
+			                      const Indexable& index) const
+			{
+				dimension_type best = fallback;
+				Distance best_spread = _spread(fallback, first, last, index);
+				for (dimension_type d = 0; d < Indexable::kth(); ++d)
+				{
+					if (d == fallback) { continue; }
+					Distance spread = _spread(d, first, last, index);
+					if (best_spread < spread) { best = d; best_spread = spread; }
+				}
+				return best;
+			}
+
+		private:
+			static Distance _spread(dimension_type d,
+			                        const value_type* const* first,
+			                        const value_type* const* last,
+			                        const Indexable& index)
+			{
+				const value_type* low = *first;
+				const value_type* high = *first;
+				for (++first; first != last; ++first)
+				{
+					if (select_compare(d, **first, *low, index)) { low = *first; }
+					else if (select_compare(d, *high, **first, index)) { high = *first; }
+				}
+				return static_cast<Distance>(Diff()(d, *high, *low));
+			}
+		};
+
+		template<typename Distance, typename Diff, typename Indexable,
+		         typename Alloc>
+		struct split_data<max_variance_split<Distance, Diff>, Indexable, Alloc>
+			: stored_split<Indexable, Alloc>
+		{
+			typedef typename Indexable::value_type value_type;
+
+			dimension_type choose(const value_type* const* first,
+			                      const value_type* const* last,
+			                      dimension_type fallback,
+			                      const Indexable&) const
+			{
+				dimension_type best = fallback;
+				double best_variance = _variance(fallback, first, last);
+				for (dimension_type d = 0; d < Indexable::kth(); ++d)
+				{
+					if (d == fallback) { continue; }
+					double variance = _variance(d, first, last);
+					if (best_variance < variance) { best = d; best_variance = variance; }
+				}
+				return best;
+			}
+
+		private:
+			/**
+			 *  The variance scaled by the number of values, accumulated with
+			 *  Welford's method in double: an integer Distance would overflow on
+			 *  the squares of wide coordinates. The differences are taken to the
+			 *  first value to stay small.
+			 */
+			static double _variance(dimension_type d,
+			                        const value_type* const* first,
+			                        const value_type* const* last)
+			{
+				Diff diff;
+				const value_type& ref = **first;
+				double n = 0.0, mean = 0.0, squares = 0.0;
+				for (; first != last; ++first)
+				{
+					double x = static_cast<double>
+						(static_cast<Distance>(diff(d, **first, ref)));
+					n += 1.0;
+					double delta = x - mean;
+					mean += delta / n;
+					squares += delta * (x - mean);
+				}
+				return squares;
+			}
+		};
+
+		/**
+		 *  The erased values of a tree, marked in a side array parallel to the
+		 *  states of the nodes. A mark only has a meaning on a valid node, and
+		 *  moves with the value when the tree relocates it. The array is only
+		 *  allocated by the first erase, and expanded with the tree as \ref
+		 *  stored_split is.
+		 */
+		template<typename Alloc>
+		class tombstones
+		{
+			using mark_alloc_type = typename std::allocator_traits<Alloc>
+				::template rebind_alloc<unsigned char>;
+
+		public:
+			typedef std::ptrdiff_t difference_type;
+
+			explicit tombstones() noexcept : _marks(), _count(), _cursor() { }
+
+			/**
+			 *  The number of erased values still in the tree.
+			 */
+			std::size_t size() const noexcept { return _count; }
+
+			template<typename Iterator>
+			live_node live(const Iterator& start) const noexcept
+			{
+				return live_node{_marks.empty() ? nullptr : _marks.data(),
+				                 std::addressof(start->state())};
+			}
+
+			bool dead(difference_type p) const noexcept
+			{ return !_marks.empty() && _marks[static_cast<std::size_t>(p)] != 0; }
+
+			/**
+			 *  Mark the value at p in a tree of dist nodes as erased. May throw
+			 *  when it allocates the side array.
+			 */
+			void mark(difference_type p, difference_type dist)
+			{
+				if (_marks.empty())
+				{ _marks.assign(static_cast<std::size_t>(dist), 0); }
+				_marks[static_cast<std::size_t>(p)] = 1;
+				++_count;
+			}
+
+			/**
+			 *  The erased value at p was destroyed.
+			 */
+			void remove(difference_type p) noexcept
+			{
+				_marks[static_cast<std::size_t>(p)] = 0;
+				--_count;
+			}
+
+			/**
+			 *  A value that was not erased was written at p.
+			 */
+			void revive(difference_type p) noexcept
+			{ if (!_marks.empty()) { _marks[static_cast<std::size_t>(p)] = 0; } }
+
+			void move(difference_type to, difference_type from) noexcept
+			{
+				if (_marks.empty()) { return; }
+				_marks[static_cast<std::size_t>(to)]
+					= _marks[static_cast<std::size_t>(from)];
+			}
+
+			void reserve(difference_type dist)
+			{ if (!_marks.empty()) { _marks.reserve(static_cast<std::size_t>(dist)); } }
+
+			/**
+			 *  Interleave the side array as the tree does with its nodes; the new
+			 *  leaves are not erased.
+			 */
+			void expand(difference_type dist) noexcept
+			{
+				if (_marks.empty()) { return; }
+				std::size_t n = static_cast<std::size_t>(dist);
+				_marks.resize(2 * n + 1);
+				for (std::size_t i = n; i-- != 0;)
+				{
+					_marks[2 * i + 1] = _marks[i];
+					_marks[2 * i + 2] = 0;
+				}
+				_marks[0] = 0;
+			}
+
+			void clear() noexcept
+			{
+				_marks.clear();
+				_count = 0;
+				_cursor = 0;
+			}
+
+			/**
+			 *  The next of n sub-trees for incremental compaction to scan, in
+			 *  turn across calls.
+			 */
+			std::size_t next_subtree(std::size_t n) noexcept
+			{ return _cursor++ % n; }
+
+		private:
+			std::vector<unsigned char, mark_alloc_type> _marks;
+			std::size_t _count;
+			std::size_t _cursor;
+		};
+	}
+
+	/**
+	 *  Statistics policy for \ref kdtree that counts nothing, at no cost. This
+	 *  is the default.
+	 */
+	struct no_stats { };
+
+	/**
+	 *  Statistics policy for \ref kdtree that counts the operations of the
+	 *  tree; see \ref kdtree::operations(). The counters are shared by all
+	 *  queries, including concurrent queries on a const tree, so each increment
+	 *  is a relaxed atomic operation.
+	 */
+	struct count_operations { };
+
+	/**
+	 *  The operations counted by \ref count_operations. Subtract the counts
+	 *  taken before a query from the counts taken after it to get the
+	 *  operations of that query.
+	 */
+	struct operation_counts
+	{
+		std::size_t visited;     // nodes examined by queries
+		std::size_t comparisons; // values compared along one dimension
+		std::size_t relocations; // values moved to another node
+		std::size_t extrema;     // searches for a minimum or maximum
+		std::size_t expansions;  // reallocations of the storage
+		std::size_t rebuilds;    // bulk rebuilds of the whole tree
+		std::size_t updates;     // values replaced in place by update()
+	};
+
+	inline operation_counts
+	operator-(const operation_counts& a, const operation_counts& b) noexcept
+	{
+		return operation_counts{a.visited - b.visited,
+		                        a.comparisons - b.comparisons,
+		                        a.relocations - b.relocations,
+		                        a.extrema - b.extrema,
+		                        a.expansions - b.expansions,
+		                        a.rebuilds - b.rebuilds,
+		                        a.updates - b.updates};
+	}
+
+	/**
+	 *  The shape of a tree, as reported by \ref kdtree::stats(). Levels are
+	 *  numbered from the root, which is level 0.
+	 */
+	struct tree_stats
+	{
+		std::size_t size;      // values in the tree
+		std::size_t capacity;  // values the storage can hold
+		std::size_t slots;     // nodes of the layout, valid or not
+		std::size_t invalid;   // nodes without a value
+		std::size_t erased;    // nodes whose value is erased, see
+		                       // kdtree::erase()
+		std::size_t height;    // levels of the layout
+		std::size_t depth;     // levels holding at least one value
+		std::size_t full;      // nodes whose sub-tree has all its slots valid
+		std::size_t free;      // nodes whose sub-tree holds the fewest values
+		                       // the layout allows
+		std::size_t mixed;     // other nodes with a value
+		double root_imbalance; // |left - right| / (left + right) at the root
+		double imbalance;      // the same, summed over all nodes, weighted
+		                       // by the size of their sub-tree
+		std::vector<std::size_t> occupancy; // values per level, erased or not
+
+		/**
+		 *  The fewest levels that can hold size values.
+		 */
+		std::size_t optimal_depth() const noexcept
+		{
+			std::size_t d = 0;
+			for (std::size_t n = size; n != 0; n >>= 1) { ++d; }
+			return d;
+		}
+
+		double load_factor() const noexcept
+		{
+			return (capacity == 0) ? 0.0
+				: static_cast<double>(size) / static_cast<double>(capacity);
+		}
+
+		double invalid_fraction() const noexcept
+		{
+			return (slots == 0) ? 0.0
+				: static_cast<double>(invalid) / static_cast<double>(slots);
+		}
+
+		/**
+		 *  The fraction of the values in the layout that are erased.
+		 */
+		double erased_fraction() const noexcept
+		{
+			return (size + erased == 0) ? 0.0
+				: static_cast<double>(erased) / static_cast<double>(size + erased);
+		}
+	};
+
+	namespace details
+	{
+		/**
+		 *  An index that counts the values it compares. It lacks
+		 *  access_compare_type, so that only the overload of select_compare()
+		 *  below applies to it.
+		 */
+		template<typename Indexable>
+		class counted_index
+		{
+		public:
+			typedef typename Indexable::value_type value_type;
+
+			explicit counted_index(const Indexable& i,
+			                       relaxed_counter& comparisons) noexcept
+				: _index(&i), _comparisons(&comparisons) { }
+
+			const Indexable& index() const noexcept { return *_index; }
+			void count() const noexcept { _comparisons->add(1); }
+
+			static constexpr dimension_type kth() { return Indexable::kth(); }
+
+		private:
+			const Indexable* _index;
+			relaxed_counter* _comparisons;
+		};
+
+		template<typename Indexable>
+		inline bool
+		select_compare(dimension_type d,
+		               const typename Indexable::value_type& a,
+		               const typename Indexable::value_type& b,
+		               const counted_index<Indexable>& i) noexcept
+		{
+			i.count();
+			return kdtree_index::select_compare(d, a, b, i.index());
+		}
+
+		/**
+		 *  Storage for the statistics policy of a tree. index() is the index
+		 *  the tree compares values with.
+		 */
+		template<typename Stats>
+		struct stats_data
+		{
+			template<typename Indexable>
+			using index_type = const Indexable&;
+
+			template<typename Indexable>
+			const Indexable& index(const Indexable& i) const noexcept { return i; }
+
+			void visit() const noexcept { }
+			void relocate() const noexcept { }
+			void extremum() const noexcept { }
+			void expand() const noexcept { }
+			void rebuild() const noexcept { }
+			void update() const noexcept { }
+			operation_counts counts() const noexcept
+			{ return operation_counts{0, 0, 0, 0, 0, 0, 0}; }
+			void reset() noexcept { }
+		};
+
+		template<>
+		struct stats_data<count_operations>
+		{
+			template<typename Indexable>
+			using index_type = counted_index<Indexable>;
+
+			template<typename Indexable>
+			counted_index<Indexable> index(const Indexable& i) const noexcept
+			{ return counted_index<Indexable>(i, _comparisons); }
+
+			void visit() const noexcept { _visited.add(1); }
+			void relocate() const noexcept { _relocations.add(1); }
+			void extremum() const noexcept { _extrema.add(1); }
+			void expand() const noexcept { _expansions.add(1); }
+			void rebuild() const noexcept { _rebuilds.add(1); }
+			void update() const noexcept { _updates.add(1); }
+
+			operation_counts counts() const noexcept
+			{
+				return operation_counts{_visited.get(), _comparisons.get(),
+				                        _relocations.get(), _extrema.get(),
+				                        _expansions.get(), _rebuilds.get(),
+				                        _updates.get()};
+			}
+
+			void reset() noexcept
+			{
+				_visited.reset();
+				_comparisons.reset();
+				_relocations.reset();
+				_extrema.reset();
+				_expansions.reset();
+				_rebuilds.reset();
+				_updates.reset();
+			}
+
+		private:
+			mutable relaxed_counter _visited;
+			mutable relaxed_counter _comparisons;
+			mutable relaxed_counter _relocations;
+			mutable relaxed_counter _extrema;
+			mutable relaxed_counter _expansions;
+			mutable relaxed_counter _rebuilds;
+			mutable relaxed_counter _updates;
+		};
+	}
+
+	/**
+	 *  The tree is stored in-order in a flat array. Augment is an optional
+	 *  policy that maintains additional information for each sub-tree, such as
+	 *  \ref box_cache. Split is the policy that chooses the dimension of each
+	 *  node, such as \ref max_spread_split. Keys is either \ref duplicate_keys
+	 *  or \ref unique_keys. Stats is either \ref no_stats or \ref
+	 *  count_operations.
+	 */
+	template<typename Index,
+	         typename Alloc = std::allocator<typename Index::value_type>,
+	         typename Augment = null_type,
+	         typename Split = cyclic_split,
+	         typename Keys = duplicate_keys,
+	         typename Stats = no_stats>
+	class kdtree
+	{
+	public:
+		using indexable_type = Index;
+		using value_type = typename indexable_type::value_type;
+		using state_type = State;
+		using allocator_type = Alloc;
+
+	private:
+		using value_alloc_type = typename std::allocator_traits<Alloc>
+			::template rebind_alloc<value_type>;
+		using state_alloc_type = typename std::allocator_traits<Alloc>
+			::template rebind_alloc<state_type>;
+		using value_alloc_traits = std::allocator_traits<value_alloc_type>;
+		using state_alloc_traits = std::allocator_traits<state_alloc_type>;
+		using value_pointer = typename value_alloc_traits::pointer;
+		using const_value_pointer = typename value_alloc_traits::const_pointer;
+		using state_pointer = typename state_alloc_traits::pointer;
+		using const_state_pointer = typename state_alloc_traits::const_pointer;
+		using augment_type
+		= details::augment_data<Augment, indexable_type, value_alloc_type>;
+		using split_type
+		= details::split_data<Split, indexable_type, value_alloc_type>;
+		using child_dim_type = typename split_type::child_dim_type;
+		using stats_type = details::stats_data<Stats>;
+		using tombstones_type = details::tombstones<value_alloc_type>;
+		using compare_index_type
+		= typename stats_type::template index_type<indexable_type>;
+
+	public:
+		using iterator = kdtree_iterator<value_pointer, state_pointer>;
+		using const_iterator = kdtree_iterator<const_value_pointer, const_state_pointer>;
+		template<typename Metric>
+		using nearest_iterator_type
+		= nearest_iterator<iterator, indexable_type, Metric, child_dim_type,
+		                   details::live_node>;
+		template<typename Metric>
+		using const_nearest_iterator_type
+		= nearest_iterator<const_iterator, indexable_type, Metric, child_dim_type,
+		                   details::live_node>;
+		using equal_iterator_type
+		= equal_iterator<iterator, indexable_type, child_dim_type,
+		                 details::live_node>;
+		using const_equal_iterator_type
+		= equal_iterator<const_iterator, indexable_type, child_dim_type,
+		                 details::live_node>;
+
+	private:
+		struct _kdtree_members
+			: indexable_type, value_alloc_type, state_alloc_type
+		{
+			iterator _start;          // first of value & state
+			iterator _finish;         // last of value & state
+			std::size_t _capacity;    // total storage capacity
+			std::size_t _count;       // fast count for O(1) access
+			state_type _full_state;   // State indicating a perfectly balanced tree
+			mutable augment_type _augment; // per sub-tree data, see Augment
+			split_type _split;        // dimension of each node, see Split
+			stats_type _stats;        // operation counters, see Stats
+			mutable details::relaxed_counter _rebalanced; // moves since build
+			double _rebuild_factor;   // see rebuild_factor()
+			mutable tombstones_type _tombs; // erased values, see erase()
+			double _compact_ratio;    // see compact_ratio()
+
+			explicit _kdtree_members()
+			noexcept(std::is_nothrow_default_constructible<value_alloc_type>::value
+			         && std::is_nothrow_default_constructible<state_alloc_type>::value)
+			: indexable_type(), value_alloc_type(), state_alloc_type(),
+			  _start(), _finish(_start), _capacity(), _count(),
+			  _full_state(State::Heads), _augment(), _split(), _stats(),
+			  _rebalanced(), _rebuild_factor(default_rebuild_factor()),
+			  _tombs(), _compact_ratio(default_compact_ratio()) { }
+
+			explicit _kdtree_members(const indexable_type& i,
+			                         const value_alloc_type& a,
+			                         const state_alloc_type& s)
+				noexcept(std::is_nothrow_copy_constructible<value_alloc_type>::value
+				         && std::is_nothrow_copy_constructible<state_alloc_type>::value)
+				: indexable_type(i), value_alloc_type(a), state_alloc_type(s),
+				  _start(), _finish(_start), _capacity(), _count(),
+				  _full_state(State::Heads), _augment(), _split(), _stats(),
+				  _rebalanced(), _rebuild_factor(default_rebuild_factor()),
+				  _tombs(), _compact_ratio(default_compact_ratio()) { }
+
+			_kdtree_members(const _kdtree_members& x)
+				noexcept(std::is_nothrow_copy_constructible<value_alloc_type>::value
+				         && std::is_nothrow_copy_constructible<state_alloc_type>::value
+				         && std::is_nothrow_copy_constructible<split_type>::value
+				         && std::is_nothrow_copy_constructible<tombstones_type>::value)
+				: indexable_type(static_cast<const indexable_type&>(x)),
+				  value_alloc_type(static_cast<const value_alloc_type&>(x)),
+				  state_alloc_type(static_cast<const state_alloc_type&>(x)),
+				  _start(), _finish(_start), _capacity(), _count(),
+				  _full_state(x._full_state), _augment(), _split(x._split),
+				  _stats(), _rebalanced(), _rebuild_factor(x._rebuild_factor),
+				  _tombs(x._tombs), _compact_ratio(x._compact_ratio) { }
+
+			_kdtree_members(_kdtree_members&& x)
+				noexcept(std::is_nothrow_move_constructible<value_alloc_type>::value
+				         && std::is_nothrow_move_constructible<state_alloc_type>::value)
+				: indexable_type(static_cast<indexable_type&&>(x)),
+				  value_alloc_type(static_cast<value_alloc_type&&>(x)),
+				  state_alloc_type(static_cast<state_alloc_type&&>(x)),
+				  _start(), _finish(_start), _capacity(), _count(),
+				  _full_state(State::Heads), _augment(), _split(), _stats(),
+				  _rebalanced(), _rebuild_factor(x._rebuild_factor), _tombs(),
+				  _compact_ratio(x._compact_ratio)
+			{
+				std::swap(_start, x._start);
+				std::swap(_finish, x._finish);
+				std::swap(_capacity, x._capacity);
+				std::swap(_count, x._count);
+				std::swap(_full_state, x._full_state);
+				std::swap(_augment, x._augment);
+				std::swap(_split, x._split);
+				std::swap(_rebalanced, x._rebalanced);
+				std::swap(_tombs, x._tombs);
+			}
+
+			/**
+			 *  Exchange the values and their layout with x, leaving the index,
+			 *  the allocators, the statistics and the settings in place.
+			 */
+			void _swap_storage(_kdtree_members& x) noexcept
+			{
+				std::swap(_start, x._start);
+				std::swap(_finish, x._finish);
+				std::swap(_capacity, x._capacity);
+				std::swap(_count, x._count);
+				std::swap(_full_state, x._full_state);
+				std::swap(_augment, x._augment);
+				std::swap(_split, x._split);
+				std::swap(_rebalanced, x._rebalanced);
+				std::swap(_tombs, x._tombs);
+			}
+		} _impl;
+
+		value_alloc_type& _get_value_alloc() noexcept
+		{ return static_cast<value_alloc_type&>(_impl); }
+		const value_alloc_type& _get_value_alloc() const noexcept
+		{ return static_cast<const value_alloc_type&>(_impl); }
+		state_alloc_type& _get_state_alloc() noexcept
+		{ return static_cast<state_alloc_type&>(_impl); }
+		const state_alloc_type& _get_state_alloc() const noexcept
+		{ return static_cast<const state_alloc_type&>(_impl); }
+
+		/**
+		 *  Create initial storage for the flat tree. Always allocate the smallest
+		 *  power of 2 that fits the requested size so that a perfectly balanced
+		 *  tree fits in.
+		 *
+		 *  _alloc_storage may throw but will leave the tree in a consistent state
+		 *  if it does.
+		 */
+		void _alloc_storage(std::size_t n)
+		{
+			if (n == 0) { return; }
+			n = details::bitwise<std::size_t>::ftz(n);
+			value_pointer v = value_alloc_traits::allocate(_get_value_alloc(), n);
+			state_pointer s;
+			try
+			{ s = state_alloc_traits::allocate(_get_state_alloc(), n); }
+			catch(...)
+			{
+				value_alloc_traits::deallocate(_get_value_alloc(), v, n);
+				throw;
+			}
+			_impl._capacity = n;
+			_impl._start.reset(v, s);
+			_impl._finish = _impl._start;
+		}
+
+		void _dealloc_storage() noexcept
+		{
+			value_alloc_traits::deallocate
+				(_get_value_alloc(), _impl._start->value_ptr(), _impl._capacity);
+			state_alloc_traits::deallocate
+				(_get_state_alloc(), _impl._start->state_ptr(), _impl._capacity);
+			_impl._capacity = 0;
+		}
+
+		/**
+		 *  Expand the tree by inserting a Invalid value between each exisiting values. Can
+		 *  expand with overlapping memory segments.
+		 */
+		void _expand(value_pointer vp, state_pointer cp) noexcept
+		{
+			auto offset = (_impl._finish - _impl._start) * 2;
+			iterator slow(_impl._finish);
+			iterator first(vp, cp);
+			iterator last(vp + offset, cp + offset);
+			last->state() = State::Invalid;
+			while (last != first)
+			{
+				--last; --slow;
+				last->state() = slow->state();
+				std::memcpy(last->value_ptr(), slow->value_ptr(), sizeof(value_type));
+				--last;
+				last->state() = State::Invalid;
+			}
+			_impl._finish.reset(vp + offset + 1, cp + offset + 1);
+		}
+
+		void _alloc_expand()
+		{
+			_impl._stats.expand();
+			std::size_t n = (_impl._capacity * 2) + 1;
+			value_pointer vp = value_alloc_traits::allocate(_get_value_alloc(), n);
+			state_pointer cp;
+			try
+			{ cp = state_alloc_traits::allocate(_get_state_alloc(), n); }
+			catch (...)
+			{
+				value_alloc_traits::deallocate(_get_value_alloc(), vp, n);
+				throw;
+			}
+			// code above may throw but will leave the tree in a consistent state
+			_expand(vp, cp);
+			value_alloc_traits::deallocate(_get_value_alloc(),
+			                               _impl._start->value_ptr(), _impl._capacity);
+			state_alloc_traits::deallocate(_get_state_alloc(),
+			                               _impl._start->state_ptr(), _impl._capacity);
+			_impl._start.reset(vp, cp);
+			_impl._capacity = n;
+		}
+
+		iterator _alloc_insert(const value_type& val)
+		{
+			if (_stored() == 0)
+			{
+				if (_impl._capacity == 0)
+				{ _alloc_storage(1); }
+				_impl._finish = _impl._start + 1;
+			}
+			else
+				if (_stored() == static_cast<std::size_t>(_impl._finish - _impl._start))
+				{
+					auto old_dist = _impl._finish - _impl._start;
+					_impl._split.reserve(2 * old_dist + 1);
+					_impl._tombs.reserve(2 * old_dist + 1);
+					if (_stored() == _impl._capacity) { _alloc_expand(); }
+					else { _expand(_impl._start->value_ptr(), _impl._start->state_ptr()); }
+					_impl._split.expand(old_dist);
+					_impl._tombs.expand(old_dist);
+					_impl._full_state = ~_impl._full_state;
+					_rebuild_augment();
+				}
+			// code above may throw but will leave the tree in a consistent state
+			++_impl._count;
+			auto dist = _impl._finish - _impl._start;
+			iterator node = root(_impl._start, dist);
+			return _place_insert(_root_dim(), root_offset(dist), node, val);
+		}
+
+		/**
+		 *  Collapse the tree by removing all leaves of the tree. The leaves' parent
+		 *  will become the new leaves. This operation corresponds exactly to
+		 *  removing one item between each item, collapsing the tree to half of its
+		 *  size.
+		 */
+		void _collapse() noexcept
+		{
+			auto offset = (_impl.finish() - _impl.start()) / 2;
+			iterator fast(_impl._start->value_ptr(), _impl._start->state_ptr());
+			iterator first(fast);
+			iterator last(_impl._start->value_ptr() + offset,
+			              _impl._start->state_ptr() + offset);
+			++fast; // skip first;
+			while (last != first)
+			{
+				std::memcpy(first->value_ptr(), fast->value_ptr(), sizeof(value_type));
+				first->state() = fast->state();
+				++first;
+				fast += 2; // skip invalid states;
+			}
+			_impl._finish.reset(_impl._start->value_ptr() + offset,
+			                    _impl._start->state_ptr() + offset);
+		}
+
+		/**
+		 *  Destroy all items in the flat tree, calling the destructor for each
+		 *  value_type.
+		 *
+		 *  @note If a call to ~value_type() throws an exception, the program will
+		 *  terminate since it will violate the noexcept condition. Simply stated,
+		 *  value_type destructor is not allowed to throw.
+		 */
+		void _destroy() noexcept
+		{
+			if (!std::is_trivially_destructible<value_type>::value)
+			{
+				for (iterator i = _impl._start; i != _impl._finish; ++i)
+				{ if (i->is_valid()) { i->value_ptr()->~value_type(); } }
+			}
+			_impl._finish = _impl._start;
+			_impl._count = 0;
+			_impl._rebalanced.reset();
+			_impl._augment.clear();
+			_impl._split.clear();
+			_impl._tombs.clear();
+		}
+
+		/**
+		 *  Recompute the augmentation after all values have moved. If it fails,
+		 *  the augmentation is cleared and will not be used until the next
+		 *  rebuild; queries remain correct without it.
+		 */
+		void _rebuild_augment() noexcept
+		{
+			try
+			{
+				_impl._augment.rebuild(_impl._start, _impl._finish - _impl._start,
+				                       get_index(), _live_nodes());
+			}
+			catch (...)
+			{ _impl._augment.clear(); }
+		}
+
+		/**
+		 *  Notify the augmentation that val enters the sub-tree rooted at node,
+		 *  unless val is an erased value that rebalancing moves.
+		 */
+		void _enter(const iterator& node,
+		            typename iterator::difference_type offset,
+		            const value_type& val) const noexcept
+		{
+			if (_erased_value(val)) { return; }
+			_impl._augment.enter(node - _impl._start, offset,
+			                     _impl._finish - _impl._start, val, get_index());
+		}
+
+		/**
+		 *  Notify the augmentation that val leaves the sub-tree rooted at node,
+		 *  unless val is an erased value, which already left it.
+		 */
+		void _leave(const iterator& node,
+		            typename iterator::difference_type offset,
+		            const value_type& val) const noexcept
+		{
+			if (_erased_value(val)) { return; }
+			_impl._augment.leave(node - _impl._start, offset,
+			                     _impl._finish - _impl._start, val, get_index());
+		}
+
+		/**
+		 *  True if val is the value of a node of the tree that is erased. The
+		 *  mark of a node stays where it is when its value is relocated, so it
+		 *  still tells about the copy left behind.
+		 */
+		bool _erased_value(const value_type& val) const noexcept
+		{
+			if (_impl._tombs.size() == 0) { return false; }
+			const value_type* v = std::addressof(val);
+			const value_type* first = _impl._start->value_ptr();
+			std::less<const value_type*> less;
+			if (less(v, first) || !less(v, first + (_impl._finish - _impl._start)))
+			{ return false; }
+			return _impl._tombs.dead(v - first);
+		}
+
+		/**
+		 *  Notify the augmentation that the value of node has changed.
+		 */
+		void _moved(const iterator& node) const noexcept
+		{
+			_impl._stats.relocate();
+			_impl._rebalanced.add(1);
+			_impl._augment.moved(node - _impl._start, node->value(), get_index());
+		}
+
+		/**
+		 *  Move the value of from to to, along with its tombstone.
+		 */
+		void _relocate(const iterator& to, const iterator& from) const noexcept
+		{
+			std::memcpy(to->value_ptr(), from->value_ptr(), sizeof(value_type));
+			_impl._tombs.move(to - _impl._start, from - _impl._start);
+			_moved(to);
+		}
+
+		/**
+		 *  True if node holds a value that was not erased; node must be valid.
+		 */
+		bool _live(const iterator& node) const noexcept
+		{ return !_impl._tombs.dead(node - _impl._start); }
+
+		details::live_node _live_nodes() const noexcept
+		{ return _impl._tombs.live(_impl._start); }
+
+		/**
+		 *  The number of values in the nodes, erased or not.
+		 */
+		std::size_t _stored() const noexcept
+		{ return _impl._count + _impl._tombs.size(); }
+
+		/**
+		 *  The index to compare values with: \ref get_index(), through a view
+		 *  that counts the comparisons under \ref count_operations.
+		 */
+		compare_index_type _index() const noexcept
+		{ return _impl._stats.index(get_index()); }
+
+		void _visit() const noexcept { _impl._stats.visit(); }
+
+		/**
+		 *  The bounding box of the sub-tree rooted at node, or nullptr if it is not
+		 *  cached.
+		 */
+		const value_type* _box(const iterator& node,
+		                       typename iterator::difference_type offset)
+			const noexcept
+		{
+			return _impl._augment.box(node - _impl._start, offset,
+			                          _impl._finish - _impl._start);
+		}
+
+		/**
+		 *  The functor that gives the dimension of a node from the dimension of
+		 *  its parent.
+		 */
+		child_dim_type _dims() const noexcept
+		{ return _impl._split.child_dim(_impl._start); }
+
+		dimension_type _child_dim(const iterator& child,
+		                          dimension_type node_dim) const noexcept
+		{ return _dims()(child, node_dim); }
+
+		/**
+		 *  The dimension of the root; with \ref cyclic_split, it is 0.
+		 */
+		dimension_type _root_dim() const noexcept
+		{
+			return _dims()(root(_impl._start, _impl._finish - _impl._start),
+			               indexable_type::kth() - 1);
+		}
+
+		/**
+		 *  List initialization works with the average O(n.log(n)) algorithm. This
+		 *  algorithm may have worst case performance of O(n^2).
+		 *
+		 *  Storage must be allocated for at least the number of values in [first,
+		 *  last) and the tree must be empty. If copying a value throws, the tree
+		 *  is left empty.
+		 */
+		template<typename ForwardIterator>
+		void _uninitialized_insert(ForwardIterator first, ForwardIterator last)
+		{
+			std::vector<const value_type*> values;
+			for (; first != last; ++first) { values.push_back(std::addressof(*first)); }
+			_remove_equal(values, Keys());
+			_uninitialized_build(values);
+		}
+
+		/**
+		 *  Copy the values pointed to into a balanced tree. The same
+		 *  requirements as \ref _uninitialized_insert apply, and values must
+		 *  not hold two equal values under \ref unique_keys.
+		 */
+		void _uninitialized_build(std::vector<const value_type*>& values)
+		{
+			if (values.empty()) { return; }
+			auto dist = static_cast<typename iterator::difference_type>
+				(details::bitwise<std::size_t>::ftz(values.size()));
+			_impl._split.assign(dist);
+			_impl._finish = _impl._start + dist;
+			std::memset(std::addressof(_impl._start->state()),
+			            static_cast<int>(State::Invalid), static_cast<std::size_t>(dist));
+			iterator node = root(_impl._start, dist);
+			try
+			{
+				_build(_root_dim(), root_offset(dist), node,
+				       values.data(), values.data() + values.size(),
+				       std::false_type());
+			}
+			catch (...) { _destroy(); throw; }
+			_impl._count = values.size();
+			_rebuild_augment();
+		}
+
+		/**
+		 *  True when more values moved since the last build than
+		 *  rebuild_factor() times the n.log2(n) operations of a build. This
+		 *  happens when inserts keep rebalancing large sub-trees, as with
+		 *  sorted values, and a rebuild spreads the free nodes evenly again.
+		 *  Pending moves that are yet to come count as well.
+		 */
+		bool _rebuild_due(std::size_t pending = 0) const noexcept
+		{
+			if (_impl._rebuild_factor <= 0 || _impl._count < 2) { return false; }
+			double n = static_cast<double>(_impl._count);
+			return static_cast<double>(_impl._rebalanced.get() + pending)
+				> _impl._rebuild_factor * n * std::log2(n);
+		}
+
+		/**
+		 *  Build a copy of the tree without its erased values, and with copies
+		 *  of the values pointed to by extra, in new storage of the same
+		 *  capacity or more, and replace the tree with it. Under \ref
+		 *  unique_keys, extra must not hold values equal to each other or to
+		 *  values of the tree. If copying a value throws, the tree is left
+		 *  unchanged.
+		 */
+		void _rebuild(const std::vector<const value_type*>& extra
+		              = std::vector<const value_type*>())
+		{
+			std::vector<const value_type*> values;
+			values.reserve(_impl._count + extra.size());
+			for (iterator i = _impl._start; i != _impl._finish; ++i)
+			{
+				if (i->is_valid() && _live(i))
+				{ values.push_back(std::addressof(i->value())); }
+			}
+			values.insert(values.end(), extra.begin(), extra.end());
+			kdtree tmp(std::max(_impl._capacity, values.size()), get_index(),
+			           get_allocator());
+			tmp._uninitialized_build(values);
+			_impl._swap_storage(tmp._impl);
+			_impl._rebalanced.reset();
+			_impl._stats.rebuild();
+		}
+
+		/**
+		 *  Rebuild in place the sub-tree rooted at pos, whose children are at
+		 *  offset, without its erased values. A sub-tree holds enough values
+		 *  to fill all but its last level, so when the other values are too
+		 *  few, some erased values are kept to fill it. The sub-tree is left as
+		 *  it is when erased values make less than compact_ratio() of its
+		 *  values, or when none of them could be removed. Only the allocation
+		 *  of the buffers may throw, before the tree is modified.
+		 */
+		bool _compact(typename iterator::difference_type pos,
+		              typename iterator::difference_type offset)
+		{
+			iterator node = _impl._start + pos;
+			iterator first = subtree_begin(node, offset);
+			iterator last = subtree_end(node, offset);
+			std::size_t live = 0;
+			std::size_t dead = 0;
+			for (iterator i = first; i != last; ++i)
+			{ if (i->is_valid()) { ++(_live(i) ? live : dead); } }
+			std::size_t least = static_cast<std::size_t>(2 * offset - 1);
+			std::size_t keep = (live < least) ? least - live : 0;
+			if (dead <= keep || offset == 0
+			    || static_cast<double>(dead)
+			       < _impl._compact_ratio * static_cast<double>(live + dead))
+			{ return false; }
+			// the ancestors of node, whose states change with its own
+			auto dist = _impl._finish - _impl._start;
+			std::vector<std::pair<iterator, typename iterator::difference_type>>
+				path;
+			iterator anc = root(_impl._start, dist);
+			dimension_type node_dim = _root_dim();
+			for (auto o = root_offset(dist); anc != node; o /= 2)
+			{
+				path.push_back(std::make_pair(anc, o));
+				anc = (node - anc < 0) ? left(anc, o) : right(anc, o);
+				node_dim = _child_dim(anc, node_dim);
+			}
+			typedef typename std::aligned_storage
+				<sizeof(value_type), alignof(value_type)>::type storage_type;
+			std::vector<storage_type> buffer(live + keep);
+			std::vector<const value_type*> values(live + keep);
+			// code above may throw but will leave the tree in a consistent state
+			// live values go first in the buffer, then the erased values kept
+			std::size_t l = 0;
+			std::size_t k = live;
+			for (iterator i = first; i != last; ++i)
+			{
+				if (!i->is_valid()) { continue; }
+				bool alive = _live(i);
+				if (alive || k != live + keep)
+				{
+					std::size_t b = alive ? l++ : k++;
+					void* p = std::addressof(buffer[b]);
+					std::memcpy(p, i->value_ptr(), sizeof(value_type));
+					values[b] = static_cast<const value_type*>(p);
+				}
+				else
+				{
+					// If the line below throws, the program terminates
+					i->value_ptr()->~value_type();
+				}
+				if (!alive) { _impl._tombs.remove(i - _impl._start); }
+				i->state() = State::Invalid;
+			}
+			_build(node_dim, offset, node, values.data(),
+			       values.data() + values.size(),
+			       _relocate_from(buffer.data() + live));
+			for (auto a = path.rbegin(); a != path.rend(); ++a)
+			{
+				a->first->state() = left(a->first, a->second)->state()
+					+ right(a->first, a->second)->state();
+			}
+			return true;
+		}
+
+		/**
+		 *  Compact incrementally when erased values make compact_ratio() of
+		 *  the values stored.
+		 */
+		void _compact_if_due()
+		{
+			if (static_cast<double>(_impl._tombs.size())
+			    >= _impl._compact_ratio * static_cast<double>(_stored()))
+			{ compact(1024); }
+		}
+
+		void _erase(const iterator& node)
+		{
+			auto dist = _impl._finish - _impl._start;
+			_impl._tombs.mark(node - _impl._start, dist);
+			--_impl._count;
+			// the value is marked, so it must leave its sub-trees unchecked
+			_walk_to(node, [&](const iterator& anc,
+			                   typename iterator::difference_type o,
+			                   dimension_type)
+			{
+				_impl._augment.leave(anc - _impl._start, o, dist, node->value(),
+				                     get_index());
+			});
+		}
+
+		/**
+		 *  Call f(ancestor, offset, dim) for each node on the path from the
+		 *  root to node, node included, and return the offset of node.
+		 */
+		template<typename Function>
+		typename iterator::difference_type
+		_walk_to(const iterator& node, Function f) const
+		{
+			auto dist = _impl._finish - _impl._start;
+			iterator anc = root(_impl._start, dist);
+			dimension_type anc_dim = _root_dim();
+			auto o = root_offset(dist);
+			for (; anc != node; o /= 2)
+			{
+				f(anc, o, anc_dim);
+				anc = (node - anc < 0) ? left(anc, o) : right(anc, o);
+				anc_dim = _child_dim(anc, anc_dim);
+			}
+			f(anc, o, anc_dim);
+			return o;
+		}
+
+		/**
+		 *  True if val can replace the value of node without breaking the
+		 *  splits: val is on the same side as node of all its ancestors, and
+		 *  between the values of its left and right sub-trees along its own
+		 *  dimension. Only the sub-tree on the side where val moves is
+		 *  searched, and only if val moves along that dimension.
+		 */
+		bool _fits(const iterator& node, const value_type& val) const noexcept
+		{
+			bool fits = true;
+			_walk_to(node, [&](const iterator& anc,
+			                   typename iterator::difference_type o,
+			                   dimension_type d)
+			{
+				if (!fits) { return; }
+				if (node - anc < 0)
+				{ fits = !select_compare(d, anc->value(), val, _index()); }
+				else if (anc != node)
+				{ fits = !select_compare(d, val, anc->value(), _index()); }
+				else if (o != 0)
+				{
+					if (select_compare(d, val, node->value(), _index()))
+					{
+						_impl._stats.extremum();
+						iterator child = left(node, o);
+						fits = !child->is_valid()
+							|| !select_compare(d, val, maximum
+							                   (d, _child_dim(child, d), o / 2,
+							                    child, _index(), _dims())->value(),
+							                   _index());
+					}
+					else if (select_compare(d, node->value(), val, _index()))
+					{
+						_impl._stats.extremum();
+						iterator child = right(node, o);
+						fits = !child->is_valid()
+							|| !select_compare(d, minimum
+							                   (d, _child_dim(child, d), o / 2,
+							                    child, _index(), _dims())->value(),
+							                   val, _index());
+					}
+				}
+			});
+			return fits;
+		}
+
+		void _remove_equal(std::vector<const value_type*>&, duplicate_keys)
+			const noexcept { }
+
+		/**
+		 *  Keep only the first of the values that are equal along all
+		 *  dimensions.
+		 */
+		void _remove_equal(std::vector<const value_type*>& values, unique_keys)
+			const
+		{
+			auto lexicographic = [this](const value_type* a, const value_type* b)
+			{
+				for (dimension_type d = 0; d < indexable_type::kth(); ++d)
+				{
+					if (select_compare(d, *a, *b, _index())) { return true; }
+					if (select_compare(d, *b, *a, _index())) { return false; }
+				}
+				return false;
+			};
+			std::stable_sort(values.begin(), values.end(), lexicographic);
+			values.erase(std::unique(values.begin(), values.end(),
+			                         [&](const value_type* a, const value_type* b)
+			                         { return !lexicographic(a, b); }),
+			             values.end());
+		}
+
+		/**
+		 *  Build the sub-tree rooted at node from the values in [first, last):
+		 *  the median along the dimension chosen by the splitting policy goes to
+		 *  node, the values before it to the left and the others to the right.
+		 *  Both sides get half of the values, so all internal nodes are valid.
+		 */
+		template<typename Relocate>
+		void _build(dimension_type node_dim,
+		            typename iterator::difference_type offset, iterator node,
+		            const value_type** first, const value_type** last,
+		            Relocate relocate)
+		{
+			_impl._split.set(node - _impl._start, node_dim);
+			if (first == last) { return; }
+			auto n = last - first;
+			if (n > 1)
+			{
+				node_dim = _impl._split.choose(first, last, node_dim, get_index());
+				_impl._split.set(node - _impl._start, node_dim);
+			}
+			const value_type** mid = first + (n - 1) / 2;
+			std::nth_element(first, mid, last,
+			                 [this, node_dim](const value_type* a, const value_type* b)
+			                 { return select_compare(node_dim, *a, *b, _index()); });
+			_place(node, **mid, relocate);
+			node->state() = _impl._full_state;
+			if (offset == 0) { return; }
+			_build(inc<indexable_type::kth()>(node_dim), offset / 2,
+			       left(node, offset), first, mid, relocate);
+			_build(inc<indexable_type::kth()>(node_dim), offset / 2,
+			       right(node, offset), mid + 1, last, relocate);
+			node->state() = (n == 4 * offset - 1) ? _impl._full_state
+				: (n == 2 * offset - 1) ? ~_impl._full_state : State::Neither;
+		}
+
+		/**
+		 *  Copy val into the empty node.
+		 */
+		void _place(const iterator& node, const value_type& val, std::false_type)
+		{ ::new(static_cast<void*>(std::addressof(node->value()))) value_type(val); }
+
+		/**
+		 *  Tag for _build() to move values that the tree no longer holds, from
+		 *  a buffer where the values stored from erased on are erased values.
+		 */
+		struct _relocate_from
+		{
+			explicit _relocate_from(const void* e) noexcept : erased(e) { }
+			const void* erased;
+		};
+
+		/**
+		 *  Move val into the empty node, and mark it erased again if it was.
+		 */
+		void _place(const iterator& node, const value_type& val,
+		            _relocate_from tag) noexcept
+		{
+			std::memcpy(node->value_ptr(), std::addressof(val), sizeof(value_type));
+			if (std::less<const void*>()(std::addressof(val), tag.erased))
+			{ _impl._tombs.revive(node - _impl._start); }
+			else { _impl._tombs.mark(node - _impl._start, 0); }
+			_moved(node);
+		}
+
+		/**
+		 *  This function is to be called only when node is free. It will find the
+		 *  position to insert value and set all nodes on the way to Unsure.
+		 */
+		iterator _insert_when_free(dimension_type node_dim,
+		                           typename iterator::difference_type node_offset,
+		                           iterator node, const value_type& val)
+			const noexcept
+		{
+			while (node_offset != 0)
+			{
+				_enter(node, node_offset, val);
+				node->state() = State::Neither;
+				if (select_compare(node_dim, val, node->value(), _index()))
+				{ node = left(node, node_offset); }
+				else
+				{ node = right(node, node_offset); }
+				node_dim = _child_dim(node, node_dim);
+				node_offset = node_offset / 2;
+			}
+			node->state() = _impl._full_state;
+			return node;
+		}
+
+		/**
+		 *  Remove the node pointed to by \ref erase from the tree.
+		 *
+		 *  @note If @ref val throws during the call to its destructor, the program
+		 *  will terminate since it violates the noexcept policy. Simply stated,
+		 *  @ref value_type destructor should not throw.
+		 */
+		iterator _erase_iter(dimension_type node_dim,
+		                     typename iterator::difference_type offset,
+		                     const iterator& node,
+		                     const iterator& erase) const noexcept
+		{
+			iterator moved_erase;
+			if (offset > 1)
+			{
+				iterator lnode = left(node, offset);
+				iterator rnode = right(node, offset);
+				dimension_type ldim = _child_dim(lnode, node_dim);
+				dimension_type rdim = _child_dim(rnode, node_dim);
+				typename iterator::difference_type child_offset = offset / 2;
+				if (erase != node)
+				{
+					// go to erase by memory locality
+					if (erase < node)
+					{
+						if (lnode->state() == ~_impl._full_state)
+						{
+							// Cannot erase in a free tree
+							_insert_when_free(ldim, child_offset, lnode, node);
+							_impl._stats.extremum();
+							iterator tmp = minimum(node_dim, rdim, child_offset,
+							                       rnode, _index(), _dims());
+							std::memcpy(node->value_ptr(), tmp->value_ptr(), sizeof(value_type));
+							_moved(node);
+							_erase_iter(rdim, child_offset, rnode, tmp);
+						}
+						else
+						{
+
+						}
+					}
+				}
+				else
+				{
+				}
+				node->state() = lnode->state() + rnode->state();
+			}
+			else if (offset == 1)
+			{
+				// If the line below throws, the program terminates
+				erase->value_ptr()->~value_type();
+				node->state() = (node->state() == State::Neither)
+					? ~_impl._full_state : State::Neither;
+				if (node != erase)
+				{ erase->state() = State::Invalid; }
+				else
+				{
+					iterator rnode = right(node, offset);
+					if (rnode->is_valid())
+					{
+						std::memcpy(node->value_ptr(), rnode->value_ptr(), sizeof(value_type));
+						_moved(node);
+						rnode->state_ptr() = State::Invalid;
+					}
+					else
+					{
+						iterator lnode = left(node, offset);
+						std::memcpy(node->value_ptr(), lnode->value_ptr(), sizeof(value_type));
+						_moved(node);
+						lnode->state_ptr() = State::Invalid;
+					}
+				}
+			}
+			else
+			{
+				// Node is necessarily equal to erase in this case
+				node->state() = State::Invalid;
+				// If the line below throw, the program terminates
+				node->value_ptr()->~value_type();
+			}
+		}
+
+		/**
+		 *  This function is to be called only when node is full. It will not
+		 *  proceed to actual detruction of "erased", so it is important that the
+		 *  caller destroys "erased" before calling the function.
+		 */
+		void _erase_when_full(dimension_type node_dim,
+		                      typename iterator::difference_type node_offset,
+		                      iterator node, iterator erased) const noexcept
+		{
+			while (node_offset > 1)
+			{
+				typename iterator::difference_type child_offset = node_offset / 2;
+				_leave(node, node_offset, erased->value());
+				node->state() = State::Neither;
+				iterator child;
+				if (node == erased)
+				{
+					child = right(node, node_offset);
+					_impl._stats.extremum();
+					iterator tmp = minimum(node_dim, _child_dim(child, node_dim),
+					                       child_offset, child, _index(), _dims());
+					_relocate(erased, tmp);
+					erased = tmp;
+				}
+				// find erased node by memory locality
+				else if (node->value_ptr() < erased->value_ptr())
+				{ child = right(node, node_offset); }
+				else
+				{ child = left(node, node_offset); }
+				node_dim = _child_dim(child, node_dim);
+				node = child;
+				node_offset = child_offset;
+			}
+			if (node_offset == 1)
+			{
+				_leave(node, node_offset, erased->value());
+				iterator rnode = right(node, node_offset);
+				if (node == erased)
+				{
+					_relocate(node, rnode);
+					rnode->state() = State::Invalid;
+				}
+				else { erased->state() = State::Invalid; }
+				node->state() = State::Neither;
+			}
+			else
+			{ node->state() = State::Invalid; }
+			return;
+		}
+
+		/**
+		 *  Find a position to insert v into the subtree (start, root) and balance
+		 *  all items along the way to make way for v.
+		 */
+		iterator _place_insert(dimension_type node_dim,
+		                       typename iterator::difference_type offset,
+		                       const iterator& node,
+		                       const value_type& val) const noexcept
+		{
+			_enter(node, offset, val);
+			if (offset == 1)
+			{
+				iterator lnode = left(node, offset);
+				iterator rnode = right(node, offset);
+				iterator insert;
+				if (select_compare(node_dim, val, node->value(), _index()))
+				{
+					if (lnode->is_valid())
+					{
+						_relocate(rnode, node);
+						rnode->state() = _impl._full_state;
+						node->state() = _impl._full_state;
+						if (select_compare(node_dim, val, lnode->value(), _index()))
+						{
+							_relocate(node, lnode);
+							insert = lnode;
+						}
+						else
+						{ insert = node; }
+					}
+					else
+					{
+						lnode->state() = _impl._full_state;
+						node->state() = rnode->is_valid()
+							? _impl._full_state : State::Neither;
+						insert = lnode;
+					}
+				}
+				else
+				{
+					if (rnode->is_valid())
+					{
+						_relocate(lnode, node);
+						lnode->state() = _impl._full_state;
+						node->state() = _impl._full_state;
+						if (select_compare(node_dim, rnode->value(), val, _index()))
+						{
+							_relocate(node, rnode);
+							insert = rnode;
+						}
+						else
+						{ insert = node; }
+					}
+					else
+					{
+						rnode->state() = _impl._full_state;
+						node->state() = lnode->is_valid()
+							? _impl._full_state : State::Neither;
+						insert = rnode;
+					}
+				}
+				return insert;
+			}
+			else if (offset > 1)
+			{
+				typename iterator::difference_type child_offset = offset / 2;
+				iterator lnode = left(node, offset);
+				iterator rnode = right(node, offset);
+				dimension_type ldim = _child_dim(lnode, node_dim);
+				dimension_type rdim = _child_dim(rnode, node_dim);
+				iterator insert;
+				if (select_compare(node_dim, val, node->value(), _index()))
+				{
+					if (lnode->state() == _impl._full_state)
+					{
+						iterator tmp
+							= _place_insert(rdim, child_offset, rnode, node->value());
+						_relocate(tmp, node);
+						_impl._stats.extremum();
+						tmp = maximum(node_dim, ldim, child_offset, lnode, _index(),
+						              _dims());
+						if (select_compare(node_dim, val, tmp->value(), _index()))
+						{
+							_relocate(node, tmp);
+							_erase_when_full(ldim, child_offset, lnode, tmp);
+							insert = _place_insert(ldim, child_offset, lnode, val);
+						}
+						else
+						{ insert = node; }
+					}
 					else if (lnode->state() == ~_impl._full_state)
-					{ insert = _insert_when_free(child_dim, child_offset, lnode, val); }
+					{ insert = _insert_when_free(ldim, child_offset, lnode, val); }
+					else
+					{ insert = _place_insert(ldim, child_offset, lnode, val); }
+				}
+				else if (select_compare(node_dim, node->value(), val, _index()))
+				{
+					if (rnode->state() == _impl._full_state)
+					{
+						iterator tmp
+							= _place_insert(ldim, child_offset, lnode, node->value());
+						_relocate(tmp, node);
+						_impl._stats.extremum();
+						tmp = minimum(node_dim, rdim, child_offset, rnode, _index(),
+						              _dims());
+						if (select_compare(node_dim, tmp->value(), val, _index()))
+						{
+							_relocate(node, tmp);
+							_erase_when_full(rdim, child_offset, rnode, tmp);
+							insert = _place_insert(rdim, child_offset, rnode, val);
+						}
+						else
+						{ insert = node; }
+					}
+					else if (rnode->state() == ~_impl._full_state)
+					{ insert = _insert_when_free(rdim, child_offset, rnode, val); }
 					else
-					{ insert = _place_insert(child_dim, child_offset, lnode, val); }
+					{ insert = _place_insert(rdim, child_offset, rnode, val); }
+				}
+				else
+				{
+					insert = (lnode->state() == _impl._full_state)
+						? _place_insert(rdim, child_offset, rnode, val)
+						: _place_insert(ldim, child_offset, lnode, val);
+				}
+				// modify state accordingly and return insert
+				node->state() = lnode->state() + rnode->state();
+				return insert;
+			}
+			else
+			{
+				// offset == 0, necessarily empty
+				node->state() = _impl._full_state;
+				return node;
+			}
+		}
+
+		iterator
+		_find(dimension_type node_dim,
+		      typename iterator::difference_type node_offset,
+		      iterator node, const value_type& val) const noexcept
+		{
+			for (; node->is_valid();)
+			{
+				_visit();
+				bool left_only
+					= select_compare(node_dim, val, node->value(), _index());
+				bool right_only
+					= select_compare(node_dim, node->value(), val, _index());
+				if (!left_only && !right_only)
+				{
+					dimension_type i = 0;
+					for (; i < node_dim; ++i)
+					{
+						if (select_compare(i, node->value(), val, _index())
+						    || select_compare(i, val, node->value(), _index()))
+						{ break; }
+					}
+					if (i == node_dim)
+					{
+						for (++i; i < indexable_type::kth(); ++i)
+						{
+							if (select_compare(i, node->value(), val, _index())
+							    || select_compare(i, val, node->value(), _index()))
+							{ break; }
+						}
+						if (i == indexable_type::kth() && _live(node)) { return node; }
+					}
+				}
+				if (node_offset != 0)
+				{
+					auto child_offset = node_offset / 2;
+					if (!right_only)
+					{
+						iterator lnode = left(node, node_offset);
+						iterator probe = _find(_child_dim(lnode, node_dim),
+						                       child_offset, lnode, val);
+						if (probe != _impl._finish) { return probe; }
+					}
+					if (left_only) { break; }
+					iterator rnode = right(node, node_offset);
+					node_dim = _child_dim(rnode, node_dim);
+					node = rnode;
+					node_offset = child_offset;
+				}
+				else { break; }
+			}
+			return _impl._finish;
+		}
+
+		/**
+		 *  \ref _find for a sub-tree whose root splits dimension D, known at
+		 *  compile time. The descent to the right is a tail call to the kernel
+		 *  of the next dimension, so that each level is compiled with a constant
+		 *  dimension.
+		 */
+		template<dimension_type D>
+		iterator
+		_find(details::dim_constant<D>,
+		      typename iterator::difference_type node_offset,
+		      iterator node, const value_type& val) const noexcept
+		{
+			using next = details::dim_constant<(D + 1) % indexable_type::kth()>;
+			if (!node->is_valid()) { return _impl._finish; }
+			_visit();
+			bool left_only = select_compare(D, val, node->value(), _index());
+			bool right_only = select_compare(D, node->value(), val, _index());
+			if (!left_only && !right_only
+			    && details::equal_except<D, indexable_type::kth()>
+			    ::test(node->value(), val, _index())
+			    && _live(node))
+			{ return node; }
+			if (node_offset == 0) { return _impl._finish; }
+			if (!right_only)
+			{
+				iterator probe = _find(next(), node_offset / 2,
+				                       left(node, node_offset), val);
+				if (probe != _impl._finish) { return probe; }
+			}
+			if (left_only) { return _impl._finish; }
+			return _find(next(), node_offset / 2, right(node, node_offset), val);
+		}
+
+		/**
+		 *  A \ref branchless descent in progress: the position and dimension of
+		 *  its next node, and the first node on its path that is equivalent to
+		 *  the value along its dimension, if any.
+		 */
+		struct _descent
+		{
+			typename iterator::difference_type pos;
+			typename iterator::difference_type tie;
+			typename iterator::difference_type tie_offset;
+			dimension_type dim;
+			dimension_type tie_dim;
+		};
+
+		_descent _descent_root() const noexcept
+		{
+			auto dist = _impl._finish - _impl._start;
+			return _descent{dist / 2, dist, 0, _root_dim(), 0};
+		}
+
+		/**
+		 *  Visit the next node of d, which is at the given offset from its
+		 *  children. Internal nodes are always valid, so only leaves need a
+		 *  check.
+		 */
+		void _descend(_descent& d, typename iterator::difference_type offset,
+		              const child_dim_type& dims, const value_type& val)
+			const noexcept
+		{
+			iterator node = _impl._start + d.pos;
+			if (offset == 0 && !node->is_valid()) { return; }
+			_visit();
+			bool less = select_compare(d.dim, node->value(), val, _index());
+			bool greater = select_compare(d.dim, val, node->value(), _index());
+			bool first = (d.tie == _impl._finish - _impl._start) & !less & !greater;
+			d.tie = first ? d.pos : d.tie;
+			d.tie_offset = first ? offset : d.tie_offset;
+			d.tie_dim = first ? d.dim : d.tie_dim;
+			if (offset == 0) { return; }
+			d.pos += less ? offset : -offset;
+			d.dim = dims(_impl._start + d.pos, d.dim);
+		}
+
+		/**
+		 *  The node found by the complete descent d. Both sides of its tie are
+		 *  searched only when the tie is not equal to val.
+		 */
+		iterator _descent_result(const _descent& d, const value_type& val)
+			const noexcept
+		{
+			if (d.tie == _impl._finish - _impl._start) { return _impl._finish; }
+			iterator node = _impl._start + d.tie;
+			if (details::equal_except<indexable_type::kth(), indexable_type::kth()>
+			    ::test(node->value(), val, _index())
+			    && _live(node))
+			{ return node; }
+			return _find(d.tie_dim, d.tie_offset, node, val);
+		}
+
+		/**
+		 *  See \ref branchless.
+		 */
+		iterator _find(const value_type& val, branchless) const noexcept
+		{
+			child_dim_type dims = _dims();
+			_descent d = _descent_root();
+			for (auto offset = root_offset(_impl._finish - _impl._start);;
+			     offset /= 2)
+			{
+				_descend(d, offset, dims, val);
+				if (offset == 0) { break; }
+			}
+			return _descent_result(d, val);
+		}
+
+		/**
+		 *  See \ref interleaved. All the descents have the same length, so the
+		 *  group moves one level at a time.
+		 */
+		template<typename OutputIterator>
+		OutputIterator
+		_find(const std::vector<value_type>& vals, std::vector<_descent>& paths,
+		      OutputIterator out) const
+		{
+			child_dim_type dims = _dims();
+			paths.assign(vals.size(), _descent_root());
+			for (auto offset = root_offset(_impl._finish - _impl._start);;
+			     offset /= 2)
+			{
+				for (std::size_t i = 0; i < vals.size(); ++i)
+				{
+					_descend(paths[i], offset, dims, vals[i]);
+					iterator next = _impl._start + paths[i].pos;
+					details::prefetch(std::addressof(next->value()));
+					// only the state of the leaves is read
+					if (offset == 1)
+					{ details::prefetch(std::addressof(next->state())); }
+				}
+				if (offset == 0) { break; }
+			}
+			for (std::size_t i = 0; i < vals.size(); ++i, ++out)
+			{ *out = const_iterator(_descent_result(paths[i], vals[i])); }
+			return out;
+		}
+
+		iterator _find_equal(const value_type&, duplicate_keys) const noexcept
+		{ return _impl._finish; }
+
+		iterator _find_equal(const value_type& val, unique_keys) const noexcept
+		{
+			return (_impl._count == 0) ? _impl._finish
+				: _find_root(val, details::unrolled<child_dim_type,
+				                                    indexable_type::kth()>());
+		}
+
+		iterator _find_root(const value_type& val, std::true_type) const noexcept
+		{
+			auto dist = _impl._finish - _impl._start;
+			return _find(details::dim_constant<0>(), root_offset(dist),
+			             root(_impl._start, dist), val);
+		}
+
+		iterator _find_root(const value_type& val, std::false_type) const noexcept
+		{
+			auto dist = _impl._finish - _impl._start;
+			return _find(_root_dim(), root_offset(dist), root(_impl._start, dist),
+			             val);
+		}
+
+		/**
+		 *  \ref _find on the keys of \ref quantized_keys: a node's value is only
+		 *  compared with val when their keys are equal along the node's
+		 *  dimension, and when they are equal along all dimensions.
+		 */
+		template<typename Key>
+		iterator
+		_find(dimension_type node_dim,
+		      typename iterator::difference_type node_offset,
+		      iterator node, const value_type& val, const Key* val_keys,
+		      const Key* keys, details::refine_count& count) const noexcept
+		{
+			constexpr dimension_type K = indexable_type::kth();
+			for (; node->is_valid();)
+			{
+				_visit();
+				++count.visited;
+				const Key* node_keys
+					= keys + static_cast<std::size_t>(node - _impl._start) * K;
+				bool left_only = val_keys[node_dim] < node_keys[node_dim];
+				bool right_only = node_keys[node_dim] < val_keys[node_dim];
+				if (!left_only && !right_only)
+				{
+					++count.refined;
+					left_only
+						= select_compare(node_dim, val, node->value(), _index());
+					right_only
+						= select_compare(node_dim, node->value(), val, _index());
+					if (!left_only && !right_only
+					    && std::equal(node_keys, node_keys + K, val_keys)
+					    && details::equal_except<K, K>
+					    ::test(node->value(), val, _index())
+					    && _live(node))
+					{ return node; }
+				}
+				if (node_offset == 0) { break; }
+				auto child_offset = node_offset / 2;
+				if (!right_only)
+				{
+					iterator lnode = left(node, node_offset);
+					iterator probe = _find(_child_dim(lnode, node_dim), child_offset,
+					                       lnode, val, val_keys, keys, count);
+					if (probe != _impl._finish) { return probe; }
+				}
+				if (left_only) { break; }
+				iterator rnode = right(node, node_offset);
+				node_dim = _child_dim(rnode, node_dim);
+				node = rnode;
+				node_offset = child_offset;
+			}
+			return _impl._finish;
+		}
+
+		iterator _find_quantized(const value_type& val, std::false_type)
+			const noexcept
+		{
+			return _find_root(val, details::unrolled<child_dim_type,
+			                                         indexable_type::kth()>());
+		}
+
+		/**
+		 *  Find val on the keys of \ref quantized_keys when they are up to date,
+		 *  and on the values otherwise.
+		 */
+		iterator _find_quantized(const value_type& val, std::true_type)
+			const noexcept
+		{
+			using key_type = typename augment_type::key_type;
+			auto dist = _impl._finish - _impl._start;
+			const key_type* keys = _impl._augment.keys(dist);
+			if (keys == nullptr) { return _find_quantized(val, std::false_type()); }
+			key_type val_keys[indexable_type::kth()];
+			_impl._augment.quantize(val, val_keys);
+			details::refine_count count = { };
+			iterator found = _find(_root_dim(), root_offset(dist),
+			                       root(_impl._start, dist), val, val_keys, keys,
+			                       count);
+			_impl._augment.count(count);
+			return found;
+		}
+
+		/**
+		 *  True if the sub-tree rooted at node has a cached bounding box that is
+		 *  not closer to origin than limit.
+		 */
+		template<typename Metric>
+		bool _outside_box(const iterator& node,
+		                  typename iterator::difference_type node_offset,
+		                  const value_type& origin, const Metric& metric,
+		                  const typename Metric::distance_type& limit)
+			const noexcept
+		{
+			const value_type* box = _box(node, node_offset);
+			typename Metric::distance_type bound;
+			return box != nullptr
+				&& details::box_bound(metric, origin, box,
+				                      box + indexable_type::kth(), bound, 0)
+				&& !(bound < limit);
+		}
+
+		/**
+		 *  True if val is within the closed box [low, high] on all dimensions.
+		 */
+		bool _within(const value_type& low, const value_type& high,
+		             const value_type& val) const noexcept
+		{
+			for (dimension_type d = 0; d < indexable_type::kth(); ++d)
+			{
+				if (select_compare(d, val, low, _index())
+				    || select_compare(d, high, val, _index()))
+				{ return false; }
+			}
+			return true;
+		}
+
+		/**
+		 *  True if the sub-tree rooted at node has a cached bounding box that does
+		 *  not intersect the closed box [low, high].
+		 */
+		bool _disjoint_box(const iterator& node,
+		                   typename iterator::difference_type node_offset,
+		                   const value_type& low, const value_type& high)
+			const noexcept
+		{
+			const value_type* box = _box(node, node_offset);
+			if (box == nullptr) { return false; }
+			for (dimension_type d = 0; d < indexable_type::kth(); ++d)
+			{
+				if (select_compare(d, box[indexable_type::kth() + d], low, _index())
+				    || select_compare(d, high, box[d], _index()))
+				{ return true; }
+			}
+			return false;
+		}
+
+		/**
+		 *  Write all values within the closed box [low, high] to out. A side of
+		 *  a node is skipped when the node's value is outside the box along the
+		 *  node's dimension, or when the side's cached bounding box is disjoint.
+		 */
+		template<typename Result, typename OutputIterator>
+		OutputIterator
+		_range(dimension_type node_dim,
+		       typename iterator::difference_type node_offset,
+		       iterator node, const value_type& low, const value_type& high,
+		       OutputIterator out) const
+		{
+			for (; node->is_valid();)
+			{
+				_visit();
+				if (_disjoint_box(node, node_offset, low, high)) { break; }
+				if (_within(low, high, node->value()) && _live(node))
+				{ *out++ = Result(node); }
+				if (node_offset == 0) { break; }
+				auto child_offset = node_offset / 2;
+				bool go_left
+					= !select_compare(node_dim, node->value(), low, _index());
+				bool go_right
+					= !select_compare(node_dim, high, node->value(), _index());
+				if (go_left && go_right)
+				{
+					iterator lnode = left(node, node_offset);
+					out = _range<Result>(_child_dim(lnode, node_dim), child_offset,
+					                     lnode, low, high, out);
+					node = right(node, node_offset);
+				}
+				else if (go_left) { node = left(node, node_offset); }
+				else if (go_right) { node = right(node, node_offset); }
+				else { break; }
+				node_dim = _child_dim(node, node_dim);
+				node_offset = child_offset;
+			}
+			return out;
+		}
+
+		/**
+		 *  \ref _range on the keys of \ref quantized_keys: a node's value is only
+		 *  compared with the bounds of the box along the dimensions where their
+		 *  keys are equal.
+		 */
+		template<typename Result, typename Key, typename OutputIterator>
+		OutputIterator
+		_range(dimension_type node_dim,
+		       typename iterator::difference_type node_offset,
+		       iterator node, const value_type& low, const value_type& high,
+		       const Key* low_keys, const Key* high_keys, const Key* keys,
+		       details::refine_count& count, OutputIterator out) const
+		{
+			constexpr dimension_type K = indexable_type::kth();
+			for (; node->is_valid();)
+			{
+				_visit();
+				++count.visited;
+				const Key* node_keys
+					= keys + static_cast<std::size_t>(node - _impl._start) * K;
+				bool outside = false;
+				bool exact = true;
+				for (dimension_type d = 0; d < K && !outside; ++d)
+				{
+					outside = node_keys[d] < low_keys[d] || high_keys[d] < node_keys[d];
+					exact = exact && low_keys[d] < node_keys[d]
+						&& node_keys[d] < high_keys[d];
+				}
+				bool refined = !outside && !exact;
+				if ((refined ? _within(low, high, node->value()) : exact)
+				    && _live(node))
+				{ *out++ = Result(node); }
+				if (node_offset == 0)
+				{
+					count.refined += refined;
+					break;
+				}
+				auto child_offset = node_offset / 2;
+				bool go_left = low_keys[node_dim] < node_keys[node_dim];
+				bool go_right = node_keys[node_dim] < high_keys[node_dim];
+				if (node_keys[node_dim] == low_keys[node_dim])
+				{
+					refined = true;
+					go_left = !select_compare(node_dim, node->value(), low, _index());
+				}
+				if (node_keys[node_dim] == high_keys[node_dim])
+				{
+					refined = true;
+					go_right
+						= !select_compare(node_dim, high, node->value(), _index());
+				}
+				count.refined += refined;
+				if (go_left && go_right)
+				{
+					iterator lnode = left(node, node_offset);
+					out = _range<Result>(_child_dim(lnode, node_dim), child_offset,
+					                     lnode, low, high, low_keys, high_keys, keys,
+					                     count, out);
+					node = right(node, node_offset);
+				}
+				else if (go_left) { node = left(node, node_offset); }
+				else if (go_right) { node = right(node, node_offset); }
+				else { break; }
+				node_dim = _child_dim(node, node_dim);
+				node_offset = child_offset;
+			}
+			return out;
+		}
+
+		template<typename Result, typename OutputIterator>
+		OutputIterator
+		_range_quantized(const value_type& low, const value_type& high,
+		                 OutputIterator out, std::false_type) const
+		{
+			auto dist = _impl._finish - _impl._start;
+			return _range<Result>(_root_dim(), root_offset(dist),
+			                      root(_impl._start, dist), low, high, out);
+		}
+
+		/**
+		 *  Find the values within [low, high] on the keys of \ref quantized_keys
+		 *  when they are up to date, and on the values otherwise.
+		 */
+		template<typename Result, typename OutputIterator>
+		OutputIterator
+		_range_quantized(const value_type& low, const value_type& high,
+		                 OutputIterator out, std::true_type) const
+		{
+			using key_type = typename augment_type::key_type;
+			auto dist = _impl._finish - _impl._start;
+			const key_type* keys = _impl._augment.keys(dist);
+			if (keys == nullptr)
+			{ return _range_quantized<Result>(low, high, out, std::false_type()); }
+			key_type low_keys[indexable_type::kth()];
+			key_type high_keys[indexable_type::kth()];
+			_impl._augment.quantize(low, low_keys);
+			_impl._augment.quantize(high, high_keys);
+			details::refine_count count = { };
+			out = _range<Result>(_root_dim(), root_offset(dist),
+			                     root(_impl._start, dist), low, high, low_keys,
+			                     high_keys, keys, count, out);
+			_impl._augment.count(count);
+			return out;
+		}
+
+		/**
+		 *  True if the sub-tree rooted at node lies within the closed box [low,
+		 *  high], either because its cell does or because its cached bounding box
+		 *  does.
+		 */
+		template<typename Cell>
+		bool _contained(const iterator& node,
+		                typename iterator::difference_type node_offset,
+		                const Cell& cell,
+		                const value_type& low, const value_type& high)
+			const noexcept
+		{
+			constexpr dimension_type K = indexable_type::kth();
+			const value_type* box = _box(node, node_offset);
+			for (dimension_type d = 0; d < K; ++d)
+			{
+				const value_type* l = (box != nullptr) ? box + d : cell.low[d];
+				const value_type* h = (box != nullptr) ? box + K + d : cell.high[d];
+				if (l == nullptr || h == nullptr
+				    || select_compare(d, *l, low, _index())
+				    || select_compare(d, high, *h, _index()))
+				{ return false; }
+			}
+			return true;
+		}
+
+		/**
+		 *  The number of values in the sub-tree rooted at node, in O(1) when the
+		 *  sub-tree is full or free and the tree holds no erased value.
+		 */
+		std::size_t _subtree_aggregate(const iterator& node,
+		                               typename iterator::difference_type offset,
+		                               const details::count_monoid& monoid)
+			const noexcept
+		{
+			if (offset == 0) { return (node->is_valid() && _live(node)) ? 1 : 0; }
+			const std::size_t* cached = _impl._augment.aggregate
+				(node - _impl._start, offset, _impl._finish - _impl._start, monoid);
+			if (cached != nullptr) { return *cached; }
+			if (_impl._tombs.size() == 0)
+			{
+				if (node->state() == _impl._full_state)
+				{ return static_cast<std::size_t>(4 * offset - 1); }
+				if (node->state() == ~_impl._full_state)
+				{ return static_cast<std::size_t>(2 * offset - 1); }
+			}
+			return (_live(node) ? 1 : 0)
+				+ _subtree_aggregate(left(node, offset), offset / 2, monoid)
+				+ _subtree_aggregate(right(node, offset), offset / 2, monoid);
+		}
+
+		/**
+		 *  The aggregate of the values in the sub-tree rooted at node, from the
+		 *  augmentation if it is cached there.
+		 */
+		template<typename Monoid>
+		typename Monoid::result_type
+		_subtree_aggregate(const iterator& node,
+		                   typename iterator::difference_type offset,
+		                   const Monoid& monoid) const
+		{
+			const typename Monoid::result_type* cached = _impl._augment.aggregate
+				(node - _impl._start, offset, _impl._finish - _impl._start, monoid);
+			if (cached != nullptr) { return *cached; }
+			typename Monoid::result_type r = monoid.identity();
+			iterator last = subtree_end(node, offset);
+			for (iterator it = subtree_begin(node, offset); it != last; ++it)
+			{
+				if (it->is_valid() && _live(it))
+				{ r = monoid.combine(r, monoid(it->value())); }
+			}
+			return r;
+		}
+
+		/**
+		 *  The aggregate of all values within the closed box [low, high]. The walk
+		 *  is the one of \ref _range, but it also tracks the cell of each node,
+		 *  bounded by the values of its ancestors, so that sub-trees contained in
+		 *  the box are aggregated without being enumerated.
+		 */
+		template<typename Monoid, typename Cell>
+		typename Monoid::result_type
+		_aggregate(dimension_type node_dim,
+		           typename iterator::difference_type node_offset,
+		           iterator node, const value_type& low, const value_type& high,
+		           Cell cell, const Monoid& monoid) const
+		{
+			typename Monoid::result_type r = monoid.identity();
+			for (; node->is_valid();)
+			{
+				_visit();
+				if (_contained(node, node_offset, cell, low, high))
+				{
+					return monoid.combine
+						(r, _subtree_aggregate(node, node_offset, monoid));
+				}
+				if (_disjoint_box(node, node_offset, low, high)) { break; }
+				if (_within(low, high, node->value()) && _live(node))
+				{ r = monoid.combine(r, monoid(node->value())); }
+				if (node_offset == 0) { break; }
+				auto child_offset = node_offset / 2;
+				bool go_left
+					= !select_compare(node_dim, node->value(), low, _index());
+				bool go_right
+					= !select_compare(node_dim, high, node->value(), _index());
+				if (go_left && go_right)
+				{
+					Cell left_cell = cell;
+					left_cell.high[node_dim] = &node->value();
+					iterator lnode = left(node, node_offset);
+					r = monoid.combine
+						(r, _aggregate(_child_dim(lnode, node_dim), child_offset, lnode,
+						               low, high, left_cell, monoid));
+					cell.low[node_dim] = &node->value();
+					node = right(node, node_offset);
+				}
+				else if (go_left)
+				{
+					cell.high[node_dim] = &node->value();
+					node = left(node, node_offset);
+				}
+				else if (go_right)
+				{
+					cell.low[node_dim] = &node->value();
+					node = right(node, node_offset);
+				}
+				else { break; }
+				node_dim = _child_dim(node, node_dim);
+				node_offset = child_offset;
+			}
+			return r;
+		}
+
+		/**
+		 *  Depth-first nearest neighbor search: descend on the side of origin
+		 *  first, then visit the far side only if the splitting plane is closer
+		 *  than the worst candidate found so far.
+		 */
+		template<typename Metric, typename Filter, typename Candidates>
+		void _nearest(dimension_type node_dim,
+		              typename iterator::difference_type node_offset,
+		              iterator node, const value_type& origin,
+		              const Metric& metric, const Filter& filter,
+		              Candidates& found, depth_first) const
+		{
+			for (; node->is_valid();)
+			{
+				_visit();
+				if (!details::subtree_may_match
+				    (filter, _impl._augment, node - _impl._start, node_offset,
+				     _impl._finish - _impl._start, 0))
+				{ break; }
+				if (_live(node) && filter(node->value()))
+				{ found.push(metric.distance_to_key(origin, node->value()), node); }
+				if (node_offset == 0) { break; }
+				auto child_offset = node_offset / 2;
+				iterator near_node = left(node, node_offset);
+				iterator far_node = right(node, node_offset);
+				if (select_compare(node_dim, node->value(), origin, _index()))
+				{ std::swap(near_node, far_node); }
+				_nearest(_child_dim(near_node, node_dim), child_offset, near_node,
+				         origin, metric, filter, found, depth_first());
+				if (found.full()
+				    && (!(metric.distance_to_plane(node_dim, origin, node->value())
+				          < found.worst())
+				        || _outside_box(far_node, child_offset, origin, metric,
+				                        found.worst())))
+				{ break; }
+				node = far_node;
+				node_dim = _child_dim(far_node, node_dim);
+				node_offset = child_offset;
+			}
+		}
+
+		/**
+		 *  Best-bin-first nearest neighbor search: pending sub-trees are kept in a
+		 *  priority queue ordered by the lower bound of their distance to origin.
+		 *  The bound of a far side is the distance to the plane of its parent, or
+		 *  the bound of the parent itself if greater.
+		 */
+		template<typename Metric, typename Filter, typename Candidates>
+		void _nearest(dimension_type node_dim,
+		              typename iterator::difference_type node_offset,
+		              iterator node, const value_type& origin,
+		              const Metric& metric, const Filter& filter,
+		              Candidates& found, best_bin_first strategy) const
+		{
+			using distance_type = typename Metric::distance_type;
+			using pending_type = details::pending_node<distance_type, iterator>;
+			std::vector<pending_type> pending;
+			pending.push_back(pending_type{distance_type(), node, node_offset,
+			                               node_dim});
+			std::size_t checks = 0;
+			while (!pending.empty())
+			{
+				std::pop_heap(pending.begin(), pending.end(),
+				              details::farther_bound());
+				pending_type bin = pending.back();
+				pending.pop_back();
+				if (found.full() && !(bin.bound < found.worst())) { break; }
+				node = bin.node;
+				node_dim = bin.dim;
+				node_offset = bin.offset;
+				for (; node->is_valid();)
+				{
+					_visit();
+					if (!details::subtree_may_match
+					    (filter, _impl._augment, node - _impl._start, node_offset,
+					     _impl._finish - _impl._start, 0))
+					{ break; }
+					if (_live(node) && filter(node->value()))
+					{ found.push(metric.distance_to_key(origin, node->value()), node); }
+					if (++checks == strategy.checks) { return; }
+					if (node_offset == 0) { break; }
+					auto child_offset = node_offset / 2;
+					iterator near_node = left(node, node_offset);
+					iterator far_node = right(node, node_offset);
+					if (select_compare(node_dim, node->value(), origin, _index()))
+					{ std::swap(near_node, far_node); }
+					distance_type bound
+						= metric.distance_to_plane(node_dim, origin, node->value());
+					if (bound < bin.bound) { bound = bin.bound; }
+					const value_type* box = _box(far_node, child_offset);
+					distance_type box_bound;
+					if (box != nullptr
+					    && details::box_bound(metric, origin, box,
+					                          box + indexable_type::kth(), box_bound, 0)
+					    && bound < box_bound)
+					{ bound = box_bound; }
+					if (!found.full() || bound < found.worst())
+					{
+						pending.push_back(pending_type{bound, far_node, child_offset,
+						                               _child_dim(far_node, node_dim)});
+						std::push_heap(pending.begin(), pending.end(),
+						               details::farther_bound());
+					}
+					node = near_node;
+					node_dim = _child_dim(near_node, node_dim);
+					node_offset = child_offset;
+				}
+			}
+		}
+
+		template<typename Result, typename Metric, typename Filter,
+		         typename OutputIterator, typename Strategy>
+		OutputIterator
+		_nearest_k(const value_type& origin, std::size_t k,
+		           const Metric& metric, const Filter& filter,
+		           OutputIterator out, Strategy strategy) const
+		{
+			if (_impl._count == 0 || k == 0) { return out; }
+			details::nearest_k<typename Metric::distance_type, iterator>
+				found(k, _impl._count);
+			auto dist = _impl._finish - _impl._start;
+			_nearest(_root_dim(), root_offset(dist), root(_impl._start, dist), origin,
+			         metric, filter, found, strategy);
+			for (const auto& n : found.sorted()) { *out++ = Result(n.node); }
+			return out;
+		}
+
+		template<typename Metric, typename Strategy>
+		iterator
+		_nearest_one(const value_type& origin, const Metric& metric,
+		             Strategy strategy) const
+		{
+			if (_impl._count == 0) { return _impl._finish; }
+			details::nearest_one<typename Metric::distance_type, iterator> found;
+			auto dist = _impl._finish - _impl._start;
+			_nearest(_root_dim(), root_offset(dist), root(_impl._start, dist), origin,
+			         metric, details::accept_all(), found, strategy);
+			return found.full() ? found.best().node : _impl._finish;
+		}
+
+		/**
+		 *  Call work(w) on threads threads, w being 0 on the calling thread.
+		 *  If a thread cannot be started, the others do its share of the work.
+		 *  The first exception thrown by work is rethrown once all threads have
+		 *  finished.
+		 */
+		template<typename Work>
+		static void _in_parallel(unsigned threads, Work work)
+		{
+			std::exception_ptr error;
+			std::mutex error_lock;
+			auto guarded = [&work, &error, &error_lock](unsigned w)
+			{
+				try { work(w); }
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(error_lock);
+					if (!error) { error = std::current_exception(); }
+				}
+			};
+			std::vector<std::thread> workers;
+			try
+			{
+				workers.reserve(threads - 1);
+				for (unsigned w = 1; w < threads; ++w)
+				{ workers.emplace_back(guarded, w); }
+			}
+			catch (...) { }
+			guarded(0);
+			for (std::thread& t : workers) { t.join(); }
+			if (error) { std::rethrow_exception(error); }
+		}
+
+		/**
+		 *  The depth at which a parallel query hands sub-trees to threads
+		 *  workers when the caller leaves it to the tree: deep enough for 8
+		 *  sub-trees per worker, to even out their loads.
+		 */
+		std::size_t _parallel_depth(unsigned threads) const noexcept
+		{
+			auto dist = _impl._finish - _impl._start;
+			std::size_t depth = 0;
+			while ((std::size_t(1) << depth) < 8 * std::size_t(threads)
+			       && (std::size_t(2) << depth) <= static_cast<std::size_t>(dist))
+			{ ++depth; }
+			return depth;
+		}
+
+		/**
+		 *  The walk of \ref _range over the depth top levels of the sub-tree
+		 *  rooted at node: values found there are written to top, and the
+		 *  sub-trees below that may intersect the box are added to tasks.
+		 */
+		template<typename Tasks>
+		void _split_range(dimension_type node_dim,
+		                  typename iterator::difference_type node_offset,
+		                  iterator node, std::size_t depth,
+		                  const value_type& low, const value_type& high,
+		                  std::vector<const_iterator>& top, Tasks& tasks) const
+		{
+			if (!node->is_valid()) { return; }
+			if (depth == 0)
+			{
+				tasks.push_back(typename Tasks::value_type{0, node, node_offset,
+				                                           node_dim});
+				return;
+			}
+			_visit();
+			if (_disjoint_box(node, node_offset, low, high)) { return; }
+			if (_within(low, high, node->value()) && _live(node))
+			{ top.push_back(const_iterator(node)); }
+			if (node_offset == 0) { return; }
+			auto child_offset = node_offset / 2;
+			if (!select_compare(node_dim, node->value(), low, _index()))
+			{
+				iterator lnode = left(node, node_offset);
+				_split_range(_child_dim(lnode, node_dim), child_offset, lnode,
+				             depth - 1, low, high, top, tasks);
+			}
+			if (!select_compare(node_dim, high, node->value(), _index()))
+			{
+				iterator rnode = right(node, node_offset);
+				_split_range(_child_dim(rnode, node_dim), child_offset, rnode,
+				             depth - 1, low, high, top, tasks);
+			}
+		}
+
+		/**
+		 *  The walk of \ref _nearest over the depth top levels of the sub-tree
+		 *  rooted at node: values found there are pushed to top, and the
+		 *  sub-trees below are added to tasks with the lower bound of their
+		 *  distance to origin, as in the best-bin-first search.
+		 */
+		template<typename Metric, typename Candidates, typename Tasks>
+		void _split_nearest(dimension_type node_dim,
+		                    typename iterator::difference_type node_offset,
+		                    iterator node, std::size_t depth,
+		                    typename Metric::distance_type bound,
+		                    const value_type& origin, const Metric& metric,
+		                    Candidates& top, Tasks& tasks) const
+		{
+			if (!node->is_valid()) { return; }
+			if (depth == 0)
+			{
+				tasks.push_back(typename Tasks::value_type{bound, node, node_offset,
+				                                           node_dim});
+				return;
+			}
+			_visit();
+			if (_live(node))
+			{ top.push(metric.distance_to_key(origin, node->value()), node); }
+			if (node_offset == 0) { return; }
+			auto child_offset = node_offset / 2;
+			iterator near_node = left(node, node_offset);
+			iterator far_node = right(node, node_offset);
+			if (select_compare(node_dim, node->value(), origin, _index()))
+			{ std::swap(near_node, far_node); }
+			auto far_bound = metric.distance_to_plane(node_dim, origin, node->value());
+			if (far_bound < bound) { far_bound = bound; }
+			_split_nearest(_child_dim(near_node, node_dim), child_offset, near_node,
+			               depth - 1, bound, origin, metric, top, tasks);
+			_split_nearest(_child_dim(far_node, node_dim), child_offset, far_node,
+			               depth - 1, far_bound, origin, metric, top, tasks);
+		}
+
+		/**
+		 *  The walk of a k nearest neighbor join over the depth top levels of
+		 *  the query sub-tree rooted at node: values found there are added to
+		 *  top, and the sub-trees below to tasks, free ones included. Each of
+		 *  those sub-trees is a contiguous slice of the tree.
+		 */
+		template<typename Tasks>
+		void _split_join(typename iterator::difference_type node_offset,
+		                 iterator node, std::size_t depth,
+		                 std::vector<iterator>& top, Tasks& tasks) const
+		{
+			if (depth == 0 || node_offset == 0 || !node->is_valid())
+			{
+				tasks.push_back(typename Tasks::value_type
+				                {subtree_begin(node, node_offset),
+				                 subtree_end(node, node_offset)});
+				return;
+			}
+			top.push_back(node);
+			auto child_offset = node_offset / 2;
+			_split_join(child_offset, left(node, node_offset), depth - 1, top, tasks);
+			_split_join(child_offset, right(node, node_offset), depth - 1, top,
+			            tasks);
+		}
+
+		/**
+		 *  Write to the row of out for query value q, a node of this tree, the
+		 *  k values of reference closest to it other than itself, followed by
+		 *  reference.end(); found holds the candidates, and is left empty.
+		 */
+		template<typename Metric, typename Candidates,
+		         typename RandomAccessIterator>
+		void _join_row(const iterator& q, const kdtree& reference,
+		               std::size_t k, const Metric& metric, Candidates& found,
+		               RandomAccessIterator out) const
+		{
+			std::size_t j = 0;
+			out += static_cast<std::ptrdiff_t>(q - _impl._start)
+				* static_cast<std::ptrdiff_t>(k);
+			if (q->is_valid() && _live(q))
+			{
+				auto rdist = reference._impl._finish - reference._impl._start;
+				reference._nearest(reference._root_dim(), root_offset(rdist),
+				                   root(reference._impl._start, rdist), q->value(),
+				                   metric, details::other_than<value_type>
+				                   {&q->value()}, found, depth_first());
+				for (const auto& n : found.sorted())
+				{
+					*out++ = const_iterator(n.node);
+					++j;
+				}
+				found.clear();
+			}
+			for (; j < k; ++j) { *out++ = reference.end(); }
+		}
+
+		/**
+		 *  The cell of the sub-tree rooted at node, or its cached bounding box
+		 *  when there is one.
+		 */
+		template<typename Cell>
+		Cell _tight_cell(const iterator& node,
+		                 typename iterator::difference_type node_offset,
+		                 const Cell& cell) const noexcept
+		{
+			constexpr dimension_type K = indexable_type::kth();
+			const value_type* box = _box(node, node_offset);
+			if (box == nullptr) { return cell; }
+			Cell tight;
+			for (dimension_type d = 0; d < K; ++d)
+			{
+				tight.low[d] = box + d;
+				tight.high[d] = box + K + d;
+			}
+			return tight;
+		}
+
+		/**
+		 *  Lower bound of the distance between the values within cell q and
+		 *  those within cell r: their largest gap along a single dimension, as
+		 *  measured by distance_to_plane(). It holds for any metric whose
+		 *  distance_to_plane() grows with the gap along its dimension, as the
+		 *  ones of this library do.
+		 */
+		template<typename Metric, typename Cell>
+		typename Metric::distance_type
+		_cell_gap(const Cell& q, const Cell& r, const Metric& metric) const
+		{
+			using distance_type = typename Metric::distance_type;
+			distance_type gap = distance_type();
+			for (dimension_type d = 0; d < indexable_type::kth(); ++d)
+			{
+				distance_type g;
+				if (q.high[d] != nullptr && r.low[d] != nullptr
+				    && select_compare(d, *q.high[d], *r.low[d], _index()))
+				{ g = metric.distance_to_plane(d, *q.high[d], *r.low[d]); }
+				else if (q.low[d] != nullptr && r.high[d] != nullptr
+				         && select_compare(d, *r.high[d], *q.low[d], _index()))
+				{ g = metric.distance_to_plane(d, *q.low[d], *r.high[d]); }
+				else { continue; }
+				if (gap < g) { gap = g; }
+			}
+			return gap;
+		}
+
+		/**
+		 *  Call found(node) for each value of the sub-tree rooted at node whose
+		 *  distance to origin is not greater than radius. The far side of a
+		 *  node is skipped when its plane, or its cached bounding box, is
+		 *  farther than radius.
+		 */
+		template<typename Metric, typename Found>
+		void _radius(dimension_type node_dim,
+		             typename iterator::difference_type node_offset,
+		             iterator node, const value_type& origin,
+		             const typename Metric::distance_type& radius,
+		             const Metric& metric, Found& found) const
+		{
+			for (; node->is_valid();)
+			{
+				_visit();
+				const value_type* box = _box(node, node_offset);
+				typename Metric::distance_type bound;
+				if (box != nullptr
+				    && details::box_bound(metric, origin, box,
+				                          box + indexable_type::kth(), bound, 0)
+				    && radius < bound)
+				{ break; }
+				if (_live(node)
+				    && !(radius < metric.distance_to_key(origin, node->value())))
+				{ found(node); }
+				if (node_offset == 0) { break; }
+				auto child_offset = node_offset / 2;
+				iterator near_node = left(node, node_offset);
+				iterator far_node = right(node, node_offset);
+				if (select_compare(node_dim, node->value(), origin, _index()))
+				{ std::swap(near_node, far_node); }
+				if (!(radius
+				      < metric.distance_to_plane(node_dim, origin, node->value())))
+				{
+					_radius(_child_dim(far_node, node_dim), child_offset, far_node,
+					        origin, radius, metric, found);
+				}
+				node = near_node;
+				node_dim = _child_dim(near_node, node_dim);
+				node_offset = child_offset;
+			}
+		}
+
+		/**
+		 *  The cell that bounds all values of this tree, which must not be
+		 *  empty: the cached bounding box of the root when there is one, and
+		 *  otherwise the minimum and maximum values along each dimension.
+		 */
+		template<typename Cell>
+		Cell _bounding_cell() const noexcept
+		{
+			auto dist = _impl._finish - _impl._start;
+			auto offset = root_offset(dist);
+			iterator node = root(_impl._start, dist);
+			Cell cell = { };
+			cell = _tight_cell(node, offset, cell);
+			for (dimension_type d = 0; d < indexable_type::kth(); ++d)
+			{
+				if (cell.low[d] != nullptr) { continue; }
+				cell.low[d] = &minimum(d, _root_dim(), offset, node, _index(),
+				                       _dims())->value();
+				cell.high[d] = &maximum(d, _root_dim(), offset, node, _index(),
+				                        _dims())->value();
+			}
+			return cell;
+		}
+
+		/**
+		 *  The walk of a radius join over the query sub-tree rooted at node,
+		 *  within cell: each value is searched in the whole reference tree,
+		 *  whose values are within rcell, and emit(q, r) is called for each
+		 *  pair found. The sub-tree is skipped when the gap between cell and
+		 *  rcell is greater than radius.
+		 */
+		template<typename Metric, typename Cell, typename Emit>
+		void _radius_join(dimension_type node_dim,
+		                  typename iterator::difference_type node_offset,
+		                  iterator node, Cell cell, const kdtree& reference,
+		                  const Cell& rcell,
+		                  const typename Metric::distance_type& radius,
+		                  const Metric& metric, Emit& emit) const
+		{
+			if (!node->is_valid()
+			    || radius < _cell_gap(_tight_cell(node, node_offset, cell), rcell,
+			                          metric))
+			{ return; }
+			_visit();
+			if (_live(node))
+			{
+				auto rdist = reference._impl._finish - reference._impl._start;
+				auto found = [&](const iterator& r) { emit(node, r); };
+				reference._radius(reference._root_dim(), root_offset(rdist),
+				                  root(reference._impl._start, rdist),
+				                  node->value(), radius, metric, found);
+			}
+			if (node_offset == 0) { return; }
+			auto child_offset = node_offset / 2;
+			Cell right_cell = cell;
+			cell.high[node_dim] = &node->value();
+			right_cell.low[node_dim] = &node->value();
+			iterator lnode = left(node, node_offset);
+			iterator rnode = right(node, node_offset);
+			_radius_join(_child_dim(lnode, node_dim), child_offset, lnode, cell,
+			             reference, rcell, radius, metric, emit);
+			_radius_join(_child_dim(rnode, node_dim), child_offset, rnode,
+			             right_cell, reference, rcell, radius, metric, emit);
+		}
+
+		/**
+		 *  The walk of a radius join over the depth top levels of the query
+		 *  sub-tree rooted at node: values found there are added to top, and
+		 *  the sub-trees below are added to tasks with their cells.
+		 */
+		template<typename Cell, typename Tasks>
+		void _split_radius_join(dimension_type node_dim,
+		                        typename iterator::difference_type node_offset,
+		                        iterator node, std::size_t depth, Cell cell,
+		                        std::vector<iterator>& top, Tasks& tasks) const
+		{
+			if (!node->is_valid()) { return; }
+			if (depth == 0 || node_offset == 0)
+			{
+				tasks.push_back(typename Tasks::value_type{node, node_offset,
+				                                           node_dim, cell});
+				return;
+			}
+			if (_live(node)) { top.push_back(node); }
+			auto child_offset = node_offset / 2;
+			Cell right_cell = cell;
+			cell.high[node_dim] = &node->value();
+			right_cell.low[node_dim] = &node->value();
+			iterator lnode = left(node, node_offset);
+			iterator rnode = right(node, node_offset);
+			_split_radius_join(_child_dim(lnode, node_dim), child_offset, lnode,
+			                   depth - 1, cell, top, tasks);
+			_split_radius_join(_child_dim(rnode, node_dim), child_offset, rnode,
+			                   depth - 1, right_cell, top, tasks);
+		}
+
+		/**
+		 *  Follow val down the depth top levels, calling f(node, offset) for
+		 *  each node on its path, and return the index of the sub-tree it
+		 *  reaches among the 2^depth sub-trees below, from the left. Values
+		 *  equal to a node along its dimension go left.
+		 */
+		template<typename Function>
+		std::size_t _route(std::size_t depth, const value_type& val,
+		                   Function f) const
+		{
+			auto dist = _impl._finish - _impl._start;
+			auto node_offset = root_offset(dist);
+			iterator node = root(_impl._start, dist);
+			dimension_type node_dim = _root_dim();
+			std::size_t i = 0;
+			for (; depth != 0; --depth)
+			{
+				f(node, node_offset);
+				bool right_side
+					= select_compare(node_dim, node->value(), val, _index());
+				i = 2 * i + (right_side ? 1 : 0);
+				node = right_side ? right(node, node_offset)
+					: left(node, node_offset);
+				node_dim = _child_dim(node, node_dim);
+				node_offset /= 2;
+			}
+			return i;
+		}
+
+		/**
+		 *  The sub-trees at depth below node, from the left, added to tasks
+		 *  with their offset and dimension.
+		 */
+		template<typename Tasks>
+		void _split_insert(dimension_type node_dim,
+		                   typename iterator::difference_type node_offset,
+		                   iterator node, std::size_t depth, Tasks& tasks) const
+		{
+			if (depth == 0)
+			{
+				tasks.push_back(typename Tasks::value_type{node, node_offset,
+				                                           node_dim});
+				return;
+			}
+			auto child_offset = node_offset / 2;
+			iterator lnode = left(node, node_offset);
+			iterator rnode = right(node, node_offset);
+			_split_insert(_child_dim(lnode, node_dim), child_offset, lnode,
+			              depth - 1, tasks);
+			_split_insert(_child_dim(rnode, node_dim), child_offset, rnode,
+			              depth - 1, tasks);
+		}
+
+		/**
+		 *  Set the state of the nodes in the depth top levels of the sub-tree
+		 *  rooted at node from the states of the sub-trees below, as inserts
+		 *  do on their way back up.
+		 */
+		void _restate(typename iterator::difference_type node_offset,
+		              const iterator& node, std::size_t depth) const noexcept
+		{
+			if (depth == 0) { return; }
+			iterator lnode = left(node, node_offset);
+			iterator rnode = right(node, node_offset);
+			_restate(node_offset / 2, lnode, depth - 1);
+			_restate(node_offset / 2, rnode, depth - 1);
+			node->state() = lnode->state() + rnode->state();
+		}
+
+	public:
+		explicit kdtree()
+		noexcept(std::is_nothrow_default_constructible<_kdtree_members>::value)
+			: _impl() { }
+
+		explicit
+		kdtree(const indexable_type& i,
+		       const allocator_type& a = allocator_type())
+			noexcept(std::is_nothrow_constructible
+			         <_kdtree_members,
+			         const indexable_type&,
+			         const value_alloc_type&,
+			         const state_alloc_type&>::value)
+			: _impl(i, a, a) { }
+
+		explicit kdtree(std::size_t n)
+			noexcept(std::is_nothrow_default_constructible<_kdtree_members>::value)
+			: _impl()
+		{ _alloc_storage(n); }
+
+		explicit kdtree(std::size_t n,
+		                const indexable_type& i,
+		                const allocator_type& a = allocator_type())
+			noexcept(std::is_nothrow_constructible
+			         <_kdtree_members,
+			         const indexable_type&,
+			         const value_alloc_type&,
+			         const state_alloc_type&>::value)
+			: _impl(i, a, a)
+		{ _alloc_storage(n); }
+
+		kdtree(const kdtree& x)
+			: _impl(x._impl)
+		{
+			_alloc_storage(x._impl._capacity);
+			try
+			{
+				std::uninitialized_copy(x._impl._start->value_ptr(),
+				                        x._impl._finish->value_ptr(),
+				                        _impl._start->value_ptr());
+			}
+			catch (...)
+			{ _dealloc_storage(); throw; }
+			auto dist = x._impl._finish - x._impl._start;
+			std::memcpy(_impl._start->state_ptr(), x._impl._start->state_ptr(),
+			            static_cast<std::size_t>(dist));
+			_impl._finish.reset(_impl._start->value_ptr() + dist,
+			                    _impl._start->state_ptr() + dist);
+			_impl._count = x._impl._count;
+			_impl._full_state = x._impl._full_state;
+			_rebuild_augment();
+		}
+
+		kdtree(kdtree&& x)
+			noexcept(std::is_nothrow_move_constructible<_kdtree_members>::value)
+			: _impl(std::move(x._impl)) { }
+
+		/**
+		 *  Insert items in kdtree according to the O(n.log(n)) algorithm: partially
+		 *  sort all items in an array to find the root, then recursively process
+		 *  each side of the array.
+		 */
+		kdtree(std::initializer_list<value_type> l,
+		       const indexable_type& i = indexable_type(),
+		       const allocator_type& a = allocator_type())
+			: kdtree(i, a)
+		{
+			_alloc_storage(l.size());
+			try { _uninitialized_insert(l.begin(), l.end()); }
+			catch (...) { _dealloc_storage(); throw; }
+		}
+
+		/**
+		 *  Build the tree from the values in [first, last) with the same
+		 *  algorithm as list initialization. The result is balanced, and with a
+		 *  splitting policy such as \ref max_spread_split, each node splits the
+		 *  dimension chosen by the policy for its values.
+		 */
+		template<typename ForwardIterator,
+		         typename = typename std::enable_if
+		         <std::is_base_of<std::forward_iterator_tag,
+		                          typename std::iterator_traits<ForwardIterator>
+		                          ::iterator_category>::value>::type>
+		kdtree(ForwardIterator first, ForwardIterator last,
+		       const indexable_type& i = indexable_type(),
+		       const allocator_type& a = allocator_type())
+			: kdtree(i, a)
+		{
+			_alloc_storage(static_cast<std::size_t>(std::distance(first, last)));
+			try { _uninitialized_insert(first, last); }
+			catch (...) { _dealloc_storage(); throw; }
+		}
+
+		~kdtree() noexcept
+		{
+			if (_impl._capacity != 0)
+			{
+				clear();
+				_dealloc_storage();
+			}
+		}
+
+		iterator begin() noexcept { return _impl._start; }
+		const_iterator begin() const noexcept { return _impl._start; }
+		const_iterator cbegin() const noexcept { return _impl._start; }
+		iterator end() noexcept { return _impl._finish; }
+		const_iterator end() const noexcept { return _impl._finish; }
+		const_iterator cend() const noexcept { return _impl._finish; }
+
+		allocator_type get_allocator() const
+			noexcept(std::is_nothrow_copy_constructible<allocator_type>::value)
+		{ return allocator_type(_get_value_alloc()); }
+
+		const indexable_type& get_index() const noexcept
+		{ return static_cast<const indexable_type&>(_impl); }
+		indexable_type& get_index() noexcept
+		{ return static_cast<indexable_type&>(_impl); }
+
+		/**
+		 *  The dimension along which node splits its sub-tree, as the splitting
+		 *  policy chose it; in O(log(n)). node must be in the tree.
+		 */
+		dimension_type split_dimension(const_iterator node) const noexcept
+		{
+			dimension_type dim = 0;
+			_walk_to(_impl._start + (node - cbegin()),
+			         [&dim](const iterator&, typename iterator::difference_type,
+			                dimension_type d) noexcept { dim = d; });
+			return dim;
+		}
+
+		/**
+		 *  The operations counted since the tree was created or since the last
+		 *  call to \ref reset_operations(); all zero unless Stats is \ref
+		 *  count_operations.
+		 */
+		operation_counts operations() const noexcept
+		{ return _impl._stats.counts(); }
+
+		void reset_operations() noexcept { _impl._stats.reset(); }
+
+		/**
+		 *  Report the shape of the tree: how full each level is, how many nodes
+		 *  are left without a value and how unbalanced the sub-trees are. Since
+		 *  each sub-tree is a contiguous range of the layout, the size of all
+		 *  sub-trees comes from a single prefix count, and the whole report
+		 *  costs two linear scans.
+		 */
+		tree_stats stats() const
+		{
+			using difference_type = typename iterator::difference_type;
+			tree_stats s{_impl._count, _impl._capacity, 0, 0, 0, 0, 0, 0, 0, 0, 0.0,
+			             0.0, std::vector<std::size_t>()};
+			difference_type dist = _impl._finish - _impl._start;
+			s.slots = static_cast<std::size_t>(dist);
+			for (difference_type n = dist; n != 0; n >>= 1) { ++s.height; }
+			s.occupancy.assign(s.height, 0);
+			// valid[i] is the number of values among the first i nodes
+			std::vector<std::size_t> valid(s.slots + 1, 0);
+			for (difference_type i = 0; i < dist; ++i)
+			{
+				iterator node = _impl._start + i;
+				std::size_t u = static_cast<std::size_t>(i);
+				valid[u + 1] = valid[u] + (node->is_valid() ? 1 : 0);
+				if (!node->is_valid()) { ++s.invalid; continue; }
+				if (!_live(node)) { ++s.erased; }
+				if (node->state() == _impl._full_state) { ++s.full; }
+				else if (node->state() == ~_impl._full_state) { ++s.free; }
+				else { ++s.mixed; }
+				// the level of a node is given by the trailing zeroes of i + 1
+				std::size_t level = s.height - 1;
+				for (std::size_t j = u + 1; (j & 1) == 0; j >>= 1) { --level; }
+				++s.occupancy[level];
+				if (s.depth < level + 1) { s.depth = level + 1; }
+			}
+			std::size_t weighted = 0;
+			std::size_t total = 0;
+			for (difference_type i = 0; i < dist; ++i)
+			{
+				difference_type o = 1;
+				for (difference_type j = i + 1; (j & 1) == 0; j >>= 1) { o <<= 1; }
+				if (o == 1 || !(_impl._start + i)->is_valid()) { continue; }
+				// the sub-tree of each child spans o - 1 nodes
+				std::size_t u = static_cast<std::size_t>(i);
+				std::size_t span = static_cast<std::size_t>(o - 1);
+				std::size_t l = valid[u] - valid[u - span];
+				std::size_t r = valid[u + 1 + span] - valid[u + 1];
+				std::size_t diff = (l < r) ? r - l : l - r;
+				weighted += diff;
+				total += l + r;
+				if (i == dist / 2 && l + r != 0)
+				{
+					s.root_imbalance = static_cast<double>(diff)
+						/ static_cast<double>(l + r);
+				}
+			}
+			if (total != 0)
+			{
+				s.imbalance = static_cast<double>(weighted)
+					/ static_cast<double>(total);
+			}
+			return s;
+		}
+
+		/**
+		 *  The data maintained for Augment, such as the counters of \ref
+		 *  quantized_keys.
+		 */
+		const augment_type& augmentation() const noexcept
+		{ return _impl._augment; }
+
+		std::size_t capacity() const noexcept { return _impl._capacity; }
+		std::size_t size() const noexcept { return _impl._count; }
+		bool empty() const noexcept { return (size() == 0); }
+
+		void clear() noexcept
+		{ if (_stored() != 0) _destroy(); }
+
+		static constexpr double default_rebuild_factor() noexcept { return 0.5; }
+
+		/**
+		 *  Inserts move values between sub-trees to keep the tree balanced;
+		 *  in some orders, such as sorted values, each insert moves values
+		 *  through the whole tree and n inserts cost O(n^2). Once the values
+		 *  moved since the last build cost more than factor times a build of
+		 *  the whole tree, the next insert first rebuilds the tree, which
+		 *  brings these orders down to about O(n^1.5) and leaves random
+		 *  orders unaffected. A factor of 0 disables rebuilds.
+		 */
+		void rebuild_factor(double factor) noexcept
+		{ _impl._rebuild_factor = factor; }
+
+		double rebuild_factor() const noexcept { return _impl._rebuild_factor; }
+
+		/**
+		 *  Rebuild the tree in place, with the same algorithm as the range
+		 *  constructor.
+		 */
+		void rebuild()
+		{ if (_stored() != 0) { _rebuild(); } }
+
+		static constexpr double default_compact_ratio() noexcept { return 0.25; }
+
+		/**
+		 *  The fraction of erased values from which \ref compact(std::size_t)
+		 *  rebuilds a sub-tree.
+		 */
+		void compact_ratio(double ratio) noexcept { _impl._compact_ratio = ratio; }
+
+		double compact_ratio() const noexcept { return _impl._compact_ratio; }
+
+		/**
+		 *  The number of erased values that the tree still holds; see \ref
+		 *  erase().
+		 */
+		std::size_t tombstones() const noexcept { return _impl._tombs.size(); }
+
+		/**
+		 *  True if node holds an erased value. node must be valid.
+		 */
+		bool erased(const_iterator node) const noexcept
+		{ return _impl._tombs.dead(node - cbegin()); }
+
+		/**
+		 *  Remove all erased values from the tree by rebuilding it, in
+		 *  O(n.log(n)).
+		 */
+		void compact()
+		{ if (_impl._tombs.size() != 0) { _rebuild(); } }
+
+		/**
+		 *  Remove erased values incrementally: scan the largest sub-trees of at
+		 *  most budget nodes, from where the previous call stopped, until
+		 *  budget nodes are scanned, and rebuild in place each sub-tree in
+		 *  which erased values make at least \ref compact_ratio() of the
+		 *  values. Erased values that a sub-tree needs to fill all but its
+		 *  last level stay in it, for a larger budget or \ref compact() to
+		 *  remove. Values are only moved within the sub-trees rebuilt, and the
+		 *  augmentation, if any, is recomputed when one is.
+		 *
+		 *  Return the number of erased values removed. The tree is not safe to
+		 *  use concurrently: to compact in the background, call this function
+		 *  with a small budget between other operations.
+		 */
+		std::size_t compact(std::size_t budget)
+		{
+			std::size_t before = _impl._tombs.size();
+			if (before == 0) { return 0; }
+			auto dist = _impl._finish - _impl._start;
+			auto offset = root_offset(dist);
+			while (offset > 1 && static_cast<std::size_t>(4 * offset - 1) > budget)
+			{ offset /= 2; }
+			if (offset == root_offset(dist))
+			{
+				// the whole tree fits in the budget, and may shrink
+				if (_compact(dist / 2, offset)) { _rebuild_augment(); }
+				else if (static_cast<double>(before)
+				         >= _impl._compact_ratio * static_cast<double>(_stored()))
+				{ _rebuild(); }
+				return before - _impl._tombs.size();
+			}
+			std::size_t subtrees = static_cast<std::size_t>((dist + 1) / (4 * offset));
+			bool rebuilt = false;
+			for (std::size_t scanned = 0, n = 0;
+			     scanned < budget && n != subtrees && _impl._tombs.size() != 0;
+			     scanned += static_cast<std::size_t>(4 * offset - 1), ++n)
+			{
+				auto k = static_cast<typename iterator::difference_type>
+					(_impl._tombs.next_subtree(subtrees));
+				rebuilt |= _compact(k * 4 * offset + 2 * offset - 1, offset);
+			}
+			if (rebuilt) { _rebuild_augment(); }
+			return before - _impl._tombs.size();
+		}
+
+		/**
+		 *  Insert a copy of val. With \ref unique_keys, if a value equal to val
+		 *  is already in the tree, nothing is inserted and the existing element
+		 *  is returned.
+		 */
+		iterator
+		insert(const value_type& val)
+		{
+			iterator found = _find_equal(val, Keys());
+			if (found != _impl._finish) { return found; }
+			if (_rebuild_due()) { _rebuild(); }
+			typename std::aligned_storage<sizeof(value_type),
+			                              alignof(value_type)>::type data;
+			::new(std::addressof(data)) value_type(val);
+			// code above may throw but will leave the tree in a consistent state
+			iterator tmp = _alloc_insert(reinterpret_cast<const value_type&>(data));
+			std::memcpy(tmp->value_ptr(), std::addressof(data), sizeof(value_type));
+			_impl._tombs.revive(tmp - _impl._start);
+			_moved(tmp);
+			return tmp;
+		}
+
+		iterator
+		insert(value_type&& val)
+		{
+			iterator found = _find_equal(val, Keys());
+			if (found != _impl._finish) { return found; }
+			if (_rebuild_due()) { _rebuild(); }
+			typename std::aligned_storage<sizeof(value_type),
+			                              alignof(value_type)>::type data;
+			::new(std::addressof(data)) value_type(std::move(val));
+			// code above may throw but will leave the tree in a consistent state
+			iterator tmp = _alloc_insert(reinterpret_cast<const value_type&>(data));
+			std::memcpy(tmp->value_ptr(), std::addressof(data), sizeof(value_type));
+			_impl._tombs.revive(tmp - _impl._start);
+			_moved(tmp);
+			return tmp;
+		}
+
+		/**
+		 *  Insert copies of the values in [first, last) with threads threads,
+		 *  the caller included, and return the number of values inserted.
+		 *
+		 *  Each value is routed through the depth top levels of the tree,
+		 *  which are left in place, to one of the sub-trees below, and each of
+		 *  these sub-trees takes its values from a single thread, as \ref
+		 *  insert() would place them; a depth of 0 lets the tree choose one,
+		 *  as for \ref parallel_range(). Threads only touch the nodes of their
+		 *  own sub-trees, so they need no lock, and the top levels are updated
+		 *  once all threads are done. A value whose sub-tree is full needs to
+		 *  move values across the top levels, and is inserted by the caller
+		 *  afterwards, unless these moves would call for a rebuild, which
+		 *  then takes all such values at once; threads also stop placing
+		 *  values once a rebuild is due.
+		 *
+		 *  When the values do not fit in the free nodes of the tree, some are
+		 *  inserted one at a time until the tree expands, unless they are as
+		 *  many as the values of the tree: the tree is then rebuilt with them
+		 *  instead, as by \ref rebuild(), which is also done when a rebuild is
+		 *  due.
+		 *
+		 *  Under \ref unique_keys, values equal to a value of the tree or to an
+		 *  earlier value of the range are not inserted. If copying a value
+		 *  throws, the values already copied stay in the tree, and the
+		 *  exception is rethrown.
+		 */
+		template<typename ForwardIterator>
+		std::size_t
+		parallel_insert(ForwardIterator first, ForwardIterator last,
+		                unsigned threads = std::thread::hardware_concurrency(),
+		                std::size_t depth = 0)
+		{
+			struct task_type
+			{
+				iterator node;
+				typename iterator::difference_type offset;
+				dimension_type dim;
+			};
+			std::vector<const value_type*> values;
+			for (; first != last; ++first) { values.push_back(std::addressof(*first)); }
+			_remove_equal(values, Keys());
+			auto found = [this](const value_type* v)
+			{ return _find_equal(*v, Keys()) != _impl._finish; };
+			values.erase(std::remove_if(values.begin(), values.end(), found),
+			             values.end());
+			std::size_t n = values.size();
+			if (n == 0) { return 0; }
+			auto fits = [this, &values]()
+			{
+				return _stored() + values.size()
+					<= static_cast<std::size_t>(_impl._finish - _impl._start);
+			};
+			if (_stored() == 0 || _rebuild_due()
+			    || (!fits() && values.size() >= _impl._count))
+			{
+				_rebuild(values);
+				return n;
+			}
+			// fill the free nodes one value at a time, until the tree expands
+			for (; !fits(); values.pop_back()) { insert(*values.back()); }
+			auto dist = _impl._finish - _impl._start;
+			if (threads == 0) { threads = 1; }
+			if (depth == 0) { depth = _parallel_depth(threads); }
+			// the sub-trees below the top levels must not be leaves
+			while (depth != 0
+			       && (std::size_t(2) << depth) > static_cast<std::size_t>(dist))
+			{ --depth; }
+			auto noop = [](const iterator&, typename iterator::difference_type) { };
+			// sort the values by sub-tree: bucket[t] is the first of sub-tree t
+			std::vector<std::size_t> bucket((std::size_t(1) << depth) + 1, 0);
+			std::vector<std::size_t> subtree(values.size());
+			for (std::size_t i = 0; i < values.size(); ++i)
+			{
+				subtree[i] = _route(depth, *values[i], noop);
+				++bucket[subtree[i] + 1];
+			}
+			for (std::size_t t = 1; t < bucket.size(); ++t)
+			{ bucket[t] += bucket[t - 1]; }
+			std::vector<const value_type*> routed(values.size());
+			{
+				std::vector<std::size_t> fill(bucket.begin(), bucket.end() - 1);
+				for (std::size_t i = 0; i < values.size(); ++i)
+				{ routed[fill[subtree[i]]++] = values[i]; }
+			}
+			std::vector<task_type> tasks;
+			_split_insert(_root_dim(), root_offset(dist), root(_impl._start, dist),
+			              depth, tasks);
+			std::vector<char> placed(routed.size(), 0);
+			std::atomic<std::size_t> next(0);
+			auto settle = [&]()
+			{
+				for (std::size_t i = 0; i < routed.size(); ++i)
+				{
+					if (!placed[i]) { continue; }
+					++_impl._count;
+					_route(depth, *routed[i],
+					       [&](const iterator& node,
+					           typename iterator::difference_type offset)
+					       { _enter(node, offset, *routed[i]); });
 				}
-				else if (select_compare(node_dim, node->value(), val, get_index()))
+				_restate(root_offset(dist), root(_impl._start, dist), depth);
+			};
+			try
+			{
+				_in_parallel(threads, [&](unsigned)
 				{
-					if (rnode->state() == _impl._full_state)
+					for (std::size_t t; (t = next.fetch_add
+					                     (1, std::memory_order_relaxed))
+						     < tasks.size();)
 					{
-						iterator tmp
-							= _place_insert(child_dim, child_offset, lnode, node->value());
-						std::memcpy(tmp->value_ptr(), node->value_ptr(), sizeof(value_type));
-						tmp = minimum(node_dim, child_dim, child_offset, rnode, get_index());
-						if (select_compare(node_dim, tmp->value(), val, get_index()))
+						// as insert() does, stop once a rebuild is due
+						const task_type& task = tasks[t];
+						for (std::size_t i = bucket[t]; i != bucket[t + 1]
+							     && task.node->state() != _impl._full_state
+							     && !_rebuild_due(); ++i)
 						{
-							std::memcpy(node->value_ptr(), tmp->value_ptr(), sizeof(value_type));
-							_erase_when_full(child_dim, child_offset, rnode, tmp);
-							insert = _place_insert(child_dim, child_offset, rnode, val);
+							typename std::aligned_storage
+								<sizeof(value_type), alignof(value_type)>::type data;
+							::new(std::addressof(data)) value_type(*routed[i]);
+							const value_type& val
+								= reinterpret_cast<const value_type&>(data);
+							iterator tmp = (task.node->state() == ~_impl._full_state)
+								? _insert_when_free(task.dim, task.offset, task.node,
+								                    val)
+								: _place_insert(task.dim, task.offset, task.node,
+								                val);
+							std::memcpy(tmp->value_ptr(), std::addressof(data),
+							            sizeof(value_type));
+							_impl._tombs.revive(tmp - _impl._start);
+							_moved(tmp);
+							placed[i] = 1;
 						}
-						else
-						{ insert = node; }
 					}
-					else if (rnode->state() == ~_impl._full_state)
-					{ insert = _insert_when_free(child_dim, child_offset, rnode, val); }
-					else
-					{ insert = _place_insert(child_dim, child_offset, rnode, val); }
-				}
-				else
+				});
+			}
+			catch (...) { settle(); throw; }
+			settle();
+			// the sub-trees of these values were full: each may move up to a
+			// whole sub-tree across the top levels
+			std::vector<const value_type*> overflow;
+			for (std::size_t i = 0; i < routed.size(); ++i)
+			{ if (!placed[i]) { overflow.push_back(routed[i]); } }
+			if (_rebuild_due(overflow.size()
+			                 * static_cast<std::size_t>(dist >> depth)))
+			{ _rebuild(overflow); }
+			else
+			{ for (const value_type* v : overflow) { insert(*v); } }
+			return n;
+		}
+
+		/**
+		 *  Erase all values equal to val along all dimensions, and return
+		 *  their number. Erased values are marked as tombstones: they keep their
+		 *  node, so that erasing costs one search and moves no value, and all
+		 *  queries skip them. Iterating from \ref begin() to \ref end() still
+		 *  visits them; see \ref erased(). \ref compact() removes them, and
+		 *  so do rebuilds.
+		 *
+		 *  Erasing allocates one byte per node on the first call, which may
+		 *  throw.
+		 */
+		std::size_t erase(const value_type& val)
+		{
+			std::size_t n = 0;
+			auto found = equal_range(val);
+			// found only reads the marks if they were allocated before
+			for (; found.first != found.second; ++found.first, ++n)
+			{ _erase(found.first.base()); }
+			return n;
+		}
+
+		/**
+		 *  Erase the value at pos, which must not be erased yet; see \ref
+		 *  erase(const value_type&).
+		 */
+		void erase(iterator pos) { _erase(pos); }
+
+		/**
+		 *  Replace the value at pos, which must not be erased, by val, and
+		 *  return the new position of val. When val is still on the same side
+		 *  of all the splits as the value it replaces, as for a point that
+		 *  moves a little, val is written in place in O(log(n)) and pos is
+		 *  returned. Otherwise the value at pos is erased and val is inserted.
+		 *  With \ref unique_keys, if another value equal to val is in the
+		 *  tree, the value at pos is erased and the other value is returned.
+		 *
+		 *  Each value erased that way stays in the tree as a tombstone; once
+		 *  they make \ref compact_ratio() of the values stored, each such
+		 *  update also calls \ref compact(std::size_t) with a small budget
+		 *  before inserting val, so that a set of moving points does not grow
+		 *  the tree without bound. Iterators are invalidated by these updates.
+		 *
+		 *  If inserting val throws, the value at pos is left erased.
+		 */
+		iterator update(iterator pos, const value_type& val)
+		{
+			iterator found = _find_equal(val, Keys());
+			if (found != _impl._finish && found != pos)
+			{
+				_erase(pos);
+				return found;
+			}
+			if (!_fits(pos, val))
+			{
+				_erase(pos);
+				_compact_if_due();
+				return insert(val);
+			}
+			typename std::aligned_storage<sizeof(value_type),
+			                              alignof(value_type)>::type data;
+			::new(std::addressof(data)) value_type(val);
+			// code above may throw but will leave the tree in a consistent state
+			const value_type& next = reinterpret_cast<const value_type&>(data);
+			_walk_to(pos, [&](const iterator& anc,
+			                  typename iterator::difference_type o,
+			                  dimension_type)
+			{
+				_leave(anc, o, pos->value());
+				_enter(anc, o, next);
+			});
+			// If the line below throws, the program terminates
+			pos->value_ptr()->~value_type();
+			std::memcpy(pos->value_ptr(), std::addressof(data), sizeof(value_type));
+			_impl._augment.moved(pos - _impl._start, pos->value(), get_index());
+			_impl._stats.update();
+			return pos;
+		}
+
+		iterator
+		find(const value_type& val) noexcept
+		{
+			return (_impl._count == 0) ? _impl._finish
+				: _find_quantized(val, details::is_quantized<Augment>());
+		}
+
+		const_iterator
+		find(const value_type& val) const noexcept
+		{
+			return (_impl._count == 0) ? const_iterator(_impl._finish)
+				: _find_quantized(val, details::is_quantized<Augment>());
+		}
+
+		/**
+		 *  Find a value equal to val along all dimensions with the \ref
+		 *  branchless strategy, or \ref end() if there is none.
+		 */
+		iterator
+		find(const value_type& val, branchless) noexcept
+		{
+			return (_impl._count == 0) ? _impl._finish
+				: _find(val, branchless());
+		}
+
+		const_iterator
+		find(const value_type& val, branchless) const noexcept
+		{
+			return (_impl._count == 0) ? const_iterator(_impl._finish)
+				: _find(val, branchless());
+		}
+
+		/**
+		 *  Look up each value of [first, last) with the \ref interleaved
+		 *  strategy and write, for each in turn, a const_iterator to a value
+		 *  equal to it along all dimensions, or \ref end() if there is none.
+		 */
+		template<typename InputIterator, typename OutputIterator>
+		OutputIterator
+		find(InputIterator first, InputIterator last, OutputIterator out,
+		     interleaved strategy) const
+		{
+			std::size_t group = (strategy.group == 0) ? 1 : strategy.group;
+			std::vector<value_type> vals;
+			std::vector<_descent> paths;
+			vals.reserve(group);
+			paths.reserve(group);
+			while (first != last)
+			{
+				vals.clear();
+				for (; first != last && vals.size() < group; ++first)
+				{ vals.push_back(*first); }
+				if (_impl._count == 0)
 				{
-					insert = (lnode->state() == _impl._full_state)
-						? _place_insert(child_dim, child_offset, rnode, val)
-						: _place_insert(child_dim, child_offset, lnode, val);
+					for (std::size_t i = 0; i < vals.size(); ++i, ++out)
+					{ *out = cend(); }
 				}
-				// modify state accordingly and return insert
-				node->state() = lnode->state() + rnode->state();
-				return insert;
-			}
-			else
-			{
-				// offset == 0, necessarily empty
-				node->state() = _impl._full_state;
-				return node;
+				else { out = _find(vals, paths, out); }
 			}
+			return out;
+		}
+
+		/**
+		 *  The values equal to val along all dimensions; see \ref
+		 *  equal_iterator.
+		 */
+		std::pair<equal_iterator_type, equal_iterator_type>
+		equal_range(const value_type& val)
+		{
+			auto dist = _impl._finish - _impl._start;
+			equal_iterator_type last(_impl._finish, val, get_index(), _dims());
+			return (_impl._count == 0) ? std::make_pair(last, last)
+				: std::make_pair(equal_iterator_type
+				                 (_impl._finish, val, get_index(),
+				                  root(_impl._start, dist), root_offset(dist),
+				                  _dims(), _live_nodes()), last);
 		}
 
+		std::pair<const_equal_iterator_type, const_equal_iterator_type>
+		equal_range(const value_type& val) const
+		{
+			auto dist = _impl._finish - _impl._start;
+			const_equal_iterator_type last(_impl._finish, val, get_index(),
+			                               _dims());
+			return (_impl._count == 0) ? std::make_pair(last, last)
+				: std::make_pair(const_equal_iterator_type
+				                 (_impl._finish, val, get_index(),
+				                  root(const_iterator(_impl._start), dist),
+				                  root_offset(dist), _dims(), _live_nodes()), last);
+		}
+
+		/**
+		 *  The number of values equal to val along all dimensions. Sub-trees
+		 *  that only hold such values are counted without being enumerated; see
+		 *  \ref count_in_range().
+		 */
+		std::size_t count(const value_type& val) const
+		{ return count_in_range(val, val); }
+
+		/**
+		 *  Find the value closest to origin according to metric, or \ref end() if
+		 *  the tree is empty. The strategy is either \ref depth_first or \ref
+		 *  best_bin_first.
+		 */
+		template<typename Metric, typename Strategy = depth_first>
 		iterator
-		_find(dimension_type node_dim,
-		      typename iterator::difference_type node_offset,
-		      iterator node, const value_type& val) const noexcept
+		nearest(const value_type& origin, const Metric& metric,
+		        Strategy strategy = Strategy())
+		{ return _nearest_one(origin, metric, strategy); }
+
+		template<typename Metric, typename Strategy = depth_first>
+		const_iterator
+		nearest(const value_type& origin, const Metric& metric,
+		        Strategy strategy = Strategy()) const
+		{ return _nearest_one(origin, metric, strategy); }
+
+		/**
+		 *  Write to out the iterators to the k values closest to origin according
+		 *  to metric, by increasing distance. Fewer than k iterators are written
+		 *  if the tree holds fewer than k values.
+		 */
+		template<typename Metric, typename OutputIterator,
+		         typename Strategy = depth_first>
+		OutputIterator
+		nearest(const value_type& origin, std::size_t k, const Metric& metric,
+		        OutputIterator out, Strategy strategy = Strategy())
 		{
-			for (; node->is_valid();)
+			return _nearest_k<iterator>(origin, k, metric, details::accept_all(),
+			                            out, strategy);
+		}
+
+		template<typename Metric, typename OutputIterator,
+		         typename Strategy = depth_first>
+		OutputIterator
+		nearest(const value_type& origin, std::size_t k, const Metric& metric,
+		        OutputIterator out, Strategy strategy = Strategy()) const
+		{
+			return _nearest_k<const_iterator>(origin, k, metric,
+			                                  details::accept_all(), out, strategy);
+		}
+
+		/**
+		 *  Same as \ref nearest() but only values for which pred returns true are
+		 *  considered. The predicate is applied during the traversal, so exactly k
+		 *  matching values are found whenever the tree holds k of them.
+		 *
+		 *  Sub-trees without matching values can be skipped whole when the tree
+		 *  keeps a summary of them: if pred names a monoid as summary_type, such
+		 *  as a count of the matching values, and the tree is augmented with
+		 *  \ref aggregate_cache of that monoid, pred.subtree(summary) is called
+		 *  with the cached aggregate of each sub-tree before it is explored, and
+		 *  the sub-tree is skipped when it returns false. Sub-trees below the
+		 *  cached levels are always explored.
+		 */
+		template<typename Metric, typename Predicate, typename OutputIterator,
+		         typename Strategy = depth_first>
+		OutputIterator
+		nearest_if(const value_type& origin, std::size_t k, const Metric& metric,
+		           const Predicate& pred, OutputIterator out,
+		           Strategy strategy = Strategy())
+		{ return _nearest_k<iterator>(origin, k, metric, pred, out, strategy); }
+
+		/**
+		 *  Same as \ref nearest(), with the search split among threads
+		 *  threads, the caller included, as in \ref parallel_range(). The
+		 *  sub-trees below the depth top levels are searched depth-first in
+		 *  the order of the lower bound of their distance to origin, each
+		 *  thread keeping its own k candidates, seeded with those found in the
+		 *  top levels so that it prunes from its first sub-tree on; a sub-tree
+		 *  is skipped once some thread holds k candidates closer than its
+		 *  bound. The candidates of all threads are merged into the k nearest
+		 *  at the end. With a single thread, this is nearest().
+		 */
+		template<typename Metric, typename OutputIterator>
+		OutputIterator
+		parallel_nearest(const value_type& origin, std::size_t k,
+		                 const Metric& metric, OutputIterator out,
+		                 unsigned threads = std::thread::hardware_concurrency(),
+		                 std::size_t depth = 0) const
+		{
+			if (threads <= 1) { return nearest(origin, k, metric, out); }
+			if (_impl._count == 0 || k == 0) { return out; }
+			if (depth == 0) { depth = _parallel_depth(threads); }
+			using distance_type = typename Metric::distance_type;
+			using candidates_type = details::nearest_k<distance_type, iterator>;
+			using task_type = details::pending_node<distance_type, iterator>;
+			candidates_type top(k, _impl._count);
+			std::vector<task_type> tasks;
+			auto dist = _impl._finish - _impl._start;
+			_split_nearest(_root_dim(), root_offset(dist), root(_impl._start, dist),
+			               depth, distance_type(), origin, metric, top, tasks);
+			std::sort(tasks.begin(), tasks.end(),
+			          [](const task_type& a, const task_type& b)
+			          { return a.bound < b.bound; });
+			std::vector<candidates_type> found(threads, top);
+			std::mutex worst_lock;
+			bool full = top.full();
+			distance_type worst = full ? top.worst() : distance_type();
+			std::atomic<std::size_t> next(0);
+			_in_parallel(threads, [&](unsigned w)
 			{
-				bool left_only
-					= select_compare(node_dim, val, node->value(), get_index());
-				bool right_only
-					= select_compare(node_dim, node->value(), val, get_index());
-				if (!left_only && !right_only)
+				candidates_type& mine = found[w];
+				for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed))
+					     < tasks.size();)
 				{
-					dimension_type i = 0;
-					for (; i < node_dim; ++i)
+					const task_type& t = tasks[i];
 					{
-						if (select_compare(i, node->value(), val, get_index())
-						    || select_compare(i, val, node->value(), get_index()))
-						{ break; }
+						std::lock_guard<std::mutex> lock(worst_lock);
+						if (full && !(t.bound < worst)) { return; }
 					}
-					if (i == node_dim)
+					_nearest(static_cast<dimension_type>(t.dim), t.offset, t.node,
+					         origin, metric, details::accept_all(), mine,
+					         depth_first());
+					if (mine.full())
 					{
-						for (++i; i < indexable_type::kth(); ++i)
+						std::lock_guard<std::mutex> lock(worst_lock);
+						if (!full || mine.worst() < worst)
 						{
-							if (select_compare(i, node->value(), val, get_index())
-							    || select_compare(i, val, node->value(), get_index()))
-							{ break; }
+							worst = mine.worst();
+							full = true;
 						}
-						if (i == indexable_type::kth()) { return node; }
 					}
 				}
-				if (node_offset != 0)
-				{
-					dimension_type child_dim = inc<indexable_type::kth()>(node_dim);
-					auto child_offset = node_offset / 2;
-					if (!right_only)
-					{
-						iterator probe = _find(child_dim, child_offset,
-						                       left(node, node_offset), val);
-						if (probe != _impl._finish) { return probe; }
-					}
-					if (left_only) { break; }
-					node = right(node, node_offset);
-					node_dim = child_dim;
-					node_offset = child_offset;
-				}
-				else { break; }
+			});
+			// the candidates of the top levels may be held by several threads
+			using neighbor_type = typename candidates_type::neighbor_type;
+			std::vector<neighbor_type> merged;
+			for (candidates_type& f : found)
+			{
+				const std::vector<neighbor_type>& mine = f.sorted();
+				merged.insert(merged.end(), mine.begin(), mine.end());
 			}
-			return _impl._finish;
+			std::sort(merged.begin(), merged.end(),
+			          [](const neighbor_type& a, const neighbor_type& b)
+			          {
+				          return a.distance < b.distance
+					          || (!(b.distance < a.distance) && a.node - b.node < 0);
+			          });
+			merged.erase(std::unique(merged.begin(), merged.end(),
+			                         [](const neighbor_type& a, const neighbor_type& b)
+			                         { return a.node == b.node; }),
+			             merged.end());
+			if (merged.size() > k) { merged.resize(k); }
+			for (const auto& n : merged) { *out++ = const_iterator(n.node); }
+			return out;
 		}
 
-	public:
-		explicit kdtree()
-		noexcept(std::is_nothrow_default_constructible<_kdtree_members>::value)
-			: _impl() { }
-
-		explicit
-		kdtree(const indexable_type& i,
-		       const allocator_type& a = allocator_type())
-			noexcept(std::is_nothrow_constructible
-			         <_kdtree_members,
-			         const indexable_type&,
-			         const value_alloc_type&,
-			         const state_alloc_type&>::value)
-			: _impl(i, a, a) { }
+		template<typename Metric, typename Predicate, typename OutputIterator,
+		         typename Strategy = depth_first>
+		OutputIterator
+		nearest_if(const value_type& origin, std::size_t k, const Metric& metric,
+		           const Predicate& pred, OutputIterator out,
+		           Strategy strategy = Strategy()) const
+		{
+			return _nearest_k<const_iterator>(origin, k, metric, pred, out,
+			                                  strategy);
+		}
 
-		explicit kdtree(std::size_t n)
-			noexcept(std::is_nothrow_default_constructible<_kdtree_members>::value)
-			: _impl()
-		{ _alloc_storage(n); }
+		/**
+		 *  Write to out the iterators to all values whose distance to origin
+		 *  according to metric is not greater than radius, in no particular
+		 *  order.
+		 */
+		template<typename Metric, typename OutputIterator>
+		OutputIterator
+		within_radius(const value_type& origin,
+		              const typename Metric::distance_type& radius,
+		              const Metric& metric, OutputIterator out)
+		{
+			if (_impl._count == 0) { return out; }
+			auto dist = _impl._finish - _impl._start;
+			auto found = [&out](const iterator& node) { *out++ = node; };
+			_radius(_root_dim(), root_offset(dist), root(_impl._start, dist), origin,
+			        radius, metric, found);
+			return out;
+		}
 
-		explicit kdtree(std::size_t n,
-		                const indexable_type& i,
-		                const allocator_type& a = allocator_type())
-			noexcept(std::is_nothrow_constructible
-			         <_kdtree_members,
-			         const indexable_type&,
-			         const value_alloc_type&,
-			         const state_alloc_type&>::value)
-			: _impl(i, a, a)
-		{ _alloc_storage(n); }
+		template<typename Metric, typename OutputIterator>
+		OutputIterator
+		within_radius(const value_type& origin,
+		              const typename Metric::distance_type& radius,
+		              const Metric& metric, OutputIterator out) const
+		{
+			if (_impl._count == 0) { return out; }
+			auto dist = _impl._finish - _impl._start;
+			auto found = [&out](const iterator& node)
+			{ *out++ = const_iterator(node); };
+			_radius(_root_dim(), root_offset(dist), root(_impl._start, dist), origin,
+			        radius, metric, found);
+			return out;
+		}
 
-		kdtree(const kdtree& x)
-			: _impl(x._impl)
+		/**
+		 *  Write to out the iterators to all values within the closed box [low,
+		 *  high], that is, not less than low and not greater than high along any
+		 *  dimension. Values are written in no particular order.
+		 */
+		template<typename OutputIterator>
+		OutputIterator
+		range(const value_type& low, const value_type& high, OutputIterator out)
 		{
-			_alloc_storage(x._impl._capacity);
-			try
-			{
-				std::uninitialized_copy(x._impl._start->value_ptr(),
-				                        x._impl._finish->value_ptr(),
-				                        _impl._start->value_ptr());
-			}
-			catch (...)
-			{ _dealloc_storage(); throw; }
-			auto dist = x._impl._finish - x._impl._start;
-			std::memcpy(_impl._start->state_ptr(), x._impl._start->state_ptr(),
-			            static_cast<std::size_t>(dist));
-			_impl._finish.reset(_impl._start->value_ptr() + dist,
-			                    _impl._start->state_ptr() + dist);
-			_impl._count = x._impl._count;
-			_impl._full_state = x._impl._full_state;
+			return (_impl._count == 0) ? out
+				: _range_quantized<iterator>(low, high, out,
+				                             details::is_quantized<Augment>());
 		}
 
-		kdtree(kdtree&& x)
-			noexcept(std::is_nothrow_move_constructible<_kdtree_members>::value)
-			: _impl(std::move(x._impl)) { }
+		template<typename OutputIterator>
+		OutputIterator
+		range(const value_type& low, const value_type& high,
+		      OutputIterator out) const
+		{
+			return (_impl._count == 0) ? out
+				: _range_quantized<const_iterator>(low, high, out,
+				                                   details::is_quantized<Augment>());
+		}
 
 		/**
-		 *  Insert items in kdtree according to the O(n.log(n)) algorithm: partially
-		 *  sort all items in an array to find the root, then recursively process
-		 *  each side of the array.
+		 *  Same as \ref range(), with the search split among threads threads,
+		 *  the caller included. The caller walks the depth top levels of the
+		 *  tree; each sub-tree below them that may intersect the box is then
+		 *  searched by one of the threads, and their results are concatenated
+		 *  to out once all are done. A depth of 0 lets the tree choose one that
+		 *  gives several sub-trees to each thread. Sub-trees are disjoint
+		 *  slices of the tree, so the threads share nothing but the tree,
+		 *  which they only read; \ref quantized_keys are not used. With a
+		 *  single thread, this is range().
+		 *
+		 *  Only worth it for boxes holding many values: starting the threads
+		 *  costs about as much as finding a few thousand values.
 		 */
-		kdtree(std::initializer_list<value_type> l,
-		       const indexable_type& i = indexable_type(),
-		       const allocator_type& a = allocator_type())
-			: kdtree(i, a)
+		template<typename OutputIterator>
+		OutputIterator
+		parallel_range(const value_type& low, const value_type& high,
+		               OutputIterator out,
+		               unsigned threads = std::thread::hardware_concurrency(),
+		               std::size_t depth = 0) const
 		{
-			_alloc_storage(l.size());
-			_uninitialized_insert(l.begin(), l.end());
+			if (threads <= 1) { return range(low, high, out); }
+			if (_impl._count == 0) { return out; }
+			if (depth == 0) { depth = _parallel_depth(threads); }
+			using task_type = details::pending_node<int, iterator>;
+			std::vector<const_iterator> top;
+			std::vector<task_type> tasks;
+			auto dist = _impl._finish - _impl._start;
+			_split_range(_root_dim(), root_offset(dist), root(_impl._start, dist),
+			             depth, low, high, top, tasks);
+			std::vector<std::vector<const_iterator>> found(tasks.size());
+			std::atomic<std::size_t> next(0);
+			_in_parallel(threads, [&](unsigned)
+			{
+				for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed))
+					     < tasks.size();)
+				{
+					const task_type& t = tasks[i];
+					_range<const_iterator>(static_cast<dimension_type>(t.dim),
+					                       t.offset, t.node, low, high,
+					                       std::back_inserter(found[i]));
+				}
+			});
+			out = std::copy(top.begin(), top.end(), out);
+			for (const auto& f : found) { out = std::copy(f.begin(), f.end(), out); }
+			return out;
 		}
 
-		~kdtree() noexcept
+		/**
+		 *  k nearest neighbor join: for each value of this tree, the k values
+		 *  of reference closest to it according to metric, as \ref nearest()
+		 *  would find them. The values are searched in the order of the tree,
+		 *  so that consecutive searches start close to each other and walk
+		 *  mostly the same nodes of reference, and the candidates of each
+		 *  thread are kept in a single buffer, reused from one search to the
+		 *  next.
+		 *
+		 *  The results go to the flat buffer at out, which must hold k *
+		 *  (end() - begin()) const_iterators to reference: the neighbors of the
+		 *  value at begin() + i are written to out[i * k] to out[i * k + k - 1]
+		 *  by increasing distance, followed by reference.end() when reference
+		 *  holds less than k values. The rows of free nodes and erased values
+		 *  are filled with reference.end(). A value is never its own neighbor,
+		 *  which only matters when reference is this tree; see \ref self_knn().
+		 *  Returns out advanced past the buffer.
+		 *
+		 *  The top levels of this tree are split among threads threads, the
+		 *  caller included, as in \ref parallel_range(): each sub-tree below
+		 *  them is a contiguous slice of the buffer, filled by a single
+		 *  thread, so threads never write to the same row.
+		 */
+		template<typename Metric, typename RandomAccessIterator>
+		RandomAccessIterator
+		knn_join(const kdtree& reference, std::size_t k, const Metric& metric,
+		         RandomAccessIterator out,
+		         unsigned threads = std::thread::hardware_concurrency()) const
 		{
-			if (_impl._capacity != 0)
+			using candidates_type
+				= details::nearest_k<typename Metric::distance_type, iterator>;
+			auto dist = _impl._finish - _impl._start;
+			std::size_t slots = static_cast<std::size_t>(dist);
+			if (_impl._count == 0 || reference._impl._count == 0)
+			{ return std::fill_n(out, k * slots, reference.end()); }
+			if (k == 0) { return out; }
+			if (threads == 0) { threads = 1; }
+			std::size_t depth = (threads == 1) ? 0 : _parallel_depth(threads);
+			std::vector<iterator> top;
+			std::vector<std::pair<iterator, iterator>> tasks;
+			_split_join(root_offset(dist), root(_impl._start, dist), depth, top,
+			            tasks);
+			candidates_type found(k, reference._impl._count);
+			for (const iterator& q : top)
+			{ _join_row(q, reference, k, metric, found, out); }
+			std::atomic<std::size_t> next(0);
+			_in_parallel(threads, [&](unsigned)
 			{
-				clear();
-				_dealloc_storage();
-			}
+				candidates_type mine(k, reference._impl._count);
+				for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed))
+					     < tasks.size();)
+				{
+					for (iterator q = tasks[i].first; q != tasks[i].second; ++q)
+					{ _join_row(q, reference, k, metric, mine, out); }
+				}
+			});
+			return out + static_cast<std::ptrdiff_t>(k * slots);
 		}
 
-		iterator begin() noexcept { return _impl._start; }
-		const_iterator begin() const noexcept { return _impl.start; }
-		const_iterator cbegin() const noexcept { return _impl.start; }
-		iterator end() noexcept { return _impl._finish; }
-		const_iterator end() const noexcept { return _impl._finish; }
-		const_iterator cend() const noexcept { return _impl._finish; }
-
-		allocator_type get_allocator() const
-			noexcept(std::is_nothrow_copy_constructible<allocator_type>::value)
-		{ return allocator_type(_get_value_alloc()); }
-
-		const indexable_type& get_index() const noexcept
-		{ return static_cast<const indexable_type&>(_impl); }
-		indexable_type& get_index() noexcept
-		{ return static_cast<indexable_type&>(_impl); }
-
-		std::size_t capacity() const noexcept { return _impl._capacity; }
-		std::size_t size() const noexcept { return _impl._count; }
-		bool empty() const noexcept { return (size() == 0); }
+		/**
+		 *  The \ref knn_join() of this tree with itself: for each value, the k
+		 *  other values of the tree closest to it.
+		 */
+		template<typename Metric, typename RandomAccessIterator>
+		RandomAccessIterator
+		self_knn(std::size_t k, const Metric& metric, RandomAccessIterator out,
+		         unsigned threads = std::thread::hardware_concurrency()) const
+		{ return knn_join(*this, k, metric, out, threads); }
 
-		void clear() noexcept
-		{ if (_impl._count != 0) _destroy(); }
+		/**
+		 *  Radius join: all pairs of a value q of this tree and a value r of
+		 *  reference whose distance according to metric is not greater than
+		 *  radius. The query tree is walked once, and each of its values is
+		 *  searched in reference; a whole query sub-tree is skipped when its
+		 *  cell, bounded by the values of its ancestors or by its cached
+		 *  bounding box, is farther than radius from the bounding box of
+		 *  reference along some dimension. This assumes that
+		 *  distance_to_plane() grows with the gap along its dimension, as for
+		 *  the metrics of this library.
+		 *
+		 *  Pairs are collected in batches of up to batch pairs, and each
+		 *  batch is passed to sink as a range [first, last) of
+		 *  std::pair<const_iterator, const_iterator>, q first; the range is
+		 *  only valid during the call. Pairs come in no particular order.
+		 *  When reference is this tree, each value is paired with itself, and
+		 *  the other pairs come in both orders. Returns the number of pairs.
+		 */
+		template<typename Metric, typename Sink>
+		std::size_t
+		radius_join(const kdtree& reference,
+		            const typename Metric::distance_type& radius,
+		            const Metric& metric, Sink sink, std::size_t batch = 1024) const
+		{ return parallel_radius_join(reference, radius, metric, sink, 1, batch); }
 
-		iterator
-		insert(const value_type& val)
+		/**
+		 *  Same as \ref radius_join(), with the query tree split among threads
+		 *  threads, the caller included, as in \ref knn_join(): each query
+		 *  sub-tree below the top levels is joined with the whole reference
+		 *  tree by a single thread. Each thread has its own batch, and sink is
+		 *  called by one thread at a time. If sink throws, the other threads
+		 *  stop once done with their current sub-tree, without calling sink
+		 *  again, and the exception is rethrown.
+		 */
+		template<typename Metric, typename Sink>
+		std::size_t
+		parallel_radius_join(const kdtree& reference,
+		                     const typename Metric::distance_type& radius,
+		                     const Metric& metric, Sink sink,
+		                     unsigned threads = std::thread::hardware_concurrency(),
+		                     std::size_t batch = 1024) const
 		{
-			typename std::aligned_storage<sizeof(value_type),
-			                              alignof(value_type)>::type data;
-			::new(std::addressof(data)) value_type(val);
-			// code above may throw but will leave the tree in a consistent state
-			iterator tmp = _alloc_insert(reinterpret_cast<const value_type&>(data));
-			std::memcpy(tmp->value_ptr(), std::addressof(data), sizeof(value_type));
-			return tmp;
+			using pair_type = std::pair<const_iterator, const_iterator>;
+			using cell_type = details::cell<value_type, indexable_type::kth()>;
+			struct task_type
+			{
+				iterator node;
+				typename iterator::difference_type offset;
+				dimension_type dim;
+				cell_type cell;
+			};
+			if (_impl._count == 0 || reference._impl._count == 0) { return 0; }
+			if (threads == 0) { threads = 1; }
+			if (batch == 0) { batch = 1; }
+			std::size_t depth = (threads == 1) ? 0 : _parallel_depth(threads);
+			cell_type unbounded = { };
+			std::vector<iterator> top;
+			std::vector<task_type> tasks;
+			auto dist = _impl._finish - _impl._start;
+			_split_radius_join(_root_dim(), root_offset(dist),
+			                   root(_impl._start, dist), depth, unbounded, top,
+			                   tasks);
+			cell_type rcell = reference.template _bounding_cell<cell_type>();
+			auto rdist = reference._impl._finish - reference._impl._start;
+			iterator rroot = root(reference._impl._start, rdist);
+			auto roffset = root_offset(rdist);
+			dimension_type rdim = reference._root_dim();
+			std::mutex sink_lock;
+			std::atomic<bool> failed(false);
+			std::atomic<std::size_t> pairs(0);
+			std::atomic<std::size_t> next(0);
+			_in_parallel(threads, [&](unsigned)
+			{
+				std::vector<pair_type> found;
+				found.reserve(batch);
+				auto flush = [&]()
+				{
+					if (failed.load(std::memory_order_relaxed))
+					{
+						found.clear();
+						return;
+					}
+					pairs.fetch_add(found.size(), std::memory_order_relaxed);
+					std::lock_guard<std::mutex> lock(sink_lock);
+					try { sink(found.data(), found.data() + found.size()); }
+					catch (...) { failed.store(true); throw; }
+					found.clear();
+				};
+				auto emit = [&](const iterator& q, const iterator& r)
+				{
+					found.push_back(pair_type(q, r));
+					if (found.size() == batch) { flush(); }
+				};
+				for (std::size_t i; !failed.load(std::memory_order_relaxed)
+					     && (i = next.fetch_add(1, std::memory_order_relaxed))
+					     < top.size() + tasks.size();)
+				{
+					if (i < top.size())
+					{
+						const iterator& q = top[i];
+						auto one = [&](const iterator& r) { emit(q, r); };
+						reference._radius(rdim, roffset, rroot, q->value(), radius,
+						                  metric, one);
+						continue;
+					}
+					const task_type& t = tasks[i - top.size()];
+					_radius_join(t.dim, t.offset, t.node, t.cell, reference, rcell,
+					             radius, metric, emit);
+				}
+				if (!found.empty()) { flush(); }
+			});
+			return pairs.load();
 		}
 
-		iterator
-		insert(value_type&& val)
+		/**
+		 *  The number of values within the closed box [low, high]. Sub-trees
+		 *  contained in the box are counted without being enumerated: in O(1)
+		 *  when they are full, or when the tree is augmented with an \ref
+		 *  aggregate_cache of \ref details::count_monoid.
+		 */
+		std::size_t count_in_range(const value_type& low,
+		                           const value_type& high) const
+		{ return aggregate_in_range(low, high, details::count_monoid()); }
+
+		/**
+		 *  The aggregate for monoid of all values within the closed box [low,
+		 *  high]; see \ref aggregate_cache for the requirements on Monoid.
+		 *  Sub-trees contained in the box are aggregated in O(1) when the tree
+		 *  is augmented with an \ref aggregate_cache of the same Monoid, and by
+		 *  scanning their values without comparisons otherwise. Only the
+		 *  identity(), operator() and combine() members of monoid are used.
+		 */
+		template<typename Monoid>
+		typename Monoid::result_type
+		aggregate_in_range(const value_type& low, const value_type& high,
+		                   const Monoid& monoid) const
 		{
-			typename std::aligned_storage<sizeof(value_type),
-			                              alignof(value_type)>::type data;
-			::new(std::addressof(data)) value_type(std::move(val));
-			// code above may throw but will leave the tree in a consistent state
-			iterator tmp = _alloc_insert(reinterpret_cast<const value_type&>(data));
-			std::memcpy(tmp->value_ptr(), std::addressof(data), sizeof(value_type));
-			return tmp;
+			if (_impl._count == 0) { return monoid.identity(); }
+			auto dist = _impl._finish - _impl._start;
+			details::cell<value_type, indexable_type::kth()> unbounded = { };
+			return _aggregate(_root_dim(), root_offset(dist), root(_impl._start, dist),
+			                  low, high, unbounded, monoid);
 		}
 
-		std::size_t erase(const value_type&) noexcept
+		/**
+		 *  Browse values by increasing distance to origin; see \ref
+		 *  nearest_iterator.
+		 */
+		template<typename Metric>
+		nearest_iterator_type<Metric>
+		nearest_begin(const value_type& origin, const Metric& metric)
 		{
-			--_impl._count;
-			return 0;
+			auto dist = _impl._finish - _impl._start;
+			return (_impl._count == 0)
+				? nearest_end(origin, metric)
+				: nearest_iterator_type<Metric>
+				(_impl._finish, origin, metric, get_index(),
+				 root(_impl._start, dist), root_offset(dist), _dims(),
+				 _live_nodes());
 		}
 
-		void erase(iterator) noexcept
+		template<typename Metric>
+		const_nearest_iterator_type<Metric>
+		nearest_begin(const value_type& origin, const Metric& metric) const
 		{
-			--_impl._count;
+			auto dist = _impl._finish - _impl._start;
+			return (_impl._count == 0)
+				? nearest_end(origin, metric)
+				: const_nearest_iterator_type<Metric>
+				(_impl._finish, origin, metric, get_index(),
+				 root(const_iterator(_impl._start), dist), root_offset(dist),
+				 _dims(), _live_nodes());
 		}
 
-		iterator
-		find(const value_type& val) noexcept
+		template<typename Metric>
+		nearest_iterator_type<Metric>
+		nearest_end(const value_type& origin, const Metric& metric)
 		{
-			auto dist = _impl._finish - _impl._start;
-			return (_impl._count == 0) ? _impl._finish
-				: _find(0, root_offset(dist), root(_impl._start, dist), val);
+			return nearest_iterator_type<Metric>
+				(_impl._finish, origin, metric, get_index(), _dims());
 		}
 
-		const_iterator
-		find(const value_type& val) const noexcept
+		template<typename Metric>
+		const_nearest_iterator_type<Metric>
+		nearest_end(const value_type& origin, const Metric& metric) const
 		{
-			auto dist = _impl._finish - _impl._start;
-			return (_impl._count == 0) ? const_iterator(_impl._finish)
-				: _find(0, root_offset(dist), root(_impl._start, dist), val);
+			return const_nearest_iterator_type<Metric>
+				(_impl._finish, origin, metric, get_index(), _dims());
 		}
 	};
 }
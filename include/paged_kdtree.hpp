@@ -0,0 +1,741 @@
+#ifndef PAGED_KDTREE_HPP
+#define PAGED_KDTREE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "kdtree_index.hpp"
+#include "details/posix_file.hpp"
+#include "details/page_reader.hpp"
+
+namespace kdtree_index
+{
+	namespace details
+	{
+		/**
+		 *  Header of the file written by \ref write_paged(). The tree of dist
+		 *  elements is cut in pages of span - 1 consecutive elements: page k
+		 *  holds the sub-tree rooted at k * span + span / 2 - 1, and the elements
+		 *  at (k + 1) * span - 1, which form the top levels of the tree, are
+		 *  stored together before the pages.
+		 */
+		struct paged_header
+		{
+			char magic[8];
+			std::uint64_t dimensions;
+			std::uint64_t value_size;
+			std::uint64_t dist;
+			std::uint64_t count;
+			std::uint64_t span;
+		};
+
+		constexpr char paged_magic[8] = { 'K', 'D', 'T', 'P', 'A', 'G', 'E', '1' };
+
+		inline std::size_t round_up(std::size_t n, std::size_t align) noexcept
+		{ return (n + align - 1) / align * align; }
+
+		/**
+		 *  Where the parts of a paged file are. A part, either the resident
+		 *  elements or a page, is a record that holds a validity byte for each
+		 *  element, padded to the alignment of the values, then the values.
+		 */
+		template<typename Value>
+		struct paged_layout
+		{
+			explicit paged_layout(const paged_header& h) noexcept
+				: pages((h.dist == 0) ? 0 : (h.dist + 1) / h.span),
+				  resident((pages == 0) ? 0 : pages - 1),
+				  page_elements(h.span - 1),
+				  page_size(record_size(page_elements)),
+				  resident_offset(round_up(sizeof(paged_header), 64)),
+				  pages_offset(round_up(resident_offset + record_size(resident), 4096))
+			{ }
+
+			static std::size_t values_offset(std::size_t n) noexcept
+			{ return round_up(n, alignof(Value)); }
+
+			static std::size_t record_size(std::size_t n) noexcept
+			{ return values_offset(n) + n * sizeof(Value); }
+
+			off_t page_offset(std::size_t k) const noexcept
+			{ return static_cast<off_t>(pages_offset + k * page_size); }
+
+			std::size_t pages;
+			std::size_t resident;
+			std::size_t page_elements;
+			std::size_t page_size;
+			std::size_t resident_offset;
+			std::size_t pages_offset;
+		};
+
+		/**
+		 *  The largest span whose pages fit in page_bytes, but at least 2, for a
+		 *  tree of dist elements.
+		 */
+		template<typename Value>
+		inline std::size_t paged_span(std::size_t dist, std::size_t page_bytes)
+			noexcept
+		{
+			std::size_t span = 2;
+			while (span * 2 <= dist + 1
+			       && paged_layout<Value>::record_size(span * 2 - 1) <= page_bytes)
+			{ span *= 2; }
+			return span;
+		}
+
+		/**
+		 *  Raw storage aligned for any value.
+		 */
+		class aligned_buffer
+		{
+		public:
+			explicit aligned_buffer(std::size_t bytes = 0)
+				: _data((bytes + sizeof(std::max_align_t) - 1)
+				        / sizeof(std::max_align_t)) { }
+
+			unsigned char* data() noexcept
+			{ return reinterpret_cast<unsigned char*>(_data.data()); }
+			const unsigned char* data() const noexcept
+			{ return reinterpret_cast<const unsigned char*>(_data.data()); }
+
+		private:
+			std::vector<std::max_align_t> _data;
+		};
+	}
+
+	/**
+	 *  Write tree to the file at path, in the format read by \ref
+	 *  paged_kdtree. Pages hold the largest sub-trees that fit in page_bytes.
+	 *  Only trees that split dimensions in turn can be written, and the file
+	 *  holds a raw copy of their values, so it is only readable on the same
+	 *  architecture. A tree that holds erased values is written compacted.
+	 */
+	template<typename Index, typename Alloc, typename Augment, typename Keys,
+	         typename Stats>
+	void write_paged(const kdtree<Index, Alloc, Augment, cyclic_split, Keys,
+	                              Stats>& tree,
+	                 const char* path, std::size_t page_bytes = 65536)
+	{
+		using value_type = typename Index::value_type;
+		static_assert(std::is_trivially_copyable<value_type>::value,
+		              "paged trees copy values as bytes");
+		if (tree.tombstones() != 0)
+		{
+			kdtree<Index, Alloc, Augment, cyclic_split, Keys, Stats> copy(tree);
+			copy.compact();
+			write_paged(copy, path, page_bytes);
+			return;
+		}
+		details::paged_header header;
+		std::memcpy(header.magic, details::paged_magic, sizeof(header.magic));
+		header.dimensions = Index::kth();
+		header.value_size = sizeof(value_type);
+		header.dist = static_cast<std::uint64_t>(tree.end() - tree.begin());
+		header.count = tree.size();
+		header.span = details::paged_span<value_type>(header.dist, page_bytes);
+		details::paged_layout<value_type> layout(header);
+		details::posix_file file(path, O_WRONLY | O_CREAT | O_TRUNC);
+		file.write_at(&header, sizeof(header), 0);
+		std::size_t span = header.span;
+		details::aligned_buffer buffer
+			(details::paged_layout<value_type>::record_size
+			 ((layout.resident < layout.page_elements)
+			  ? layout.page_elements : layout.resident));
+		// Copy the elements at first, first + stride... to a record
+		auto write_record = [&](std::size_t n, std::size_t first,
+		                        std::size_t stride, std::size_t offset)
+		{
+			unsigned char* valid = buffer.data();
+			value_type* values = reinterpret_cast<value_type*>
+				(valid + details::paged_layout<value_type>::values_offset(n));
+			std::size_t size = details::paged_layout<value_type>::record_size(n);
+			std::memset(valid, 0, size);
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				auto node = tree.begin()
+					+ static_cast<std::ptrdiff_t>(first + i * stride);
+				if (!node->is_valid()) { continue; }
+				valid[i] = 1;
+				std::memcpy(static_cast<void*>(values + i),
+				            std::addressof(node->value()), sizeof(value_type));
+			}
+			file.write_at(valid, size, static_cast<off_t>(offset));
+		};
+		write_record(layout.resident, span - 1, span, layout.resident_offset);
+		for (std::size_t k = 0; k < layout.pages; ++k)
+		{
+			write_record(layout.page_elements, k * span, 1,
+			             static_cast<std::size_t>(layout.page_offset(k)));
+		}
+	}
+
+	/**
+	 *  Counters of the page cache of a \ref paged_kdtree. A page is accessed
+	 *  when a query first reads one of its elements, or reads one of its
+	 *  elements after reading another page.
+	 */
+	struct page_cache_stats
+	{
+		std::size_t queries;
+		std::size_t hits;       // accesses to pages that were in the cache
+		std::size_t misses;     // accesses to pages read from the file
+		std::size_t bytes_read;
+		std::size_t waits;      // times a batch of queries waited for reads
+
+		double hit_rate() const noexcept
+		{
+			return (hits + misses == 0) ? 0.0
+				: static_cast<double>(hits) / static_cast<double>(hits + misses);
+		}
+
+		double reads_per_query() const noexcept
+		{
+			return (queries == 0) ? 0.0
+				: static_cast<double>(misses) / static_cast<double>(queries);
+		}
+	};
+
+	/**
+	 *  Read-only kd-tree stored in a file written by \ref write_paged(), for
+	 *  trees that do not fit in memory. The top levels of the tree are loaded
+	 *  when the file is opened. The sub-trees below them are read a page at a
+	 *  time with pread() when a query reaches them, and kept in a cache of at
+	 *  most cache_pages pages, evicted with the CLOCK algorithm.
+	 *
+	 *  Queries return copies of the values. They update the cache, so a
+	 *  paged_kdtree must not be queried by several threads at once; open the
+	 *  file once per thread instead. Requires POSIX.
+	 */
+	template<typename Index>
+	class paged_kdtree
+	{
+	public:
+		using indexable_type = Index;
+		using value_type = typename indexable_type::value_type;
+		using difference_type = std::ptrdiff_t;
+
+		static_assert(std::is_trivially_copyable<value_type>::value,
+		              "paged trees copy values as bytes");
+		static_assert(alignof(value_type) <= alignof(std::max_align_t),
+		              "over-aligned values are not supported");
+
+	private:
+		using layout_type = details::paged_layout<value_type>;
+		static constexpr std::size_t npos = ~std::size_t(0);
+
+		indexable_type _index;
+		details::posix_file _file;
+		details::paged_header _header;
+		layout_type _layout;
+		std::size_t _span;
+		details::aligned_buffer _resident;
+		std::size_t _frames;
+		details::aligned_buffer _cache;
+		std::vector<std::size_t> _table;  // frame of each page, or npos
+		std::vector<std::size_t> _owner;  // page in each frame, or npos
+		std::vector<unsigned char> _referenced;
+		std::vector<std::size_t> _pins;   // queries of a batch that wait
+		std::vector<unsigned char> _loading;
+		std::size_t _hand;
+		std::size_t _last_page;
+		const unsigned char* _last_frame;
+		page_cache_stats _stats;
+
+		static details::paged_header
+		_read_header(const details::posix_file& file)
+		{
+			details::paged_header header;
+			file.read_at(&header, sizeof(header), 0);
+			if (std::memcmp(header.magic, details::paged_magic,
+			                sizeof(header.magic)) != 0)
+			{ throw std::runtime_error("paged_kdtree: not a paged tree"); }
+			if (header.dimensions != indexable_type::kth()
+			    || header.value_size != sizeof(value_type))
+			{ throw std::runtime_error("paged_kdtree: value type mismatch"); }
+			if (header.span < 2 || (header.span & (header.span - 1)) != 0
+			    || (header.dist != 0 && (header.dist + 1) % header.span != 0))
+			{ throw std::runtime_error("paged_kdtree: corrupted header"); }
+			return header;
+		}
+
+		static const value_type* _element(const unsigned char* record,
+		                                  std::size_t n, std::size_t i) noexcept
+		{
+			return (record[i] == 0) ? nullptr
+				: reinterpret_cast<const value_type*>
+				(record + layout_type::values_offset(n)) + i;
+		}
+
+		/**
+		 *  Pick a frame with CLOCK: a frame whose page was accessed since the
+		 *  hand last passed gets a second chance. Frames pinned by a batch of
+		 *  queries are skipped; npos is returned if all of them are.
+		 */
+		std::size_t _victim() noexcept
+		{
+			for (std::size_t i = 0; i <= 2 * _frames; ++i)
+			{
+				std::size_t f = _hand;
+				_hand = (_hand + 1 == _frames) ? 0 : _hand + 1;
+				if (_pins[f] != 0) { continue; }
+				if (_owner[f] == npos) { return f; }
+				if (_referenced[f] == 0)
+				{
+					_table[_owner[f]] = npos;
+					_owner[f] = npos;
+					return f;
+				}
+				_referenced[f] = 0;
+			}
+			return npos;
+		}
+
+		const unsigned char* _page(std::size_t k)
+		{
+			if (k == _last_page) { return _last_frame; }
+			std::size_t f = _table[k];
+			if (f != npos)
+			{
+				++_stats.hits;
+				_referenced[f] = 1;
+			}
+			else
+			{
+				++_stats.misses;
+				f = _victim();
+				_file.read_at(_cache.data() + f * _layout.page_size,
+				              _layout.page_size, _layout.page_offset(k));
+				_stats.bytes_read += _layout.page_size;
+				_owner[f] = k;
+				_table[k] = f;
+				_referenced[f] = 1;
+			}
+			_last_page = k;
+			_last_frame = _cache.data() + f * _layout.page_size;
+			return _last_frame;
+		}
+
+		/**
+		 *  The value at position p, or nullptr if the element is invalid. A
+		 *  pointer into a page stays valid until another page is read; since a
+		 *  page holds whole sub-trees, a query never reads another page while it
+		 *  visits one.
+		 */
+		const value_type* _node(difference_type p)
+		{
+			std::size_t q = static_cast<std::size_t>(p) + 1;
+			if (q % _span == 0)
+			{ return _element(_resident.data(), _layout.resident, q / _span - 1); }
+			std::size_t k = q / _span;
+			return _element(_page(k), _layout.page_elements,
+			                static_cast<std::size_t>(p) - k * _span);
+		}
+
+		void _begin_query() noexcept
+		{
+			++_stats.queries;
+			_last_page = npos;
+		}
+
+		difference_type _dist() const noexcept
+		{ return static_cast<difference_type>(_header.dist); }
+
+		bool _equal(const value_type& a, const value_type& b) const noexcept
+		{
+			return details::equal_except<indexable_type::kth(),
+			                             indexable_type::kth()>::test(a, b, _index);
+		}
+
+		const value_type* _find(dimension_type node_dim,
+		                        difference_type node_offset,
+		                        difference_type node, const value_type& val)
+		{
+			for (const value_type* v; (v = _node(node)) != nullptr;)
+			{
+				bool left_only = select_compare(node_dim, val, *v, _index);
+				bool right_only = select_compare(node_dim, *v, val, _index);
+				if (!left_only && !right_only && _equal(*v, val)) { return v; }
+				if (node_offset == 0) { break; }
+				node_dim = inc<indexable_type::kth()>(node_dim);
+				if (!right_only)
+				{
+					const value_type* probe
+						= _find(node_dim, node_offset / 2, node - node_offset, val);
+					if (probe != nullptr) { return probe; }
+				}
+				if (left_only) { break; }
+				node += node_offset;
+				node_offset /= 2;
+			}
+			return nullptr;
+		}
+
+		template<typename OutputIterator>
+		OutputIterator _range(dimension_type node_dim,
+		                      difference_type node_offset, difference_type node,
+		                      const value_type& low, const value_type& high,
+		                      OutputIterator out)
+		{
+			for (const value_type* v; (v = _node(node)) != nullptr;)
+			{
+				bool within = true;
+				for (dimension_type d = 0; d < indexable_type::kth() && within; ++d)
+				{
+					within = !select_compare(d, *v, low, _index)
+						&& !select_compare(d, high, *v, _index);
+				}
+				if (within) { *out++ = *v; }
+				if (node_offset == 0) { break; }
+				bool go_left = !select_compare(node_dim, *v, low, _index);
+				bool go_right = !select_compare(node_dim, high, *v, _index);
+				node_dim = inc<indexable_type::kth()>(node_dim);
+				if (go_left && go_right)
+				{
+					out = _range(node_dim, node_offset / 2, node - node_offset,
+					             low, high, out);
+					node += node_offset;
+				}
+				else if (go_left) { node -= node_offset; }
+				else if (go_right) { node += node_offset; }
+				else { break; }
+				node_offset /= 2;
+			}
+			return out;
+		}
+
+		template<typename Metric, typename Candidates>
+		void _nearest(dimension_type node_dim, difference_type node_offset,
+		              difference_type node, const value_type& origin,
+		              const Metric& metric, Candidates& found)
+		{
+			for (const value_type* v; (v = _node(node)) != nullptr;)
+			{
+				found.push(metric.distance_to_key(origin, *v), *v);
+				if (node_offset == 0) { break; }
+				typename Metric::distance_type plane
+					= metric.distance_to_plane(node_dim, origin, *v);
+				difference_type near_node = node - node_offset;
+				difference_type far_node = node + node_offset;
+				if (select_compare(node_dim, *v, origin, _index))
+				{ std::swap(near_node, far_node); }
+				node_dim = inc<indexable_type::kth()>(node_dim);
+				node_offset /= 2;
+				_nearest(node_dim, node_offset, near_node, origin, metric, found);
+				if (found.full() && !(plane < found.worst())) { break; }
+				node = far_node;
+			}
+		}
+
+		/**
+		 *  A query of a batch: the sub-trees it has left to visit, the last one
+		 *  on top.
+		 */
+		struct _pending_find
+		{
+			dimension_type dim;
+			difference_type offset;
+			difference_type node;
+		};
+
+		struct _batch_query
+		{
+			std::size_t index;  // of the query in the batch
+			std::size_t page;   // last page accessed or waited for
+			std::size_t frame;  // frame pinned while waiting, or npos
+			bool found;
+			std::vector<_pending_find> stack;
+		};
+
+		/**
+		 *  Continue query q until it is answered, and return npos, or until it
+		 *  reaches a page that is not in the cache yet, and return that page.
+		 */
+		std::size_t _resume(_batch_query& q, const value_type& val)
+		{
+			while (!q.stack.empty())
+			{
+				_pending_find e = q.stack.back();
+				std::size_t p = static_cast<std::size_t>(e.node) + 1;
+				const value_type* v;
+				if (p % _span == 0)
+				{ v = _element(_resident.data(), _layout.resident, p / _span - 1); }
+				else
+				{
+					std::size_t k = p / _span;
+					std::size_t f = _table[k];
+					if (f == npos || _loading[f] != 0) { return k; }
+					if (k != q.page)
+					{
+						++_stats.hits;
+						_referenced[f] = 1;
+						q.page = k;
+					}
+					v = _element(_cache.data() + f * _layout.page_size,
+					             _layout.page_elements, p - 1 - k * _span);
+				}
+				q.stack.pop_back();
+				if (v == nullptr) { continue; }
+				bool left_only = select_compare(e.dim, val, *v, _index);
+				bool right_only = select_compare(e.dim, *v, val, _index);
+				if (!left_only && !right_only && _equal(*v, val))
+				{
+					q.found = true;
+					q.stack.clear();
+					break;
+				}
+				if (e.offset == 0) { continue; }
+				dimension_type child_dim = inc<indexable_type::kth()>(e.dim);
+				// the left side is visited first, as in _find
+				if (!left_only)
+				{
+					q.stack.push_back(_pending_find{child_dim, e.offset / 2,
+					                                e.node + e.offset});
+				}
+				if (!right_only)
+				{
+					q.stack.push_back(_pending_find{child_dim, e.offset / 2,
+					                                e.node - e.offset});
+				}
+			}
+			return npos;
+		}
+
+		/**
+		 *  Run the queries of a batch, at most window at once. A query that
+		 *  reaches a page that is not in the cache pins a frame for it and is
+		 *  suspended; the page is read with the others when no query can
+		 *  continue, and the queries that wait for it resume once it is read.
+		 */
+		template<typename Reader>
+		void _contains(const std::vector<value_type>& values,
+		               std::vector<unsigned char>& found, std::size_t window)
+		{
+			std::size_t n = values.size();
+			_stats.queries += n;
+			if (n == 0 || empty()) { return; }
+			window = (window == 0) ? 1 : (window < n) ? window : n;
+			Reader reader(static_cast<unsigned>((_frames < 4096) ? _frames : 4096));
+			std::size_t levels = 1;
+			for (difference_type o = root_offset(_dist()); o != 0; o /= 2) { ++levels; }
+			std::vector<_batch_query> slots(window);
+			std::deque<std::size_t> runnable;
+			std::vector<std::size_t> stalled;
+			std::vector<std::vector<std::size_t>> waiters(_frames);
+			std::size_t next = 0;
+			std::size_t done = 0;
+			auto start = [&](std::size_t s)
+			{
+				_batch_query& q = slots[s];
+				q.index = next++;
+				q.page = npos;
+				q.frame = npos;
+				q.found = false;
+				q.stack.clear();
+				q.stack.push_back(_pending_find{0, root_offset(_dist()),
+				                                _dist() / 2});
+				runnable.push_back(s);
+			};
+			for (std::size_t s = 0; s < window; ++s)
+			{
+				slots[s].stack.reserve(levels + 1);
+				start(s);
+			}
+			auto completed = [&](std::size_t f)
+			{
+				_loading[f] = 0;
+				runnable.insert(runnable.end(), waiters[f].begin(), waiters[f].end());
+				waiters[f].clear();
+			};
+			try
+			{
+				while (done < n)
+				{
+					while (!runnable.empty())
+					{
+						std::size_t s = runnable.front();
+						runnable.pop_front();
+						_batch_query& q = slots[s];
+						if (q.frame != npos)
+						{
+							--_pins[q.frame];
+							q.frame = npos;
+						}
+						std::size_t k = _resume(q, values[q.index]);
+						if (k == npos)
+						{
+							found[q.index] = q.found;
+							++done;
+							if (next < n) { start(s); }
+							continue;
+						}
+						q.page = k;
+						std::size_t f = _table[k];
+						if (f != npos) { ++_stats.hits; }
+						else
+						{
+							if (reader.pending() == reader.capacity()
+							    || (f = _victim()) == npos)
+							{
+								stalled.push_back(s);
+								continue;
+							}
+							++_stats.misses;
+							_stats.bytes_read += _layout.page_size;
+							_owner[f] = k;
+							_table[k] = f;
+							_loading[f] = 1;
+							_referenced[f] = 1;
+							reader.read(_file, _cache.data() + f * _layout.page_size,
+							            _layout.page_size, _layout.page_offset(k), f);
+						}
+						++_pins[f];
+						q.frame = f;
+						waiters[f].push_back(s);
+					}
+					if (reader.pending() != 0)
+					{
+						++_stats.waits;
+						reader.wait(completed);
+					}
+					runnable.insert(runnable.end(), stalled.begin(), stalled.end());
+					stalled.clear();
+				}
+			}
+			catch (...)
+			{
+				reader.drain();
+				for (std::size_t f = 0; f < _frames; ++f)
+				{
+					_pins[f] = 0;
+					if (_loading[f] == 0) { continue; }
+					_table[_owner[f]] = npos;
+					_owner[f] = npos;
+					_loading[f] = 0;
+				}
+				throw;
+			}
+		}
+
+	public:
+		/**
+		 *  Open the file at path, written by \ref write_paged(), and load the
+		 *  top levels of the tree. Throws if the file cannot be read or was
+		 *  written for another type of value.
+		 */
+		explicit paged_kdtree(const char* path, std::size_t cache_pages = 64,
+		                      const indexable_type& index = indexable_type())
+			: _index(index), _file(path, O_RDONLY), _header(_read_header(_file)),
+			  _layout(_header), _span(static_cast<std::size_t>(_header.span)),
+			  _resident(layout_type::record_size(_layout.resident)),
+			  _frames((cache_pages == 0) ? 1
+			          : (cache_pages < _layout.pages) ? cache_pages : _layout.pages),
+			  _cache(_frames * _layout.page_size), _table(_layout.pages, npos),
+			  _owner(_frames, npos), _referenced(_frames), _pins(_frames),
+			  _loading(_frames), _hand(),
+			  _last_page(npos), _last_frame(), _stats()
+		{
+			_file.read_at(_resident.data(), layout_type::record_size(_layout.resident),
+			              static_cast<off_t>(_layout.resident_offset));
+		}
+
+		paged_kdtree(const paged_kdtree&) = delete;
+		paged_kdtree& operator=(const paged_kdtree&) = delete;
+
+		std::size_t size() const noexcept
+		{ return static_cast<std::size_t>(_header.count); }
+		bool empty() const noexcept { return size() == 0; }
+
+		/**
+		 *  The number of elements in each page, and in the top levels of the
+		 *  tree that stay in memory.
+		 */
+		std::size_t page_elements() const noexcept { return _layout.page_elements; }
+		std::size_t resident_elements() const noexcept { return _layout.resident; }
+		std::size_t cache_pages() const noexcept { return _frames; }
+
+		const indexable_type& get_index() const noexcept { return _index; }
+
+		const page_cache_stats& stats() const noexcept { return _stats; }
+		void reset_stats() noexcept { _stats = page_cache_stats(); }
+
+		/**
+		 *  Copy to found a value equal to val along all dimensions and return
+		 *  true, or return false if there is none.
+		 */
+		bool find(const value_type& val, value_type& found)
+		{
+			_begin_query();
+			if (empty()) { return false; }
+			const value_type* v = _find(0, root_offset(_dist()), _dist() / 2, val);
+			if (v == nullptr) { return false; }
+			found = *v;
+			return true;
+		}
+
+		bool contains(const value_type& val)
+		{
+			_begin_query();
+			return !empty()
+				&& _find(0, root_offset(_dist()), _dist() / 2, val) != nullptr;
+		}
+
+		/**
+		 *  For each value in [first, last), write to out whether the tree holds
+		 *  a value equal to it, in order. Up to window queries run at once:
+		 *  when one reaches a page that is not in the cache, it is suspended
+		 *  while the others continue, and the pages they wait for are read
+		 *  together by Reader, on an io_uring where the kernel allows it.
+		 */
+		template<typename Reader = details::default_page_reader,
+		         typename InputIterator, typename OutputIterator>
+		OutputIterator contains(InputIterator first, InputIterator last,
+		                        OutputIterator out, std::size_t window = 64)
+		{
+			std::vector<value_type> values(first, last);
+			std::vector<unsigned char> found(values.size());
+			_contains<Reader>(values, found, window);
+			for (unsigned char f : found) { *out++ = (f != 0); }
+			return out;
+		}
+
+		/**
+		 *  Write to out copies of all values within the closed box [low, high],
+		 *  in no particular order.
+		 */
+		template<typename OutputIterator>
+		OutputIterator
+		range(const value_type& low, const value_type& high, OutputIterator out)
+		{
+			_begin_query();
+			return empty() ? out
+				: _range(0, root_offset(_dist()), _dist() / 2, low, high, out);
+		}
+
+		/**
+		 *  Write to out copies of the k values closest to origin according to
+		 *  metric, by increasing distance; see \ref kdtree::nearest().
+		 */
+		template<typename Metric, typename OutputIterator>
+		OutputIterator
+		nearest(const value_type& origin, std::size_t k, const Metric& metric,
+		        OutputIterator out)
+		{
+			_begin_query();
+			if (empty() || k == 0) { return out; }
+			details::nearest_k<typename Metric::distance_type, value_type>
+				found(k, size());
+			_nearest(0, root_offset(_dist()), _dist() / 2, origin, metric, found);
+			for (const auto& n : found.sorted()) { *out++ = n.node; }
+			return out;
+		}
+	};
+
+	template<typename Index>
+	constexpr std::size_t paged_kdtree<Index>::npos;
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef WINDOWED_KDTREE_HPP
+#define WINDOWED_KDTREE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "kdtree_index.hpp"
+
+namespace kdtree_index
+{
+	/**
+	 *  Index of values that expire once they are older than a time window.
+	 *  The window is cut in slices of equal duration, and the values
+	 *  inserted during each slice go to a \ref kdtree of their own, a
+	 *  generation. When its slice ends, a generation is sealed: it no longer
+	 *  receives values and is rebuilt once, in bulk, for queries. When the
+	 *  last of its values leaves the window, the whole generation is dropped
+	 *  at once, without erasing its values one by one; with trivially
+	 *  destructible values, this only frees its storage.
+	 *
+	 *  Queries run on every generation and merge their results. Expiry has
+	 *  the granularity of a slice: a value stays in the index from window to
+	 *  window plus one slice after its insertion, depending on when it was
+	 *  inserted in its slice. More generations make that margin smaller, and
+	 *  each query a bit slower.
+	 *
+	 *  Time only moves forward when \ref advance() is called, with the
+	 *  current time of Clock.
+	 */
+	template<typename Index, typename Clock = std::chrono::steady_clock,
+	         typename Alloc = std::allocator<typename Index::value_type>,
+	         typename Augment = null_type, typename Split = cyclic_split>
+	class windowed_kdtree
+	{
+	public:
+		using tree_type = kdtree<Index, Alloc, Augment, Split>;
+		using indexable_type = Index;
+		using value_type = typename tree_type::value_type;
+		using allocator_type = Alloc;
+		using const_iterator = typename tree_type::const_iterator;
+		using clock_type = Clock;
+		using time_point = typename Clock::time_point;
+		using duration = typename Clock::duration;
+
+	private:
+		indexable_type _index;
+		allocator_type _alloc;
+		duration _window;
+		duration _slice;
+		std::deque<tree_type> _generations; // oldest first
+		std::deque<time_point> _ends;       // end of the slice of each one
+
+		/**
+		 *  Seal the current generation and open a new one for the next slice,
+		 *  sized for as many values as the one sealed.
+		 */
+		void _rotate()
+		{
+			std::size_t n = _generations.back().size();
+			_generations.emplace_back(n, _index, _alloc);
+			try { _ends.push_back(_ends.back() + _slice); }
+			catch (...) { _generations.pop_back(); throw; }
+			_generations[_generations.size() - 2].rebuild();
+		}
+
+	public:
+		/**
+		 *  An empty index of values kept for window, in generations slices,
+		 *  the first of which starts at start.
+		 */
+		explicit windowed_kdtree(duration window, std::size_t generations = 8,
+		                         time_point start = Clock::now(),
+		                         const indexable_type& index = indexable_type(),
+		                         const allocator_type& alloc = allocator_type())
+			: _index(index), _alloc(alloc), _window(window),
+			  _slice((generations == 0) ? window
+			         : window / static_cast<typename duration::rep>(generations)),
+			  _generations(), _ends()
+		{
+			if (_slice <= duration::zero())
+			{ throw std::invalid_argument("windowed_kdtree: empty time slice"); }
+			_generations.emplace_back(_index, _alloc);
+			_ends.push_back(start + _slice);
+		}
+
+		duration window() const noexcept { return _window; }
+		duration slice() const noexcept { return _slice; }
+		const indexable_type& get_index() const noexcept { return _index; }
+		allocator_type get_allocator() const noexcept { return _alloc; }
+
+		/**
+		 *  The generations, oldest first; the last one receives the inserts.
+		 */
+		const std::deque<tree_type>& generations() const noexcept
+		{ return _generations; }
+
+		std::size_t size() const noexcept
+		{
+			std::size_t n = 0;
+			for (const tree_type& g : _generations) { n += g.size(); }
+			return n;
+		}
+
+		bool empty() const noexcept { return size() == 0; }
+
+		/**
+		 *  Move the window to now: seal the generations whose slice ended,
+		 *  and drop those whose values are all older than the window. Return
+		 *  the number of generations dropped.
+		 */
+		std::size_t advance(time_point now)
+		{
+			std::size_t dropped = 0;
+			if (now - _ends.back() >= _window)
+			{
+				// everything expired: start over with the slice of now
+				dropped = _generations.size();
+				auto slices = (now - _ends.back()) / _slice + 1;
+				time_point end = _ends.back() + slices * _slice;
+				_generations.clear();
+				_ends.clear();
+				_generations.emplace_back(_index, _alloc);
+				_ends.push_back(end);
+				return dropped;
+			}
+			while (now >= _ends.back()) { _rotate(); }
+			while (_generations.size() > 1 && now - _ends.front() >= _window)
+			{
+				_generations.pop_front();
+				_ends.pop_front();
+				++dropped;
+			}
+			return dropped;
+		}
+
+		/**
+		 *  Insert a copy of val in the current generation.
+		 */
+		typename tree_type::iterator insert(const value_type& val)
+		{ return _generations.back().insert(val); }
+
+		typename tree_type::iterator insert(value_type&& val)
+		{ return _generations.back().insert(std::move(val)); }
+
+		/**
+		 *  Remove all values, keeping the current slice.
+		 */
+		void clear()
+		{
+			while (_generations.size() > 1)
+			{
+				_generations.pop_front();
+				_ends.pop_front();
+			}
+			_generations.back().clear();
+		}
+
+		/**
+		 *  The number of values equal to val along all dimensions, in all
+		 *  generations.
+		 */
+		std::size_t count(const value_type& val) const
+		{
+			std::size_t n = 0;
+			for (const tree_type& g : _generations) { n += g.count(val); }
+			return n;
+		}
+
+		/**
+		 *  A value equal to val along all dimensions, from the most recent
+		 *  generation that holds one, or nullptr.
+		 */
+		const value_type* find(const value_type& val) const noexcept
+		{
+			for (auto g = _generations.rbegin(); g != _generations.rend(); ++g)
+			{
+				const_iterator found = g->find(val);
+				if (found != g->end()) { return std::addressof(found->value()); }
+			}
+			return nullptr;
+		}
+
+		/**
+		 *  Write to out the const_iterator of each value within the closed box
+		 *  [low, high], generation by generation, oldest first.
+		 */
+		template<typename OutputIterator>
+		OutputIterator
+		range(const value_type& low, const value_type& high,
+		      OutputIterator out) const
+		{
+			for (const tree_type& g : _generations) { out = g.range(low, high, out); }
+			return out;
+		}
+
+		std::size_t count_in_range(const value_type& low,
+		                           const value_type& high) const
+		{
+			std::size_t n = 0;
+			for (const tree_type& g : _generations)
+			{ n += g.count_in_range(low, high); }
+			return n;
+		}
+
+		template<typename Monoid>
+		typename Monoid::result_type
+		aggregate_in_range(const value_type& low, const value_type& high,
+		                   const Monoid& monoid) const
+		{
+			typename Monoid::result_type r = monoid.identity();
+			for (const tree_type& g : _generations)
+			{ r = monoid.combine(r, g.aggregate_in_range(low, high, monoid)); }
+			return r;
+		}
+
+		/**
+		 *  Write to out the const_iterators of the k values closest to origin
+		 *  according to metric, by increasing distance, from all generations.
+		 */
+		template<typename Metric, typename OutputIterator,
+		         typename Strategy = depth_first>
+		OutputIterator
+		nearest(const value_type& origin, std::size_t k, const Metric& metric,
+		        OutputIterator out, Strategy strategy = Strategy()) const
+		{
+			if (k == 0) { return out; }
+			details::nearest_k<typename Metric::distance_type, const_iterator>
+				found(k, size());
+			std::vector<const_iterator> candidates;
+			candidates.reserve(std::min(k, size()));
+			for (const tree_type& g : _generations)
+			{
+				candidates.clear();
+				g.nearest(origin, k, metric, std::back_inserter(candidates),
+				          strategy);
+				for (const const_iterator& c : candidates)
+				{ found.push(metric.distance_to_key(origin, c->value()), c); }
+			}
+			for (const auto& n : found.sorted()) { *out++ = n.node; }
+			return out;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,482 @@
+// Benchmark suite for kdtree, built when Google Benchmark is installed.
+//
+// Each benchmark takes the tree size and the distribution of the values as
+// arguments, and is instantiated for several numbers of dimensions K and value
+// sizes (in bytes, the coordinates included). To record results for later
+// comparison:
+//
+//   ./bench --benchmark_out=results.json --benchmark_out_format=json
+//
+// and select benchmarks with --benchmark_filter=<regex>. Tree sizes go up to
+// KDTREE_BENCH_MAX_SIZE, 1e6 by default; define it to 100000000 at compile time
+// to sweep up to 1e8 values, given enough memory.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../include/kdtree_index.hpp"
+
+using namespace kdtree_index;
+
+#ifndef KDTREE_BENCH_MAX_SIZE
+#define KDTREE_BENCH_MAX_SIZE 1000000
+#endif
+
+// Inserting one value at a time is much slower than the bulk build, so the
+// insert and erase benchmarks stop at smaller sizes
+constexpr std::int64_t Max_size = KDTREE_BENCH_MAX_SIZE;
+constexpr std::int64_t Max_update_size = (Max_size < 100000) ? Max_size : 100000;
+
+constexpr std::int32_t Span = 1000000000;
+
+/**
+ *  A value of N 32-bit integers, the first K of which are its coordinates; the
+ *  others only make the value larger.
+ */
+template<dimension_type K, std::size_t N>
+struct point
+{
+	static_assert(K <= N, "a point holds at least its coordinates");
+	std::int32_t x[N];
+};
+
+template<dimension_type K, std::size_t N>
+struct less_point
+{
+	bool operator()(dimension_type d, const point<K, N>& a,
+	                const point<K, N>& b) const noexcept
+	{ return a.x[d] < b.x[d]; }
+};
+
+template<dimension_type K, std::size_t N>
+struct minus_point
+{
+	double operator()(dimension_type d, const point<K, N>& a,
+	                  const point<K, N>& b) const noexcept
+	{ return static_cast<double>(a.x[d]) - static_cast<double>(b.x[d]); }
+};
+
+template<dimension_type K, std::size_t N>
+using point_tree = kdtree<indexable<point<K, N>, K, less_point<K, N>>>;
+
+template<dimension_type K, std::size_t N>
+using point_metric = quadrance<indexable<point<K, N>, K, less_point<K, N>>,
+                               double, minus_point<K, N>>;
+
+enum distribution { uniform, clustered, sorted, adversarial };
+
+const char* const distribution_names[]
+= { "uniform", "clustered", "sorted", "adversarial" };
+
+/**
+ *  n values drawn from d:
+ *  - uniform: coordinates drawn uniformly from [0, Span],
+ *  - clustered: normally distributed around 1000 random centers,
+ *  - sorted: the i-th value is i along all dimensions, in that order,
+ *  - adversarial: coordinates drawn from 8 values only, so that most values
+ *    are equivalent to many others along each dimension.
+ */
+template<dimension_type K, std::size_t N>
+std::vector<point<K, N>>
+generate(std::int64_t n, distribution d, std::uint32_t seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<std::int32_t> coord(0, Span);
+	std::uniform_int_distribution<std::int32_t> few(0, 7);
+	std::normal_distribution<double> spread(0.0, Span / 10000.0);
+	std::vector<point<K, N>> centers(1000);
+	for (auto& c : centers)
+	{ for (dimension_type j = 0; j < K; ++j) { c.x[j] = coord(gen); } }
+	std::vector<point<K, N>> values(static_cast<std::size_t>(n));
+	for (std::size_t i = 0; i < values.size(); ++i)
+	{
+		point<K, N>& v = values[i];
+		for (std::size_t j = 0; j < N; ++j) { v.x[j] = 0; }
+		for (dimension_type j = 0; j < K; ++j)
+		{
+			switch (d)
+			{
+			case uniform: v.x[j] = coord(gen); break;
+			case clustered:
+				v.x[j] = centers[i % centers.size()].x[j]
+					+ static_cast<std::int32_t>(spread(gen));
+				break;
+			case sorted: v.x[j] = static_cast<std::int32_t>(i); break;
+			case adversarial: v.x[j] = few(gen); break;
+			}
+		}
+	}
+	return values;
+}
+
+template<dimension_type K, std::size_t N>
+void set_counters(benchmark::State& state, std::int64_t items)
+{
+	state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) * items);
+	state.SetLabel(distribution_names[state.range(1)]);
+	state.counters["K"] = static_cast<double>(K);
+	state.counters["bytes"] = static_cast<double>(sizeof(point<K, N>));
+}
+
+template<dimension_type K, std::size_t N>
+void BM_insert(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	for (auto _ : state)
+	{
+		point_tree<K, N> tree(values.size());
+		for (const auto& v : values) { tree.insert(v); }
+		benchmark::DoNotOptimize(tree.size());
+	}
+	set_counters<K, N>(state, state.range(0));
+}
+
+template<dimension_type K, std::size_t N>
+void BM_build(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	for (auto _ : state)
+	{
+		point_tree<K, N> tree(values.begin(), values.end());
+		benchmark::DoNotOptimize(tree.size());
+	}
+	set_counters<K, N>(state, state.range(0));
+}
+
+template<dimension_type K, std::size_t N>
+void BM_find(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	std::shuffle(values.begin(), values.end(), std::mt19937(2));
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(tree.find(values[i]));
+		if (++i == values.size()) { i = 0; }
+	}
+	set_counters<K, N>(state, 1);
+}
+
+template<dimension_type K, std::size_t N>
+void BM_min_max(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	auto dist = tree.end() - tree.begin();
+	dimension_type d = 0;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(minimum(d, 0, root_offset(dist),
+		                                 root(tree.begin(), dist),
+		                                 tree.get_index()));
+		benchmark::DoNotOptimize(maximum(d, 0, root_offset(dist),
+		                                 root(tree.begin(), dist),
+		                                 tree.get_index()));
+		d = inc<K>(d);
+	}
+	set_counters<K, N>(state, 1);
+}
+
+template<dimension_type K, std::size_t N>
+void BM_erase(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	point_tree<K, N> built(values.begin(), values.end());
+	std::shuffle(values.begin(), values.end(), std::mt19937(2));
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		point_tree<K, N> tree(built);
+		state.ResumeTiming();
+		for (const auto& v : values) { tree.erase(v); }
+		benchmark::DoNotOptimize(tree.size());
+	}
+	set_counters<K, N>(state, state.range(0));
+}
+
+/**
+ *  Insert a batch of n / 10 values in a tree of n values, one at a time or
+ *  with parallel_insert() on all hardware threads.
+ */
+template<dimension_type K, std::size_t N, bool Parallel>
+void BM_batch_insert(benchmark::State& state)
+{
+	auto d = static_cast<distribution>(state.range(1));
+	auto values = generate<K, N>(state.range(0), d, 1);
+	auto batch = generate<K, N>(state.range(0) / 10, d, 2);
+	point_tree<K, N> built(values.begin(), values.end());
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		point_tree<K, N> tree(built);
+		state.ResumeTiming();
+		if (Parallel) { tree.parallel_insert(batch.begin(), batch.end()); }
+		else { for (const auto& v : batch) { tree.insert(v); } }
+		benchmark::DoNotOptimize(tree.size());
+	}
+	set_counters<K, N>(state, state.range(0) / 10);
+}
+
+/**
+ *  Move values by up to 1/10000 of the span along each dimension, as for
+ *  positions that are updated often.
+ */
+template<dimension_type K, std::size_t N>
+void BM_update(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	std::mt19937 gen(2);
+	std::uniform_int_distribution<std::int32_t> step(-Span / 10000, Span / 10000);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		point<K, N>& v = values[i];
+		auto pos = tree.find(v);
+		for (dimension_type j = 0; j < K; ++j) { v.x[j] += step(gen); }
+		benchmark::DoNotOptimize(tree.update(pos, v));
+		if (++i == values.size()) { i = 0; }
+	}
+	set_counters<K, N>(state, 1);
+}
+
+/**
+ *  Boxes with sides chosen to hold about 10 values when the values are
+ *  uniform.
+ */
+template<dimension_type K, std::size_t N>
+void BM_range(benchmark::State& state)
+{
+	auto d = static_cast<distribution>(state.range(1));
+	auto values = generate<K, N>(state.range(0), d, 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	auto lows = generate<K, N>(1024, d, 2);
+	double side = std::pow(10.0 / static_cast<double>(state.range(0)),
+	                       1.0 / static_cast<double>(K))
+		* static_cast<double>(Span);
+	std::vector<point<K, N>> highs(lows);
+	for (auto& h : highs)
+	{
+		for (dimension_type j = 0; j < K; ++j)
+		{ h.x[j] = static_cast<std::int32_t>(std::min<double>(h.x[j] + side, Span)); }
+	}
+	std::vector<typename point_tree<K, N>::const_iterator> found;
+	std::size_t i = 0;
+	std::size_t total = 0;
+	for (auto _ : state)
+	{
+		found.clear();
+		tree.range(lows[i], highs[i], std::back_inserter(found));
+		total += found.size();
+		i = (i + 1) % lows.size();
+	}
+	set_counters<K, N>(state, 1);
+	state.counters["found"] = benchmark::Counter(static_cast<double>(total),
+	                                             benchmark::Counter::kAvgIterations);
+}
+
+/**
+ *  Export with one large box, bounded by quantiles so that it holds about a
+ *  quarter of the values when they are uniform, on one thread or on all the
+ *  hardware threads.
+ */
+template<dimension_type K, std::size_t N, bool Parallel>
+void BM_export(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	point<K, N> low, high;
+	for (std::size_t j = 0; j < N; ++j) { low.x[j] = high.x[j] = 0; }
+	for (dimension_type j = 0; j < K; ++j)
+	{
+		std::vector<std::int32_t> c;
+		for (const auto& v : values) { c.push_back(v.x[j]); }
+		std::sort(c.begin(), c.end());
+		high.x[j] = c[static_cast<std::size_t>(
+			std::pow(0.25, 1.0 / static_cast<double>(K))
+			* static_cast<double>(c.size() - 1))];
+		low.x[j] = c.front();
+	}
+	std::vector<typename point_tree<K, N>::const_iterator> found;
+	found.reserve(values.size());
+	for (auto _ : state)
+	{
+		found.clear();
+		if (Parallel)
+		{ tree.parallel_range(low, high, std::back_inserter(found)); }
+		else
+		{ tree.range(low, high, std::back_inserter(found)); }
+		benchmark::DoNotOptimize(found.data());
+	}
+	set_counters<K, N>(state, 1);
+	state.counters["found"] = static_cast<double>(found.size());
+}
+
+template<dimension_type K, std::size_t N>
+void BM_knn(benchmark::State& state)
+{
+	auto d = static_cast<distribution>(state.range(1));
+	auto values = generate<K, N>(state.range(0), d, 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	auto queries = generate<K, N>(1024, d, 2);
+	point_metric<K, N> metric;
+	std::vector<typename point_tree<K, N>::const_iterator> found;
+	found.reserve(8);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		found.clear();
+		tree.nearest(queries[i], 8, metric, std::back_inserter(found));
+		benchmark::DoNotOptimize(found.data());
+		i = (i + 1) % queries.size();
+	}
+	set_counters<K, N>(state, 1);
+}
+
+/**
+ *  The 8 nearest other values of every value, on one thread: one search per
+ *  value, or a single self join.
+ */
+template<dimension_type K, std::size_t N, bool Join>
+void BM_self_knn(benchmark::State& state)
+{
+	auto values = generate<K, N>(state.range(0),
+	                             static_cast<distribution>(state.range(1)), 1);
+	point_tree<K, N> tree(values.begin(), values.end());
+	point_metric<K, N> metric;
+	const std::size_t k = 8;
+	std::vector<typename point_tree<K, N>::const_iterator>
+		found(k * static_cast<std::size_t>(tree.end() - tree.begin()));
+	for (auto _ : state)
+	{
+		if (Join) { tree.self_knn(k, metric, found.begin(), 1); }
+		else
+		{
+			auto out = found.begin();
+			for (auto i = tree.cbegin(); i != tree.cend(); ++i, out += k)
+			{
+				if (!i->is_valid()) { continue; }
+				const point<K, N>* self = &i->value();
+				tree.nearest_if(i->value(), k, metric,
+				                [self](const point<K, N>& v) { return &v != self; },
+				                out);
+			}
+		}
+		benchmark::DoNotOptimize(found.data());
+	}
+	set_counters<K, N>(state, state.range(0));
+}
+
+/**
+ *  All pairs of values of two trees within a radius chosen so that each
+ *  value has a few partners when the values are uniform, on one thread: one
+ *  search per value of the first tree, or a single radius join.
+ */
+template<dimension_type K, std::size_t N, bool Join>
+void BM_radius_join(benchmark::State& state)
+{
+	auto d = static_cast<distribution>(state.range(1));
+	auto a = generate<K, N>(state.range(0), d, 1);
+	auto b = generate<K, N>(state.range(0), d, 2);
+	point_tree<K, N> queries(a.begin(), a.end());
+	point_tree<K, N> reference(b.begin(), b.end());
+	point_metric<K, N> metric;
+	double side = std::pow(10.0 / static_cast<double>(state.range(0)),
+	                       1.0 / static_cast<double>(K))
+		* static_cast<double>(Span);
+	auto radius = static_cast<typename point_metric<K, N>::distance_type>
+		(side * side / 4);
+	std::vector<typename point_tree<K, N>::const_iterator> within;
+	std::size_t pairs = 0;
+	for (auto _ : state)
+	{
+		pairs = 0;
+		if (Join)
+		{
+			pairs = queries.radius_join
+				(reference, radius, metric,
+				 [](const std::pair<typename point_tree<K, N>::const_iterator,
+				                    typename point_tree<K, N>::const_iterator>* first,
+				    const std::pair<typename point_tree<K, N>::const_iterator,
+				                    typename point_tree<K, N>::const_iterator>*)
+				 { benchmark::DoNotOptimize(first); });
+		}
+		else
+		{
+			for (const auto& v : a)
+			{
+				within.clear();
+				reference.within_radius(v, radius, metric, std::back_inserter(within));
+				pairs += within.size();
+			}
+		}
+		benchmark::DoNotOptimize(pairs);
+	}
+	set_counters<K, N>(state, state.range(0));
+	state.counters["pairs"] = static_cast<double>(pairs);
+}
+
+void sweep(benchmark::internal::Benchmark* b, std::int64_t max_size,
+           distribution last = adversarial)
+{
+	b->ArgNames({"n", "dist"});
+	for (std::int64_t d = uniform; d <= last; ++d)
+	{
+		for (std::int64_t n = 1000; n <= max_size; n *= 10) { b->Args({n, d}); }
+	}
+}
+
+void sweep_queries(benchmark::internal::Benchmark* b)
+{ sweep(b, Max_size); }
+
+void sweep_updates(benchmark::internal::Benchmark* b)
+{ sweep(b, Max_update_size); }
+
+// On sorted and adversarial values, a join finds nearly all pairs
+void sweep_joins(benchmark::internal::Benchmark* b)
+{ sweep(b, Max_update_size, clustered); }
+
+#define KDTREE_BENCH(K, N) \
+	BENCHMARK_TEMPLATE(BM_insert, K, N)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_build, K, N)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_find, K, N)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_min_max, K, N)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_batch_insert, K, N, false)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_batch_insert, K, N, true)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_erase, K, N)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_update, K, N)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_range, K, N)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_export, K, N, false)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_export, K, N, true)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_knn, K, N)->Apply(sweep_queries); \
+	BENCHMARK_TEMPLATE(BM_self_knn, K, N, false)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_self_knn, K, N, true)->Apply(sweep_updates); \
+	BENCHMARK_TEMPLATE(BM_radius_join, K, N, false)->Apply(sweep_joins); \
+	BENCHMARK_TEMPLATE(BM_radius_join, K, N, true)->Apply(sweep_joins)
+
+// Number of dimensions, with the smallest values
+KDTREE_BENCH(1, 1);
+KDTREE_BENCH(2, 2);
+KDTREE_BENCH(3, 3);
+KDTREE_BENCH(4, 4);
+KDTREE_BENCH(8, 8);
+// Value size: 64 and 256 bytes
+KDTREE_BENCH(2, 16);
+KDTREE_BENCH(2, 64);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,345 @@
+// Runs the same workloads through kdtree and the common alternatives, and
+// prints their throughput, latency percentiles and memory footprint side by
+// side. Only std::multiset, in 1 dimension, and Boost.Geometry's rtree are
+// compared; the rtree when CMake finds Boost, which defines
+// KDTREE_COMPARE_BOOST_RTREE. Other kd-trees, such as nanoflann or
+// libspatial, are not compared.
+//
+//   ./compare [values [queries]]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "../include/kdtree_index.hpp"
+
+#ifdef KDTREE_COMPARE_BOOST_RTREE
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#endif
+
+using namespace kdtree_index;
+
+// Bytes currently allocated through counting_allocator
+std::size_t allocated = 0;
+
+/**
+ *  Allocator that keeps track of the memory used by the containers compared.
+ */
+template<typename T>
+struct counting_allocator
+{
+	typedef T value_type;
+
+	counting_allocator() noexcept { }
+	template<typename U>
+	counting_allocator(const counting_allocator<U>&) noexcept { }
+
+	T* allocate(std::size_t n)
+	{
+		allocated += n * sizeof(T);
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* p, std::size_t n) noexcept
+	{
+		allocated -= n * sizeof(T);
+		std::allocator<T>().deallocate(p, n);
+	}
+};
+
+template<typename T, typename U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&)
+	noexcept
+{ return true; }
+
+template<typename T, typename U>
+bool operator!=(const counting_allocator<T>&, const counting_allocator<U>&)
+	noexcept
+{ return false; }
+
+template<dimension_type K>
+struct point { double x[K]; };
+
+template<dimension_type K>
+struct less_point
+{
+	bool operator()(dimension_type d, const point<K>& a, const point<K>& b)
+		const noexcept
+	{ return a.x[d] < b.x[d]; }
+};
+
+template<dimension_type K>
+struct minus_point
+{
+	double operator()(dimension_type d, const point<K>& a, const point<K>& b)
+		const noexcept
+	{ return a.x[d] - b.x[d]; }
+};
+
+template<dimension_type K>
+using point_indexable = indexable<point<K>, K, less_point<K>>;
+
+template<dimension_type K>
+using point_tree = kdtree<point_indexable<K>, counting_allocator<point<K>>>;
+
+template<dimension_type K>
+using point_metric = quadrance<point_indexable<K>, double, minus_point<K>>;
+
+constexpr std::size_t Neighbors = 8;
+
+/**
+ *  The values and queries shared by all the containers compared.
+ */
+template<dimension_type K>
+struct workload
+{
+	std::vector<point<K>> values;
+	std::vector<point<K>> hits;    // values to find, in random order
+	std::vector<point<K>> lows;    // range queries, about 10 values each
+	std::vector<point<K>> highs;
+	std::vector<point<K>> origins; // nearest neighbor queries
+
+	workload(std::size_t n, std::size_t queries)
+	{
+		std::mt19937 gen(42);
+		std::uniform_real_distribution<double> coord(0.0, 1.0);
+		auto draw = [&]()
+		{
+			point<K> p;
+			for (dimension_type d = 0; d < K; ++d) { p.x[d] = coord(gen); }
+			return p;
+		};
+		double side = std::pow(10.0 / static_cast<double>(n),
+		                       1.0 / static_cast<double>(K));
+		for (std::size_t i = 0; i < n; ++i) { values.push_back(draw()); }
+		for (std::size_t i = 0; i < queries; ++i)
+		{
+			hits.push_back(values[gen() % n]);
+			point<K> low = draw();
+			point<K> high = low;
+			for (dimension_type d = 0; d < K; ++d) { high.x[d] += side; }
+			lows.push_back(low);
+			highs.push_back(high);
+			origins.push_back(draw());
+		}
+	}
+};
+
+void header()
+{
+	std::printf("%-14s %-6s %12s %9s %9s %9s %10s\n", "container", "query",
+	            "queries/s", "p50 ns", "p90 ns", "p99 ns", "memory MB");
+}
+
+/**
+ *  Time query(i) for each of the n queries separately and print the
+ *  throughput and latency percentiles. The sum of the results of query is
+ *  printed too, so that the work is not optimized away and the containers can
+ *  be checked against each other.
+ */
+template<typename Query>
+void measure(const char* container, const char* name, std::size_t n,
+             Query query)
+{
+	typedef std::chrono::steady_clock clock;
+	std::vector<double> latencies;
+	latencies.reserve(n);
+	std::size_t check = 0;
+	auto first = clock::now();
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		auto start = clock::now();
+		check += query(i);
+		latencies.push_back(std::chrono::duration<double, std::nano>
+		                    (clock::now() - start).count());
+	}
+	std::chrono::duration<double> total = clock::now() - first;
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p)
+	{ return latencies[static_cast<std::size_t>(p * static_cast<double>(n - 1))]; };
+	std::printf("%-14s %-6s %12.0f %9.0f %9.0f %9.0f %10s (%zu)\n", container,
+	            name, static_cast<double>(n) / total.count(), percentile(0.5),
+	            percentile(0.9), percentile(0.99), "", check);
+}
+
+/**
+ *  Time the construction of a container from all the values, and print the
+ *  memory it holds.
+ */
+template<typename Build>
+auto build(const char* container, std::size_t n, Build make) -> decltype(make())
+{
+	typedef std::chrono::steady_clock clock;
+	std::size_t before = allocated;
+	auto start = clock::now();
+	auto result = make();
+	std::chrono::duration<double> total = clock::now() - start;
+	std::printf("%-14s %-6s %12.0f %9s %9s %9s %10.1f\n", container, "build",
+	            static_cast<double>(n) / total.count(), "", "", "",
+	            static_cast<double>(allocated - before) / 1048576.0);
+	return result;
+}
+
+template<dimension_type K>
+void compare_kdtree(const workload<K>& w)
+{
+	auto tree = build("kdtree", w.values.size(), [&]()
+	{ return point_tree<K>(w.values.begin(), w.values.end()); });
+	std::size_t n = w.hits.size();
+	measure("kdtree", "find", n, [&](std::size_t i)
+	{ return static_cast<std::size_t>(tree.find(w.hits[i]) != tree.end()); });
+	std::vector<typename point_tree<K>::const_iterator> found;
+	measure("kdtree", "range", n, [&](std::size_t i)
+	{
+		found.clear();
+		tree.range(w.lows[i], w.highs[i], std::back_inserter(found));
+		return found.size();
+	});
+	point_metric<K> metric;
+	measure("kdtree", "knn", n, [&](std::size_t i)
+	{
+		found.clear();
+		tree.nearest(w.origins[i], Neighbors, metric, std::back_inserter(found));
+		return found.size();
+	});
+}
+
+/**
+ *  Ordered containers only index 1 dimension.
+ */
+template<dimension_type K>
+void compare_ordered(const workload<K>&) { }
+
+void compare_ordered(const workload<1>& w)
+{
+	typedef std::multiset<double, std::less<double>, counting_allocator<double>>
+		multiset;
+	auto set = build("std::multiset", w.values.size(), [&]()
+	{
+		multiset s;
+		for (const point<1>& v : w.values) { s.insert(v.x[0]); }
+		return s;
+	});
+	std::size_t n = w.hits.size();
+	measure("std::multiset", "find", n, [&](std::size_t i)
+	{ return static_cast<std::size_t>(set.find(w.hits[i].x[0]) != set.end()); });
+	std::vector<multiset::const_iterator> found;
+	measure("std::multiset", "range", n, [&](std::size_t i)
+	{
+		found.clear();
+		auto last = set.upper_bound(w.highs[i].x[0]);
+		for (auto it = set.lower_bound(w.lows[i].x[0]); it != last; ++it)
+		{ found.push_back(it); }
+		return found.size();
+	});
+	measure("std::multiset", "knn", n, [&](std::size_t i)
+	{
+		// merge the values on each side of the origin, closest first
+		double origin = w.origins[i].x[0];
+		auto right = set.lower_bound(origin);
+		auto left = right;
+		found.clear();
+		while (found.size() < Neighbors
+		       && (left != set.begin() || right != set.end()))
+		{
+			if (right == set.end()
+			    || (left != set.begin()
+			        && origin - *std::prev(left) < *right - origin))
+			{ found.push_back(--left); }
+			else { found.push_back(right++); }
+		}
+		return found.size();
+	});
+}
+
+#ifdef KDTREE_COMPARE_BOOST_RTREE
+template<typename BPoint, dimension_type K, std::size_t... D>
+BPoint to_bpoint(const point<K>& p, std::index_sequence<D...>)
+{
+	BPoint b;
+	int expand[] = { (boost::geometry::set<D>(b, p.x[D]), 0)... };
+	static_cast<void>(expand);
+	return b;
+}
+
+template<dimension_type K>
+void compare_rtree(const workload<K>& w)
+{
+	namespace bg = boost::geometry;
+	namespace bgi = boost::geometry::index;
+	typedef bg::model::point<double, K, bg::cs::cartesian> bpoint;
+	typedef bg::model::box<bpoint> bbox;
+	typedef bgi::rtree<bpoint, bgi::quadratic<16>, bgi::indexable<bpoint>,
+	                   bgi::equal_to<bpoint>, counting_allocator<bpoint>> rtree;
+	auto convert = [](const point<K>& p)
+	{ return to_bpoint<bpoint>(p, std::make_index_sequence<K>()); };
+	std::vector<bpoint> values;
+	for (const point<K>& v : w.values) { values.push_back(convert(v)); }
+	// the packing algorithm is used when constructing from a range
+	auto tree = build("bgi::rtree", values.size(), [&]()
+	{ return rtree(values.begin(), values.end()); });
+	std::size_t n = w.hits.size();
+	std::vector<bpoint> found;
+	measure("bgi::rtree", "find", n, [&](std::size_t i)
+	{
+		found.clear();
+		tree.query(bgi::intersects(convert(w.hits[i])), std::back_inserter(found));
+		return static_cast<std::size_t>(!found.empty());
+	});
+	measure("bgi::rtree", "range", n, [&](std::size_t i)
+	{
+		found.clear();
+		tree.query(bgi::intersects(bbox(convert(w.lows[i]), convert(w.highs[i]))),
+		           std::back_inserter(found));
+		return found.size();
+	});
+	measure("bgi::rtree", "knn", n, [&](std::size_t i)
+	{
+		found.clear();
+		tree.query(bgi::nearest(convert(w.origins[i]),
+		                        static_cast<unsigned>(Neighbors)),
+		           std::back_inserter(found));
+		return found.size();
+	});
+}
+#endif
+
+template<dimension_type K>
+void compare(std::size_t n, std::size_t queries)
+{
+	workload<K> w(n, queries);
+	std::printf("\nK = %zu, %zu uniform values, %zu queries of each kind\n",
+	            static_cast<std::size_t>(K), n, queries);
+	header();
+	compare_kdtree(w);
+	compare_ordered(w);
+#ifdef KDTREE_COMPARE_BOOST_RTREE
+	compare_rtree(w);
+#endif
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t n = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::size_t queries
+		= (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 100000;
+	if (n == 0 || queries == 0)
+	{
+		std::fprintf(stderr, "usage: %s [values [queries]]\n", argv[0]);
+		return 1;
+	}
+	compare<1>(n, queries);
+	compare<2>(n, queries);
+	compare<3>(n, queries);
+	return 0;
+}
@@ -2,6 +2,10 @@
 #include <utility>
 #include <chrono>
 #include <cstring>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <iterator>
 
 #include "../include/kdtree_index.hpp"
 
@@ -15,6 +19,102 @@ struct ac_pod
 };
 typedef indexable<pod, 2, ac_pod> my_indexable;
 
+struct point { double x; double y; };
+struct ac_point
+{
+	bool operator()(dimension_type d, const point& a, const point& b) const noexcept
+	{ return (d == 0) ? a.x < b.x : a.y < b.y; }
+};
+struct minus_point
+{
+	double operator()(dimension_type d, const point& a, const point& b)
+		const noexcept
+	{ return (d == 0) ? a.x - b.x : a.y - b.y; }
+};
+typedef indexable<point, 2, ac_point> point_indexable;
+
+template<typename Tree, typename Query, typename... Strategy>
+void find_all(const char* name, const Tree& tree,
+              const std::vector<Query>& queries, Strategy... strategy)
+{
+	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::duration<double> elapsed_seconds;
+
+	start = std::chrono::system_clock::now();
+
+	for (const Query& q : queries)
+	{
+		auto iter = tree.find(q, strategy...);
+		// to avoid result optimization
+		if (!iter->is_valid()) { std::cout << "Error!" << std::endl; }
+	}
+
+	end = std::chrono::system_clock::now();
+	elapsed_seconds = end-start;
+	std::cout << name << " find time: " << elapsed_seconds.count() << "s\n";
+}
+
+template<typename Tree, typename Query>
+void find_group(const char* name, const Tree& tree,
+                const std::vector<Query>& queries, std::size_t group)
+{
+	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::duration<double> elapsed_seconds;
+	std::vector<typename Tree::const_iterator> found;
+	found.reserve(queries.size());
+
+	start = std::chrono::system_clock::now();
+
+	tree.find(queries.begin(), queries.end(), std::back_inserter(found),
+	          interleaved(group));
+
+	end = std::chrono::system_clock::now();
+	for (const auto& iter : found)
+	{
+		// to avoid result optimization
+		if (!iter->is_valid()) { std::cout << "Error!" << std::endl; }
+	}
+	elapsed_seconds = end-start;
+	std::cout << name << " " << group << " find time: "
+	          << elapsed_seconds.count() << "s\n";
+}
+
+void compare(const char* name, int range)
+{
+	constexpr int Max = 1000000;
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<int> coord(0, range);
+	std::vector<pod> points;
+	for (int i = 0; i < Max; ++i) { points.push_back({coord(gen), coord(gen)}); }
+	kdtree<my_indexable> tree(points.begin(), points.end());
+	std::shuffle(points.begin(), points.end(), gen);
+	std::cout << name << ":\n";
+	find_all("  default", tree, points);
+	find_all("  branchless", tree, points, branchless());
+	find_group("  interleaved", tree, points, 1);
+	find_group("  interleaved", tree, points, 8);
+	find_group("  interleaved", tree, points, 16);
+	find_group("  interleaved", tree, points, 32);
+}
+
+void compare_quantized()
+{
+	constexpr int Max = 1000000;
+	std::mt19937 gen(42);
+	std::normal_distribution<double> coord(0.0, 1000.0);
+	std::vector<point> points;
+	for (int i = 0; i < Max; ++i) { points.push_back({coord(gen), coord(gen)}); }
+	kdtree<point_indexable> tree(points.begin(), points.end());
+	kdtree<point_indexable, std::allocator<point>,
+	       quantized_keys<std::uint16_t, double, minus_point>>
+		quantized(points.begin(), points.end());
+	std::shuffle(points.begin(), points.end(), gen);
+	std::cout << "doubles:\n";
+	find_all("  values", tree, points);
+	find_all("  16-bit keys", quantized, points);
+	std::cout << "  refined " << quantized.augmentation().refinements()
+	          << " of " << quantized.augmentation().visited() << " nodes\n";
+}
 
 int main (int, char **, char **)
 {
@@ -43,5 +143,9 @@ int main (int, char **, char **)
 	end = std::chrono::system_clock::now();
 	elapsed_seconds = end-start;
 	std::cout << "find time: " << elapsed_seconds.count() << "s\n";
+
+	compare("random, few duplicates", 100000000);
+	compare("random, many duplicates", 1000);
+	compare_quantized();
 	return 0;
 }
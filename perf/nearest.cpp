@@ -0,0 +1,138 @@
+#include <iostream>
+#include <utility>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "../include/kdtree_index.hpp"
+
+using namespace kdtree_index;
+
+struct pod { int a; int b; };
+struct ac_pod
+{
+	bool operator()(dimension_type d, const pod& a, const pod& b) const noexcept
+	{ return (d == 0) ? a.a < b.a : a.b < b.b; }
+};
+struct minus_pod
+{
+	double operator()(dimension_type d, const pod& a, const pod& b) const noexcept
+	{ return (d == 0) ? double(a.a) - double(b.a) : double(a.b) - double(b.b); }
+};
+typedef indexable<pod, 2, ac_pod> my_indexable;
+typedef quadrance<my_indexable, double, minus_pod> my_metric;
+
+constexpr int Max = 100000;
+constexpr int Queries = 100000;
+constexpr std::size_t K = 8;
+
+std::vector<pod> uniform(std::mt19937& gen, int n)
+{
+	std::uniform_int_distribution<int> coord(0, 1000000);
+	std::vector<pod> points;
+	for (int i = 0; i < n; ++i) { points.push_back({coord(gen), coord(gen)}); }
+	return points;
+}
+
+std::vector<pod> anisotropic(std::mt19937& gen, int n)
+{
+	std::uniform_int_distribution<int> narrow(0, 100);
+	std::uniform_int_distribution<int> wide(0, 1000000);
+	std::vector<pod> points;
+	for (int i = 0; i < n; ++i) { points.push_back({narrow(gen), wide(gen)}); }
+	return points;
+}
+
+std::vector<pod> clustered(std::mt19937& gen, int n)
+{
+	std::uniform_int_distribution<int> center(0, 1000000);
+	std::normal_distribution<double> spread(0.0, 1000.0);
+	std::vector<pod> points;
+	pod c = {center(gen), center(gen)};
+	for (int i = 0; i < n; ++i)
+	{
+		if (i % 1000 == 0) { c = {center(gen), center(gen)}; }
+		points.push_back({c.a + static_cast<int>(spread(gen)),
+		                  c.b + static_cast<int>(spread(gen))});
+	}
+	return points;
+}
+
+template<typename Tree, typename Strategy>
+void run(const char* name, const Tree& tree,
+         const std::vector<pod>& queries, Strategy strategy)
+{
+	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::duration<double> elapsed_seconds;
+	my_metric metric;
+	std::vector<typename Tree::const_iterator> found;
+	found.reserve(K);
+
+	start = std::chrono::system_clock::now();
+
+	for (const pod& q : queries)
+	{
+		auto iter = tree.nearest(q, metric, strategy);
+		// to avoid result optimization
+		if (!iter->is_valid()) { std::cout << "Error!" << std::endl; }
+	}
+
+	end = std::chrono::system_clock::now();
+	elapsed_seconds = end-start;
+	std::cout << name << " nearest time: " << elapsed_seconds.count() << "s\n";
+	start = std::chrono::system_clock::now();
+
+	for (const pod& q : queries)
+	{
+		found.clear();
+		tree.nearest(q, K, metric, std::back_inserter(found), strategy);
+		// to avoid result optimization
+		if (found.size() != K) { std::cout << "Error!" << std::endl; }
+	}
+
+	end = std::chrono::system_clock::now();
+	elapsed_seconds = end-start;
+	std::cout << name << " " << K << "-nearest time: "
+	          << elapsed_seconds.count() << "s\n";
+}
+
+void run_all(const char* name, const std::vector<pod>& points,
+             const std::vector<pod>& queries)
+{
+	kdtree<my_indexable> tree(points.size());
+	for (const pod& p : points) { tree.insert(p); }
+	std::cout << name << ":\n";
+	run("  depth-first", tree, queries, depth_first());
+	run("  best-bin-first", tree, queries, best_bin_first());
+	run("  best-bin-first (64 checks)", tree, queries, best_bin_first(64));
+	kdtree<my_indexable, std::allocator<pod>, box_cache<>> boxed(points.size());
+	for (const pod& p : points) { boxed.insert(p); }
+	run("  box cache, depth-first", boxed, queries, depth_first());
+	run("  box cache, best-bin-first", boxed, queries, best_bin_first());
+}
+
+void run_bulk(const char* name, const std::vector<pod>& points,
+              const std::vector<pod>& queries)
+{
+	std::cout << name << ", bulk built:\n";
+	kdtree<my_indexable> cyclic(points.begin(), points.end());
+	run("  cyclic split", cyclic, queries, depth_first());
+	kdtree<my_indexable, std::allocator<pod>, null_type,
+	       max_spread_split<double, minus_pod>> spread(points.begin(), points.end());
+	run("  max spread split", spread, queries, depth_first());
+	kdtree<my_indexable, std::allocator<pod>, null_type,
+	       max_variance_split<double, minus_pod>>
+		variance(points.begin(), points.end());
+	run("  max variance split", variance, queries, depth_first());
+}
+
+int main (int, char **, char **)
+{
+	std::mt19937 gen(42);
+	std::vector<pod> queries = uniform(gen, Queries);
+	run_all("uniform", uniform(gen, Max), queries);
+	run_all("clustered", clustered(gen, Max), queries);
+	run_bulk("uniform", uniform(gen, Max), queries);
+	run_bulk("anisotropic", anisotropic(gen, Max), anisotropic(gen, Queries));
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "../include/paged_kdtree.hpp"
+
+using namespace kdtree_index;
+
+struct pod { int a; int b; };
+struct ac_pod
+{
+	bool operator()(dimension_type d, const pod& a, const pod& b) const noexcept
+	{ return (d == 0) ? a.a < b.a : a.b < b.b; }
+};
+typedef indexable<pod, 2, ac_pod> my_indexable;
+
+void find_all(std::size_t cache_pages, const std::vector<pod>& queries)
+{
+	paged_kdtree<my_indexable> tree("paged.bin", cache_pages);
+	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::duration<double> elapsed_seconds;
+
+	start = std::chrono::system_clock::now();
+
+	for (const pod& q : queries)
+	{
+		// to avoid result optimization
+		if (!tree.contains(q)) { std::cout << "Error!" << std::endl; }
+	}
+
+	end = std::chrono::system_clock::now();
+	elapsed_seconds = end-start;
+	const page_cache_stats& stats = tree.stats();
+	std::cout << cache_pages << " pages: find time: " << elapsed_seconds.count()
+	          << "s, hit rate: " << stats.hit_rate()
+	          << ", reads per query: " << stats.reads_per_query()
+	          << ", bytes read: " << stats.bytes_read << "\n";
+}
+
+template<typename Reader>
+void find_batch(const char* name, std::size_t cache_pages, std::size_t window,
+                const std::vector<pod>& queries)
+{
+	paged_kdtree<my_indexable> tree("paged.bin", cache_pages);
+	std::vector<bool> found;
+	found.reserve(queries.size());
+	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::duration<double> elapsed_seconds;
+
+	start = std::chrono::system_clock::now();
+
+	tree.contains<Reader>(queries.begin(), queries.end(),
+	                      std::back_inserter(found), window);
+
+	end = std::chrono::system_clock::now();
+	elapsed_seconds = end-start;
+	// to avoid result optimization
+	for (bool f : found) { if (!f) { std::cout << "Error!" << std::endl; } }
+	const page_cache_stats& stats = tree.stats();
+	std::cout << cache_pages << " pages, " << name << " batch of " << window
+	          << ": find time: " << elapsed_seconds.count()
+	          << "s, reads per query: " << stats.reads_per_query()
+	          << ", reads per wait: "
+	          << static_cast<double>(stats.misses) / static_cast<double>(stats.waits)
+	          << "\n";
+}
+
+int main (int, char **, char **)
+{
+	constexpr int Max = 1000000;
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<int> coord(0, 100000000);
+	std::vector<pod> points;
+	for (int i = 0; i < Max; ++i) { points.push_back({coord(gen), coord(gen)}); }
+	{
+		kdtree<my_indexable> tree(points.begin(), points.end());
+		write_paged(tree, "paged.bin", 16384);
+	}
+	// queries are skewed towards a small part of the tree
+	std::vector<pod> queries;
+	std::uniform_int_distribution<int> hot(0, Max / 20);
+	for (int i = 0; i < Max; ++i)
+	{
+		queries.push_back((i % 4 == 0) ? points[static_cast<std::size_t>(i)]
+		                  : points[static_cast<std::size_t>(hot(gen))]);
+	}
+	for (std::size_t cache_pages : {std::size_t(16), std::size_t(64), std::size_t(512)})
+	{ find_all(cache_pages, queries); }
+	for (std::size_t window : {std::size_t(1), std::size_t(64)})
+	{
+		find_batch<details::pread_reader>("pread", 64, window, queries);
+		find_batch<details::default_page_reader>("default", 64, window, queries);
+	}
+	std::remove("paged.bin");
+	return 0;
+}
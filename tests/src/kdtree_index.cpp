@@ -11,11 +11,18 @@
 #include <cstdlib> // std::rand(), std::srand()
 #include <ctime>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <iostream>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <tuple>
 
 #define BOOST_TEST_MAIN
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
+#include <boost/mpl/list.hpp>
 
 BOOST_AUTO_TEST_CASE(install_srand)
 {
@@ -278,3 +285,1530 @@ BOOST_AUTO_TEST_CASE(kdtree_erase_by_value)
 	BOOST_CHECK_EQUAL(count, Max);
 	BOOST_CHECK_EQUAL(tree.size(), 0);
 }
+
+struct pod2 { int a; int b; };
+struct ac_pod2
+{
+	bool operator()(dimension_type d, const pod2& a, const pod2& b) const noexcept
+	{ return (d == 0) ? a.a < b.a : a.b < b.b; }
+};
+struct minus_pod2
+{
+	long operator()(dimension_type d, const pod2& a, const pod2& b) const noexcept
+	{ return (d == 0) ? long(a.a) - long(b.a) : long(a.b) - long(b.b); }
+};
+typedef indexable<pod2, 2, ac_pod2> my_indexable2;
+typedef quadrance<my_indexable2, long, minus_pod2> my_quadrance2;
+
+template<typename Tree>
+long brute_force_nearest(const Tree& tree, const pod2& origin, std::size_t k)
+{
+	// returns the distance to the k-th nearest neighbor
+	my_quadrance2 metric;
+	std::vector<long> dists;
+	for (auto ref : tree)
+	{
+		if (ref.is_valid())
+		{ dists.push_back(metric.distance_to_key(origin, ref.value())); }
+	}
+	std::sort(dists.begin(), dists.end());
+	return dists[k - 1];
+}
+
+std::vector<pod2> random_values(std::size_t n, int range, int shift = 0)
+{
+	// values in [0, range) along both dimensions, shifted along the first
+	std::vector<pod2> values;
+	for (std::size_t i = 0; i < n; ++i)
+	{ values.push_back({std::rand() % range + shift, std::rand() % range}); }
+	return values;
+}
+
+inline bool within(const pod2& v, const pod2& low, const pod2& high)
+{ return low.a <= v.a && v.a <= high.a && low.b <= v.b && v.b <= high.b; }
+
+struct sum_a
+{
+	typedef long result_type;
+	long identity() const noexcept { return 0; }
+	long operator()(const pod2& v) const noexcept { return v.a; }
+	long combine(long x, long y) const noexcept { return x + y; }
+	long remove(long x, long y) const noexcept { return x - y; }
+};
+
+template<typename Tree>
+void check_query(Tree& tree, const std::vector<pod2>& values,
+                 const pod2& low, const pod2& high)
+{
+	// values holds the values of tree, searched by brute force
+	std::size_t equal = 0, inside = 0;
+	long sum = 0;
+	my_quadrance2 metric;
+	std::vector<long> dists;
+	for (const pod2& v : values)
+	{
+		if (v.a == low.a && v.b == low.b) { ++equal; }
+		if (within(v, low, high)) { ++inside; sum += v.a; }
+		dists.push_back(metric.distance_to_key(low, v));
+	}
+	BOOST_CHECK_EQUAL(equal, tree.count(low));
+	BOOST_CHECK_EQUAL(equal != 0, tree.find(low) != tree.end());
+	std::vector<typename Tree::iterator> found;
+	tree.range(low, high, std::back_inserter(found));
+	BOOST_CHECK_EQUAL(inside, found.size());
+	for (auto iter : found) { BOOST_CHECK(within(iter->value(), low, high)); }
+	BOOST_CHECK_EQUAL(inside, tree.count_in_range(low, high));
+	BOOST_CHECK_EQUAL(sum, tree.aggregate_in_range(low, high, sum_a()));
+	std::sort(dists.begin(), dists.end());
+	std::size_t k = std::min(values.size(), std::size_t(5));
+	std::vector<typename Tree::iterator> df, bbf;
+	tree.nearest(low, k, metric, std::back_inserter(df));
+	tree.nearest(low, k, metric, std::back_inserter(bbf), best_bin_first());
+	BOOST_REQUIRE_EQUAL(k, df.size());
+	BOOST_REQUIRE_EQUAL(k, bbf.size());
+	auto browse = tree.nearest_begin(low, metric);
+	for (std::size_t j = 0; j < k; ++j, ++browse)
+	{
+		BOOST_CHECK_EQUAL(dists[j], metric.distance_to_key(low, df[j]->value()));
+		BOOST_CHECK_EQUAL(dists[j], metric.distance_to_key(low, bbf[j]->value()));
+		BOOST_CHECK_EQUAL(dists[j], browse.distance());
+	}
+}
+
+template<typename Tree>
+void check_queries(Tree& tree, const std::vector<pod2>& values,
+                   const pod2& range, const pod2& extent)
+{
+	// boxes within range, of up to extent; every other one starts on a value
+	for (int i = 0; i < 20; ++i)
+	{
+		pod2 low = {std::rand() % range.a, std::rand() % range.b};
+		if (i % 2 == 0 && !values.empty())
+		{ low = values[static_cast<std::size_t>(std::rand()) % values.size()]; }
+		check_query(tree, values, low,
+		            {low.a + std::rand() % extent.a, low.b + std::rand() % extent.b});
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_empty)
+{
+	kdtree<my_indexable2> tree;
+	BOOST_CHECK(tree.nearest({0, 0}, my_quadrance2()) == tree.end());
+	BOOST_CHECK(tree.nearest({0, 0}, my_quadrance2(), best_bin_first())
+	            == tree.end());
+	std::vector<kdtree<my_indexable2>::iterator> found;
+	tree.nearest({0, 0}, 3, my_quadrance2(), std::back_inserter(found));
+	BOOST_CHECK(found.empty());
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_one)
+{
+	constexpr int Max = 100;
+	kdtree<my_indexable2> tree(Max);
+	for (int i = 0; i < Max; ++i)
+	{ tree.insert({std::rand() % 50, std::rand() % 50}); }
+	my_quadrance2 metric;
+	for (int i = 0; i < 20; ++i)
+	{
+		pod2 origin = {std::rand() % 60 - 5, std::rand() % 60 - 5};
+		long expect = brute_force_nearest(tree, origin, 1);
+		auto df = tree.nearest(origin, metric);
+		BOOST_REQUIRE(df != tree.end());
+		BOOST_CHECK_EQUAL(expect, metric.distance_to_key(origin, df->value()));
+		auto bbf = tree.nearest(origin, metric, best_bin_first());
+		BOOST_REQUIRE(bbf != tree.end());
+		BOOST_CHECK_EQUAL(expect, metric.distance_to_key(origin, bbf->value()));
+		auto cdf = static_cast<const kdtree<my_indexable2>&>(tree)
+			.nearest(origin, metric);
+		BOOST_CHECK(cdf->value_ptr() == df->value_ptr());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_k)
+{
+	constexpr int Max = 100;
+	constexpr std::size_t K = 7;
+	kdtree<my_indexable2> tree(Max);
+	for (int i = 0; i < Max; ++i)
+	{ tree.insert({std::rand() % 50, std::rand() % 50}); }
+	my_quadrance2 metric;
+	for (int i = 0; i < 20; ++i)
+	{
+		pod2 origin = {std::rand() % 60 - 5, std::rand() % 60 - 5};
+		std::vector<kdtree<my_indexable2>::iterator> df, bbf;
+		tree.nearest(origin, K, metric, std::back_inserter(df));
+		tree.nearest(origin, K, metric, std::back_inserter(bbf), best_bin_first());
+		BOOST_REQUIRE_EQUAL(K, df.size());
+		BOOST_REQUIRE_EQUAL(K, bbf.size());
+		for (std::size_t j = 0; j < K; ++j)
+		{
+			long expect = brute_force_nearest(tree, origin, j + 1);
+			BOOST_CHECK_EQUAL(expect, metric.distance_to_key(origin, df[j]->value()));
+			BOOST_CHECK_EQUAL(expect, metric.distance_to_key(origin, bbf[j]->value()));
+		}
+	}
+	// asking for more than what the tree holds returns all values
+	std::vector<kdtree<my_indexable2>::iterator> all;
+	tree.nearest({0, 0}, Max * 2, metric, std::back_inserter(all));
+	BOOST_CHECK_EQUAL(Max, all.size());
+	all.clear();
+	tree.nearest({0, 0}, std::numeric_limits<std::size_t>::max(), metric,
+	             std::back_inserter(all), best_bin_first());
+	BOOST_CHECK_EQUAL(Max, all.size());
+	std::vector<kdtree<my_indexable2>::const_iterator> pall;
+	tree.parallel_nearest({0, 0}, std::numeric_limits<std::size_t>::max(),
+	                      metric, std::back_inserter(pall), 4);
+	BOOST_CHECK_EQUAL(Max, pall.size());
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_bounded_checks)
+{
+	constexpr int Max = 100;
+	kdtree<my_indexable2> tree(Max);
+	for (int i = 0; i < Max; ++i)
+	{ tree.insert({std::rand() % 50, std::rand() % 50}); }
+	// with a single check, only the root is examined
+	auto iter = tree.nearest({0, 0}, my_quadrance2(), best_bin_first(1));
+	BOOST_REQUIRE(iter != tree.end());
+	auto dist = tree.end() - tree.begin();
+	BOOST_CHECK(iter == root(tree.begin(), dist));
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_iterator_empty)
+{
+	kdtree<my_indexable2> tree;
+	my_quadrance2 metric;
+	BOOST_CHECK(tree.nearest_begin({0, 0}, metric)
+	            == tree.nearest_end({0, 0}, metric));
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_iterator_browse)
+{
+	constexpr int Max = 100;
+	kdtree<my_indexable2> tree(Max);
+	for (int i = 0; i < Max; ++i)
+	{ tree.insert({std::rand() % 50, std::rand() % 50}); }
+	my_quadrance2 metric;
+	pod2 origin = {std::rand() % 60 - 5, std::rand() % 60 - 5};
+	std::size_t count = 0;
+	for (auto iter = tree.nearest_begin(origin, metric);
+	     iter != tree.nearest_end(origin, metric); ++iter)
+	{
+		++count;
+		BOOST_REQUIRE(iter->is_valid());
+		BOOST_CHECK_EQUAL(iter.distance(),
+		                  metric.distance_to_key(origin, iter->value()));
+		BOOST_CHECK_EQUAL(iter.distance(),
+		                  brute_force_nearest(tree, origin, count));
+	}
+	BOOST_CHECK_EQUAL(Max, count);
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_iterator_first_match)
+{
+	constexpr int Max = 100;
+	kdtree<my_indexable2> tree(Max);
+	for (int i = 0; i < Max; ++i)
+	{ tree.insert({i % 10, i / 10}); }
+	my_quadrance2 metric;
+	// walk neighbors until the first one above the diagonal
+	const kdtree<my_indexable2>& ctree = tree;
+	auto iter = ctree.nearest_begin({9, 0}, metric);
+	auto end = ctree.nearest_end({9, 0}, metric);
+	BOOST_CHECK_EQUAL(0, iter.distance());
+	while (iter != end && iter->value().b <= iter->value().a) { ++iter; }
+	BOOST_REQUIRE(iter != end);
+	BOOST_CHECK_EQUAL(iter->value().b, iter->value().a + 1);
+	BOOST_CHECK_EQUAL(iter.distance(), metric.distance_to_key({9, 0}, iter->value()));
+	auto copy = iter++;
+	BOOST_CHECK(copy != iter);
+	BOOST_CHECK(!(copy.distance() > iter.distance()));
+}
+
+struct even_pod2
+{
+	bool operator()(const pod2& x) const noexcept { return x.a % 2 == 0; }
+};
+
+struct even_count
+{
+	typedef std::size_t result_type;
+	std::size_t identity() const noexcept { return 0; }
+	std::size_t operator()(const pod2& x) const noexcept
+	{ return (x.a % 2 == 0) ? 1 : 0; }
+	std::size_t combine(std::size_t x, std::size_t y) const noexcept
+	{ return x + y; }
+	std::size_t remove(std::size_t x, std::size_t y) const noexcept
+	{ return x - y; }
+};
+
+struct even_pod2_summary
+{
+	typedef even_count summary_type;
+	explicit even_pod2_summary(std::size_t* c) : calls(c) { }
+	bool operator()(const pod2& x) const noexcept { return x.a % 2 == 0; }
+	bool subtree(std::size_t matching) const noexcept
+	{
+		++*calls;
+		return matching != 0;
+	}
+	std::size_t* calls;
+};
+
+typedef kdtree<my_indexable2, std::allocator<pod2>, aggregate_cache<even_count>,
+               cyclic_split, duplicate_keys, count_operations> even_tree2;
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_if)
+{
+	constexpr int Max = 100;
+	constexpr std::size_t K = 5;
+	kdtree<my_indexable2> tree(Max);
+	even_tree2 cached;
+	for (int i = 0; i < Max; ++i)
+	{
+		pod2 v = {std::rand() % 50, std::rand() % 50};
+		tree.insert(v);
+		cached.insert(v);
+	}
+	my_quadrance2 metric;
+	for (int i = 0; i < 20; ++i)
+	{
+		pod2 origin = {std::rand() % 60 - 5, std::rand() % 60 - 5};
+		std::vector<long> expect;
+		for (auto ref : tree)
+		{
+			if (ref.is_valid() && ref.value().a % 2 == 0)
+			{ expect.push_back(metric.distance_to_key(origin, ref.value())); }
+		}
+		std::sort(expect.begin(), expect.end());
+		std::vector<kdtree<my_indexable2>::iterator> df, bbf, plain;
+		std::vector<even_tree2::iterator> summary;
+		tree.nearest_if(origin, K, metric, even_pod2(), std::back_inserter(df));
+		tree.nearest_if(origin, K, metric, even_pod2(), std::back_inserter(bbf),
+		                best_bin_first());
+		// without a cached summary, the hook is never called
+		std::size_t calls = 0;
+		tree.nearest_if(origin, K, metric, even_pod2_summary(&calls),
+		                std::back_inserter(plain));
+		BOOST_CHECK_EQUAL(0, calls);
+		cached.nearest_if(origin, K, metric, even_pod2_summary(&calls),
+		                  std::back_inserter(summary));
+		BOOST_CHECK_NE(0, calls);
+		BOOST_REQUIRE_EQUAL(std::min(K, expect.size()), df.size());
+		BOOST_REQUIRE_EQUAL(df.size(), bbf.size());
+		BOOST_REQUIRE_EQUAL(df.size(), plain.size());
+		BOOST_REQUIRE_EQUAL(df.size(), summary.size());
+		for (std::size_t j = 0; j < df.size(); ++j)
+		{
+			BOOST_CHECK_EQUAL(0, df[j]->value().a % 2);
+			BOOST_CHECK_EQUAL(expect[j], metric.distance_to_key(origin, df[j]->value()));
+			BOOST_CHECK_EQUAL(expect[j], metric.distance_to_key(origin, bbf[j]->value()));
+			BOOST_CHECK_EQUAL(expect[j], metric.distance_to_key(origin, plain[j]->value()));
+			BOOST_CHECK_EQUAL(expect[j], metric.distance_to_key(origin, summary[j]->value()));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_if_no_match)
+{
+	even_tree2 tree;
+	for (int i = 0; i < 10; ++i) { tree.insert({2 * i + 1, i}); }
+	std::vector<even_tree2::iterator> found;
+	std::size_t calls = 0;
+	operation_counts before = tree.operations();
+	tree.nearest_if({0, 0}, 3, my_quadrance2(), even_pod2_summary(&calls),
+	                std::back_inserter(found));
+	BOOST_CHECK(found.empty());
+	// the whole tree is skipped at the root
+	BOOST_CHECK_EQUAL(1, calls);
+	BOOST_CHECK_EQUAL(1, (tree.operations() - before).visited);
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_nearest_if_pruning)
+{
+	// even values are rare and far from the origin, in a single corner
+	even_tree2 tree;
+	for (int i = 0; i < 1000; ++i)
+	{ tree.insert({2 * (std::rand() % 500) + 1, std::rand() % 1000}); }
+	for (int i = 0; i < 10; ++i) { tree.insert({990 + 2 * (i % 5), 990 + i}); }
+	my_quadrance2 metric;
+	std::vector<even_tree2::iterator> plain, summary;
+	operation_counts before = tree.operations();
+	tree.nearest_if({0, 0}, 3, metric, even_pod2(), std::back_inserter(plain));
+	std::size_t plain_visited = (tree.operations() - before).visited;
+	std::size_t calls = 0;
+	before = tree.operations();
+	tree.nearest_if({0, 0}, 3, metric, even_pod2_summary(&calls),
+	                std::back_inserter(summary));
+	std::size_t summary_visited = (tree.operations() - before).visited;
+	BOOST_REQUIRE_EQUAL(3, plain.size());
+	BOOST_REQUIRE_EQUAL(3, summary.size());
+	for (std::size_t j = 0; j < 3; ++j)
+	{
+		BOOST_CHECK_EQUAL(metric.distance_to_key({0, 0}, plain[j]->value()),
+		                  metric.distance_to_key({0, 0}, summary[j]->value()));
+	}
+	// sub-trees without even values are skipped rather than explored
+	BOOST_CHECK(4 * summary_visited < plain_visited);
+}
+
+template<typename Tree>
+void check_range(Tree& tree, const pod2& low, const pod2& high)
+{
+	std::size_t expect = 0;
+	for (auto ref : tree)
+	{
+		if (ref.is_valid() && low.a <= ref.value().a && ref.value().a <= high.a
+		    && low.b <= ref.value().b && ref.value().b <= high.b)
+		{ ++expect; }
+	}
+	std::vector<typename Tree::iterator> found;
+	tree.range(low, high, std::back_inserter(found));
+	BOOST_CHECK_EQUAL(expect, found.size());
+	for (auto iter : found)
+	{
+		BOOST_CHECK(low.a <= iter->value().a && iter->value().a <= high.a);
+		BOOST_CHECK(low.b <= iter->value().b && iter->value().b <= high.b);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_range)
+{
+	constexpr int Max = 100;
+	kdtree<my_indexable2> tree(Max);
+	std::vector<kdtree<my_indexable2>::iterator> found;
+	tree.range({0, 0}, {50, 50}, std::back_inserter(found));
+	BOOST_CHECK(found.empty());
+	for (int i = 0; i < Max; ++i)
+	{ tree.insert({std::rand() % 50, std::rand() % 50}); }
+	for (int i = 0; i < 20; ++i)
+	{
+		int a = std::rand() % 50, b = std::rand() % 50;
+		check_range(tree, {a, b}, {a + std::rand() % 20, b + std::rand() % 20});
+	}
+	check_range(tree, {0, 0}, {49, 49});
+	check_range(tree, {10, 10}, {5, 5});
+	std::vector<kdtree<my_indexable2>::const_iterator> cfound;
+	static_cast<const kdtree<my_indexable2>&>(tree)
+		.range({0, 0}, {49, 49}, std::back_inserter(cfound));
+	BOOST_CHECK_EQUAL(Max, cfound.size());
+}
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<2>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<1>>> box_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_box_cache_queries, Tree, box_trees2)
+{
+	// clustered values
+	std::vector<pod2> values;
+	for (int i = 0; i < 200; ++i)
+	{
+		int c = (std::rand() % 4) * 1000;
+		values.push_back({c + std::rand() % 50, c + std::rand() % 50});
+	}
+	Tree one, two, tree;
+	for (const pod2& v : values) { tree.insert(v); }
+	BOOST_CHECK_EQUAL(values.size(), tree.size());
+	check_queries(tree, values, {3100, 3100}, {500, 500});
+	one.insert(values[0]);
+	check_queries(one, {values[0]}, {3100, 3100}, {500, 500});
+	two.insert(values[0]);
+	two.insert(values[1]);
+	check_queries(two, {values[0], values[1]}, {3100, 3100}, {500, 500});
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_box_cache)
+{
+	// a box between the clusters misses their boxes near the root, where
+	// the splits alone do not tell it apart from them
+	kdtree<my_indexable2, std::allocator<pod2>, box_cache<>, cyclic_split,
+	       duplicate_keys, count_operations> boxed;
+	kdtree<my_indexable2, std::allocator<pod2>, null_type, cyclic_split,
+	       duplicate_keys, count_operations> plain;
+	for (int i = 0; i < 200; ++i)
+	{
+		int c = (std::rand() % 4) * 1000;
+		pod2 v = {c + std::rand() % 50, c + std::rand() % 50};
+		boxed.insert(v);
+		plain.insert(v);
+	}
+	std::vector<decltype(boxed)::iterator> none;
+	std::vector<decltype(plain)::iterator> plain_none;
+	boxed.range({100, 1100}, {900, 1900}, std::back_inserter(none));
+	plain.range({100, 1100}, {900, 1900}, std::back_inserter(plain_none));
+	BOOST_CHECK(none.empty() && plain_none.empty());
+	BOOST_CHECK(boxed.operations().visited < plain.operations().visited);
+	kdtree<my_indexable2, std::allocator<pod2>, box_cache<>> tree;
+	for (int i = 0; i < 10; ++i) { tree.insert({i, i}); }
+	kdtree<my_indexable2, std::allocator<pod2>, box_cache<>> copy(tree);
+	std::vector<kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>
+	            ::iterator> found;
+	copy.range({2, 2}, {4, 4}, std::back_inserter(found));
+	BOOST_CHECK_EQUAL(3, found.size());
+}
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, aggregate_cache<sum_a>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, aggregate_cache<sum_a, 2>>,
+	 kdtree<my_indexable2, std::allocator<pod2>,
+	        aggregate_cache<details::count_monoid>>> aggregate_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_aggregate_queries, Tree, aggregate_trees2)
+{
+	Tree empty, one, tree;
+	BOOST_CHECK_EQUAL(0, empty.count_in_range({0, 0}, {50, 50}));
+	BOOST_CHECK_EQUAL(0, empty.aggregate_in_range({0, 0}, {50, 50}, sum_a()));
+	std::vector<pod2> values = random_values(200, 50);
+	for (const pod2& v : values) { tree.insert(v); }
+	check_queries(tree, values, {50, 50}, {40, 40});
+	BOOST_CHECK_EQUAL(values.size(), tree.count_in_range({0, 0}, {49, 49}));
+	one.insert(values[0]);
+	check_queries(one, {values[0]}, {50, 50}, {40, 40});
+}
+
+struct counted_sum_a : sum_a
+{
+	// the number of values read, by all instances
+	static std::size_t reads;
+	long operator()(const pod2& v) const noexcept { ++reads; return v.a; }
+};
+std::size_t counted_sum_a::reads = 0;
+
+BOOST_AUTO_TEST_CASE(kdtree_aggregate_in_range)
+{
+	// sub-trees inside the box are summed from the cache, without reading
+	// their values again
+	kdtree<my_indexable2, std::allocator<pod2>, aggregate_cache<counted_sum_a>>
+		cached;
+	kdtree<my_indexable2> plain;
+	long sum = 0;
+	for (const pod2& v : random_values(1000, 1000))
+	{
+		cached.insert(v);
+		plain.insert(v);
+		sum += v.a;
+	}
+	counted_sum_a::reads = 0;
+	BOOST_CHECK_EQUAL(sum, plain.aggregate_in_range({0, 0}, {999, 999},
+	                                                counted_sum_a()));
+	std::size_t plain_reads = counted_sum_a::reads;
+	BOOST_CHECK_EQUAL(1000, plain_reads);
+	counted_sum_a::reads = 0;
+	BOOST_CHECK_EQUAL(sum, cached.aggregate_in_range({0, 0}, {999, 999},
+	                                                 counted_sum_a()));
+	// only the nodes whose cells are not bounded on all sides are read
+	BOOST_CHECK(2 * counted_sum_a::reads < plain_reads);
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_list_initialization)
+{
+	kdtree<my_indexable> tree({{3}, {1}, {4}, {1}, {5}, {9}, {2}, {6}});
+	BOOST_CHECK_EQUAL(8, tree.size());
+	BOOST_CHECK_EQUAL(15, tree.capacity());
+	for (int i : {1, 2, 3, 4, 5, 6, 9})
+	{
+		auto iter = tree.find({i});
+		BOOST_REQUIRE(iter != tree.end());
+		BOOST_CHECK_EQUAL(iter->value().a, i);
+	}
+	BOOST_CHECK(tree.find({7}) == tree.end());
+	tree.insert({7});
+	BOOST_CHECK(tree.find({7}) != tree.end());
+	kdtree<my_indexable> empty({});
+	BOOST_CHECK(empty.empty());
+}
+
+typedef max_spread_split<long, minus_pod2> my_spread2;
+typedef max_variance_split<long, minus_pod2> my_variance2;
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, null_type, my_variance2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<>, my_spread2>>
+	split_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_bulk_build_queries, Tree, split_trees2)
+{
+	for (std::size_t n : {std::size_t(1), std::size_t(127), std::size_t(200)})
+	{
+		// values spread 10000 times more along b than along a
+		std::vector<pod2> values;
+		for (std::size_t i = 0; i < n; ++i)
+		{ values.push_back({std::rand() % 10, std::rand() % 100000}); }
+		Tree tree(values.begin(), values.end());
+		BOOST_CHECK_EQUAL(n, tree.size());
+		for (int round = 0; round < 2; ++round)
+		{
+			for (const pod2& v : values)
+			{
+				auto iter = tree.find(v);
+				BOOST_REQUIRE(iter != tree.end());
+				BOOST_CHECK(iter->value().a == v.a && iter->value().b == v.b);
+			}
+			check_queries(tree, values, {10, 100000}, {5, 20000});
+			// inserting after the build expands the tree and its side array
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				pod2 v = {std::rand() % 10, std::rand() % 100000};
+				values.push_back(v);
+				tree.insert(v);
+			}
+			BOOST_CHECK_EQUAL(values.size(), tree.size());
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_bulk_build)
+{
+	// the split is kept by copies
+	std::vector<pod2> values = {{0, 0}, {1, 1000}, {2, 2000}, {0, 3000}};
+	kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>
+		tree(values.begin(), values.end());
+	auto copy = tree;
+	for (const pod2& v : values) { BOOST_CHECK(copy.find(v) != copy.end()); }
+	BOOST_CHECK_EQUAL(3, copy.count_in_range({0, 500}, {2, 3000}));
+	// the top nodes split b, which spreads 10000 times more than a, unlike
+	// with cyclic_split; copies keep the dimensions
+	auto check_top = [](const auto& t, dimension_type top, dimension_type next)
+	{
+		auto dist = t.end() - t.begin();
+		auto node = root(t.begin(), dist);
+		auto o = root_offset(dist);
+		BOOST_CHECK_EQUAL(top, t.split_dimension(node));
+		BOOST_CHECK_EQUAL(next, t.split_dimension(left(node, o)));
+		BOOST_CHECK_EQUAL(next, t.split_dimension(right(node, o)));
+	};
+	std::vector<pod2> wide;
+	for (int i = 0; i < 127; ++i)
+	{ wide.push_back({std::rand() % 10, std::rand() % 100000}); }
+	kdtree<my_indexable2> cyclic(wide.begin(), wide.end());
+	check_top(cyclic, 0, 1);
+	kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>
+		spread(wide.begin(), wide.end());
+	check_top(spread, 1, 1);
+	auto spread_copy = spread;
+	check_top(spread_copy, 1, 1);
+	kdtree<my_indexable2, std::allocator<pod2>, null_type, my_variance2>
+		variance(wide.begin(), wide.end());
+	check_top(variance, 1, 1);
+	auto variance_copy = variance;
+	check_top(variance_copy, 1, 1);
+	// the squares of these differences overflow a long
+	std::vector<pod2> huge;
+	for (int i = 0; i < 127; ++i)
+	{ huge.push_back({std::rand() % 2000000000 - 1000000000, std::rand() % 1000}); }
+	kdtree<my_indexable2, std::allocator<pod2>, null_type, my_variance2>
+		huge_variance(huge.begin(), huge.end());
+	check_top(huge_variance, 0, 0);
+}
+
+template<std::size_t N> struct podn { int c[N]; };
+template<std::size_t N> struct ac_podn
+{
+	bool operator()(dimension_type d, const podn<N>& a, const podn<N>& b)
+		const noexcept
+	{ return a.c[d] < b.c[d]; }
+};
+
+template<std::size_t N>
+void check_find_dimensions()
+{
+	// K up to 4 uses the unrolled kernels, above falls back on the loops
+	typedef indexable<podn<N>, N, ac_podn<N>> my_indexablen;
+	kdtree<my_indexablen> tree;
+	std::vector<podn<N>> values(300);
+	for (auto& v : values)
+	{
+		for (std::size_t d = 0; d < N; ++d) { v.c[d] = std::rand() % 8; }
+		tree.insert(v);
+	}
+	BOOST_CHECK_EQUAL(values.size(), tree.size());
+	for (const auto& v : values)
+	{
+		auto iter = tree.find(v);
+		BOOST_REQUIRE(iter != tree.end());
+		for (std::size_t d = 0; d < N; ++d)
+		{ BOOST_CHECK_EQUAL(v.c[d], iter->value().c[d]); }
+	}
+	podn<N> missing;
+	for (std::size_t d = 0; d < N; ++d) { missing.c[d] = 8; }
+	BOOST_CHECK(tree.find(missing) == tree.end());
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_find_dimensions)
+{
+	check_find_dimensions<3>();
+	check_find_dimensions<4>();
+	check_find_dimensions<5>();
+}
+
+template<typename Tree>
+void check_find_branchless(int range)
+{
+	std::vector<pod2> values;
+	for (int i = 0; i < 500; ++i)
+	{ values.push_back({std::rand() % range, std::rand() % range}); }
+	Tree tree(values.begin(), values.end());
+	for (int i = 0; i < 100; ++i)
+	{
+		pod2 v = {std::rand() % range, std::rand() % range};
+		values.push_back(v);
+		tree.insert(v);
+	}
+	for (const pod2& v : values)
+	{
+		auto iter = tree.find(v, branchless());
+		BOOST_REQUIRE(iter != tree.end());
+		BOOST_CHECK(iter->value().a == v.a && iter->value().b == v.b);
+	}
+	std::vector<pod2> probes;
+	for (int i = 0; i < 200; ++i)
+	{
+		pod2 v = {std::rand() % (range + 2) - 1, std::rand() % (range + 2) - 1};
+		bool expect = std::any_of(values.begin(), values.end(),
+		                          [&](const pod2& x)
+		                          { return x.a == v.a && x.b == v.b; });
+		BOOST_CHECK_EQUAL(expect, tree.find(v, branchless()) != tree.end());
+		BOOST_CHECK_EQUAL(expect, tree.find(v) != tree.end());
+		probes.push_back(v);
+	}
+	values.insert(values.end(), probes.begin(), probes.end());
+	for (std::size_t group : {1u, 3u, 16u})
+	{
+		std::vector<typename Tree::const_iterator> found;
+		tree.find(values.begin(), values.end(), std::back_inserter(found),
+		          interleaved(group));
+		BOOST_REQUIRE_EQUAL(found.size(), values.size());
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			typename Tree::const_iterator expect
+				= tree.find(values[i], branchless());
+			BOOST_CHECK(found[i] == expect);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_find_branchless)
+{
+	kdtree<my_indexable2> empty;
+	BOOST_CHECK(empty.find({0, 0}, branchless()) == empty.end());
+	kdtree<my_indexable2> one({{1, 2}});
+	BOOST_CHECK(one.find({1, 2}, branchless()) == one.begin());
+	BOOST_CHECK(one.find({2, 1}, branchless()) == one.end());
+	std::vector<pod2> some = {{1, 2}, {2, 1}};
+	std::vector<kdtree<my_indexable2>::const_iterator> found;
+	empty.find(some.begin(), some.end(), std::back_inserter(found),
+	           interleaved());
+	one.find(some.begin(), some.end(), std::back_inserter(found),
+	         interleaved());
+	BOOST_REQUIRE_EQUAL(found.size(), 4u);
+	BOOST_CHECK(found[0] == empty.cend() && found[1] == empty.cend());
+	BOOST_CHECK(found[2] == one.cbegin() && found[3] == one.cend());
+	// few values lead to many ties along the path
+	check_find_branchless<kdtree<my_indexable2>>(5);
+	check_find_branchless<kdtree<my_indexable2>>(1000);
+	check_find_branchless<kdtree<my_indexable2, std::allocator<pod2>, null_type,
+	                             my_spread2>>(5);
+	check_find_branchless<kdtree<my_indexable2, std::allocator<pod2>, null_type,
+	                             my_spread2>>(1000);
+}
+
+typedef kdtree<my_indexable2, std::allocator<pod2>, null_type, cyclic_split,
+               unique_keys> unique_tree2;
+
+BOOST_AUTO_TEST_CASE(kdtree_unique_keys)
+{
+	unique_tree2 tree;
+	auto first = tree.insert({1, 2});
+	BOOST_CHECK(tree.insert({1, 2}) == first);
+	BOOST_CHECK_EQUAL(1, tree.size());
+	tree.insert({2, 1});
+	BOOST_CHECK_EQUAL(2, tree.size());
+	std::vector<pod2> values;
+	for (int i = 0; i < 500; ++i)
+	{ values.push_back({std::rand() % 10, std::rand() % 10}); }
+	unique_tree2 built(values.begin(), values.end());
+	for (const pod2& v : values) { tree.insert(v); }
+	for (const pod2& v : values)
+	{
+		BOOST_CHECK_EQUAL(1, built.count(v));
+		BOOST_CHECK_EQUAL(1, tree.count(v));
+	}
+	BOOST_CHECK(built.size() <= 100);
+	BOOST_CHECK_EQUAL(built.size(), tree.size());
+}
+
+template<typename Tree>
+void check_equal_range(const Tree& tree, const pod2& key)
+{
+	std::size_t expect = 0;
+	for (auto ref : tree)
+	{
+		if (ref.is_valid() && ref.value().a == key.a && ref.value().b == key.b)
+		{ ++expect; }
+	}
+	std::size_t found = 0;
+	auto range = tree.equal_range(key);
+	for (auto i = range.first; i != range.second; ++i)
+	{
+		BOOST_CHECK(i->value().a == key.a && i->value().b == key.b);
+		++found;
+	}
+	BOOST_CHECK_EQUAL(expect, found);
+	BOOST_CHECK_EQUAL(expect, tree.count(key));
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_equal_range)
+{
+	kdtree<my_indexable2> tree;
+	check_equal_range(tree, {0, 0});
+	// thousands of duplicates among a few other values
+	for (int i = 0; i < 3000; ++i)
+	{
+		tree.insert({5, 5});
+		if (i % 10 == 0) { tree.insert({std::rand() % 10, std::rand() % 10}); }
+	}
+	for (int a = 0; a < 10; ++a)
+	{
+		for (int b = 0; b < 10; ++b) { check_equal_range(tree, {a, b}); }
+	}
+	check_equal_range(tree, {11, 5});
+	std::size_t n = 0;
+	auto range = tree.equal_range({5, 5});
+	for (auto i = range.first; i != range.second; ++i) { ++n; }
+	BOOST_CHECK(n >= 3000);
+	std::vector<pod2> values(2000, pod2{3, 4});
+	kdtree<my_indexable2> built(values.begin(), values.end());
+	check_equal_range(built, {3, 4});
+	BOOST_CHECK_EQUAL(2000, built.count({3, 4}));
+}
+
+typedef kdtree<my_indexable2, std::allocator<pod2>,
+               quantized_keys<std::uint8_t, double, minus_pod2>> quantized_tree2;
+
+void check_quantized(const quantized_tree2& tree, const std::vector<pod2>& values)
+{
+	for (int i = 0; i < 50; ++i)
+	{
+		pod2 v = values[static_cast<std::size_t>(std::rand()) % values.size()];
+		auto found = tree.find(v);
+		BOOST_REQUIRE(found != tree.end());
+		BOOST_CHECK(found->value().a == v.a && found->value().b == v.b);
+		int a = std::rand() % 3000 - 1500, b = std::rand() % 3000 - 1500;
+		pod2 low = {a, b}, high = {a + std::rand() % 800, b + std::rand() % 800};
+		std::vector<quantized_tree2::const_iterator> in_range;
+		tree.range(low, high, std::back_inserter(in_range));
+		std::size_t count = 0;
+		for (auto ref : tree)
+		{
+			if (ref.is_valid() && low.a <= ref.value().a && ref.value().a <= high.a
+			    && low.b <= ref.value().b && ref.value().b <= high.b)
+			{ ++count; }
+		}
+		BOOST_CHECK_EQUAL(count, in_range.size());
+		for (auto it : in_range)
+		{
+			BOOST_CHECK(low.a <= it->value().a && it->value().a <= high.a
+			            && low.b <= it->value().b && it->value().b <= high.b);
+		}
+	}
+	BOOST_CHECK(tree.find({5000, 5000}) == tree.end());
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_quantized_keys)
+{
+	quantized_tree2 tree;
+	std::vector<pod2> values;
+	for (int i = 0; i < 1000; ++i)
+	{
+		// later values fall outside the range of the keys more often
+		int spread = 100 + 2 * i;
+		values.push_back({std::rand() % spread - spread / 2,
+		                  std::rand() % spread - spread / 2});
+		tree.insert(values.back());
+	}
+	check_quantized(tree, values);
+	BOOST_CHECK(tree.augmentation().visited() > 0);
+	BOOST_CHECK(tree.augmentation().refinements() > 0);
+	BOOST_CHECK(tree.augmentation().refinements()
+	            < tree.augmentation().visited());
+	tree.augmentation().reset_counts();
+	BOOST_CHECK_EQUAL(0, tree.augmentation().visited());
+	quantized_tree2 built(values.begin(), values.end());
+	check_quantized(built, values);
+	quantized_tree2 copy(tree);
+	check_quantized(copy, values);
+}
+
+typedef kdtree<my_indexable2, std::allocator<pod2>, null_type, cyclic_split,
+               duplicate_keys, count_operations> counted_tree2;
+
+BOOST_AUTO_TEST_CASE(kdtree_count_operations)
+{
+	kdtree<my_indexable2> plain;
+	counted_tree2 tree;
+	operation_counts none = tree.operations();
+	BOOST_CHECK_EQUAL(0, none.visited + none.comparisons + none.relocations
+	                  + none.extrema + none.expansions);
+	std::vector<pod2> values;
+	for (int i = 0; i < 300; ++i)
+	{
+		values.push_back({i, 300 - i}); // sorted, to force relocations
+		tree.insert(values.back());
+		plain.insert(values.back());
+	}
+	operation_counts inserted = tree.operations();
+	BOOST_CHECK(inserted.comparisons > 0);
+	BOOST_CHECK(inserted.relocations > 0);
+	BOOST_CHECK(inserted.extrema > 0);
+	BOOST_CHECK(inserted.expansions > 0);
+	for (const pod2& v : values)
+	{
+		operation_counts before = tree.operations();
+		auto found = tree.find(v);
+		operation_counts query = tree.operations() - before;
+		BOOST_REQUIRE(found != tree.end());
+		BOOST_CHECK(found->value().a == v.a && found->value().b == v.b);
+		BOOST_CHECK(query.visited > 0);
+		BOOST_CHECK(query.comparisons >= query.visited);
+		BOOST_CHECK_EQUAL(0, query.relocations + query.extrema + query.expansions);
+	}
+	std::vector<counted_tree2::const_iterator> counted;
+	std::vector<kdtree<my_indexable2>::const_iterator> expected;
+	tree.range({10, 10}, {200, 200}, std::back_inserter(counted));
+	plain.range({10, 10}, {200, 200}, std::back_inserter(expected));
+	BOOST_CHECK_EQUAL(expected.size(), counted.size());
+	my_quadrance2 metric;
+	operation_counts before = tree.operations();
+	BOOST_CHECK(tree.nearest({50, 50}, metric)->value().a
+	            == plain.nearest({50, 50}, metric)->value().a);
+	BOOST_CHECK((tree.operations() - before).visited > 0);
+	tree.reset_operations();
+	BOOST_CHECK_EQUAL(0, tree.operations().visited);
+	BOOST_CHECK_EQUAL(0, plain.operations().comparisons);
+}
+
+template<typename Tree>
+void check_stats(const Tree& tree)
+{
+	tree_stats s = tree.stats();
+	BOOST_CHECK_EQUAL(tree.size(), s.size);
+	BOOST_CHECK_EQUAL(static_cast<std::size_t>(tree.end() - tree.begin()),
+	                  s.slots);
+	BOOST_CHECK_EQUAL(s.slots, s.size + s.erased + s.invalid);
+	BOOST_CHECK_EQUAL(tree.tombstones(), s.erased);
+	BOOST_CHECK_EQUAL(s.size + s.erased, s.full + s.free + s.mixed);
+	BOOST_CHECK_EQUAL(s.height, s.occupancy.size());
+	std::size_t sum = 0;
+	for (std::size_t level = 0; level < s.occupancy.size(); ++level)
+	{
+		BOOST_CHECK(s.occupancy[level] <= (std::size_t(1) << level));
+		sum += s.occupancy[level];
+	}
+	BOOST_CHECK_EQUAL(s.size + s.erased, sum);
+	BOOST_CHECK(s.optimal_depth() <= s.depth && s.depth <= s.height);
+	BOOST_CHECK(0.0 <= s.imbalance && s.imbalance <= 1.0);
+	BOOST_CHECK(0.0 <= s.root_imbalance && s.root_imbalance <= 1.0);
+	BOOST_CHECK(s.load_factor() <= 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_stats)
+{
+	kdtree<my_indexable2> empty;
+	tree_stats none = empty.stats();
+	BOOST_CHECK_EQUAL(0, none.size + none.slots + none.height + none.depth);
+	BOOST_CHECK_EQUAL(0.0, none.invalid_fraction());
+	std::vector<pod2> values;
+	for (int i = 0; i < 127; ++i)
+	{ values.push_back({std::rand() % 1000, std::rand() % 1000}); }
+	// a complete tree has no invalid slot and no imbalance
+	kdtree<my_indexable2> complete(values.begin(), values.end());
+	tree_stats s = complete.stats();
+	check_stats(complete);
+	BOOST_CHECK_EQUAL(0, s.invalid);
+	BOOST_CHECK_EQUAL(7, s.depth);
+	BOOST_CHECK_EQUAL(7, s.optimal_depth());
+	BOOST_CHECK_EQUAL(127, s.full);
+	BOOST_CHECK_EQUAL(0.0, s.imbalance);
+	BOOST_CHECK_EQUAL(64, s.occupancy[6]);
+	kdtree<my_indexable2> tree;
+	for (int i = 0; i < 200; ++i)
+	{
+		tree.insert({i, i});
+		check_stats(tree);
+	}
+	values.resize(100);
+	kdtree<my_indexable2> partial(values.begin(), values.end());
+	check_stats(partial);
+	BOOST_CHECK(partial.stats().invalid_fraction() > 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_rebuild)
+{
+	counted_tree2 tree;
+	counted_tree2 never;
+	never.rebuild_factor(0.0);
+	BOOST_CHECK_EQUAL(counted_tree2::default_rebuild_factor(),
+	                  tree.rebuild_factor());
+	BOOST_CHECK_EQUAL(0.0, never.rebuild_factor());
+	std::vector<pod2> values;
+	for (int i = 0; i < 2000; ++i)
+	{
+		values.push_back({i, i}); // sorted, the worst order for inserts
+		tree.insert(values.back());
+		never.insert(values.back());
+	}
+	BOOST_CHECK(tree.operations().rebuilds > 0);
+	BOOST_CHECK_EQUAL(0, never.operations().rebuilds);
+	BOOST_CHECK(tree.operations().relocations
+	            < never.operations().relocations);
+	BOOST_CHECK_EQUAL(values.size(), tree.size());
+	check_stats(tree);
+	for (const pod2& v : values)
+	{
+		auto found = tree.find(v);
+		BOOST_REQUIRE(found != tree.end());
+		BOOST_CHECK(found->value().a == v.a && found->value().b == v.b);
+	}
+	counted_tree2 copy(tree);
+	BOOST_CHECK_EQUAL(tree.rebuild_factor(), copy.rebuild_factor());
+	copy.rebuild();
+	BOOST_CHECK_EQUAL(values.size(), copy.size());
+	// the root splits the values in halves
+	BOOST_CHECK(copy.stats().root_imbalance
+	            < 2.0 / static_cast<double>(values.size()));
+	for (const pod2& v : values) { BOOST_CHECK(copy.find(v) != copy.end()); }
+	counted_tree2 empty;
+	empty.rebuild();
+	BOOST_CHECK(empty.begin() == empty.end());
+}
+
+template<typename Tree>
+void erase_random(Tree& tree, std::size_t n, int range, int shift = 0)
+{ for (const pod2& v : random_values(n, range, shift)) { tree.erase(v); } }
+
+template<typename Tree>
+std::vector<pod2> live_values(const Tree& tree)
+{
+	std::vector<pod2> live;
+	for (auto i = tree.cbegin(); i != tree.cend(); ++i)
+	{ if (i->is_valid() && !tree.erased(i)) { live.push_back(i->value()); } }
+	return live;
+}
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>,
+	 kdtree<my_indexable2, std::allocator<pod2>,
+	        aggregate_cache<details::count_monoid>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>>
+	tombstone_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_tombstones_queries, Tree, tombstone_trees2)
+{
+	const std::size_t n = 300;
+	std::vector<pod2> values = random_values(n, 100);
+	Tree tree;
+	for (const pod2& v : values) { tree.insert(v); }
+	// erased values keep their nodes until they are compacted
+	auto check_nodes = [&tree]()
+	{
+		tree_stats s = tree.stats();
+		BOOST_CHECK_EQUAL(tree.tombstones(), s.erased);
+		BOOST_CHECK_EQUAL(tree.size() + tree.tombstones(), s.slots - s.invalid);
+		check_stats(tree);
+	};
+	auto check_live = [&tree]()
+	{
+		std::vector<pod2> live = live_values(tree);
+		BOOST_REQUIRE_EQUAL(tree.size(), live.size());
+		check_queries(tree, live, {100, 100}, {30, 30});
+		for (const pod2& v : live)
+		{
+			auto found = tree.find(v);
+			BOOST_REQUIRE(found != tree.end());
+			BOOST_CHECK(!tree.erased(found));
+		}
+		// browsing visits each live value once
+		my_quadrance2 metric;
+		std::size_t j = 0;
+		for (auto it = tree.nearest_begin({50, 50}, metric);
+		     it != tree.nearest_end({50, 50}, metric) && j <= live.size(); ++it, ++j)
+		{ }
+		BOOST_CHECK_EQUAL(live.size(), j);
+	};
+	// erase about half of the values, by value then by iterator
+	std::size_t erased = 0;
+	for (std::size_t i = 0; i < n / 4; ++i)
+	{ erased += tree.erase(values[static_cast<std::size_t>(std::rand()) % n]); }
+	for (std::size_t i = 0; i < n / 4; ++i)
+	{
+		auto found = tree.find(values[static_cast<std::size_t>(std::rand()) % n]);
+		if (found != tree.end()) { tree.erase(found); ++erased; }
+	}
+	BOOST_CHECK_EQUAL(n - erased, tree.size());
+	BOOST_CHECK_EQUAL(erased, tree.tombstones());
+	check_nodes();
+	check_live();
+	// inserts reuse the tree as it is
+	for (const pod2& v : random_values(n / 4, 100)) { tree.insert(v); }
+	BOOST_CHECK_EQUAL(n - erased + n / 4, tree.size());
+	check_nodes();
+	check_live();
+	// each step frees the nodes of the values it removes
+	std::size_t size = tree.size();
+	std::size_t before = tree.tombstones();
+	for (int i = 0; i < 20 && tree.tombstones() != 0; ++i)
+	{
+		std::size_t removed = tree.compact(64);
+		BOOST_CHECK_EQUAL(before - removed, tree.tombstones());
+		before = tree.tombstones();
+		BOOST_CHECK_EQUAL(size, tree.size());
+		check_nodes();
+	}
+	check_live();
+	tree.compact();
+	BOOST_CHECK_EQUAL(0, tree.tombstones());
+	BOOST_CHECK_EQUAL(0.0, tree.stats().erased_fraction());
+	BOOST_CHECK_EQUAL(size, tree.size());
+	check_nodes();
+	check_live();
+	// a tree whose only value is erased
+	Tree one;
+	one.insert({1, 1});
+	BOOST_CHECK_EQUAL(1, one.erase(pod2{1, 1}));
+	BOOST_CHECK(one.empty());
+	BOOST_CHECK(one.find({1, 1}) == one.end());
+	BOOST_CHECK_EQUAL(0, one.count_in_range({0, 0}, {2, 2}));
+	one.compact();
+	BOOST_CHECK_EQUAL(0, one.tombstones());
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_erase_tombstones)
+{
+	kdtree<my_indexable2> tree;
+	for (int i = 0; i < 100; ++i) { tree.insert({i, i}); }
+	for (int i = 0; i < 100; i += 2) { BOOST_CHECK_EQUAL(1, tree.erase(pod2{i, i})); }
+	BOOST_CHECK_EQUAL(0, tree.erase(pod2{0, 0}));
+	kdtree<my_indexable2> copy(tree);
+	BOOST_CHECK_EQUAL(50, copy.tombstones());
+	BOOST_CHECK(copy.find({2, 2}) == copy.end());
+	BOOST_CHECK(copy.find({3, 3}) != copy.end());
+	// a compact ratio of 1 only rebuilds sub-trees where all values are erased
+	copy.compact_ratio(1.0);
+	copy.compact(16);
+	BOOST_CHECK_EQUAL(50, copy.tombstones());
+	copy.compact();
+	BOOST_CHECK_EQUAL(0, copy.tombstones());
+	BOOST_CHECK_EQUAL(50, copy.size());
+	for (int i = 1; i < 100; i += 2) { BOOST_CHECK(copy.find({i, i}) != copy.end()); }
+	// erased values leave the cached aggregates, which stay in use
+	kdtree<my_indexable2, std::allocator<pod2>,
+	       aggregate_cache<details::count_monoid>, cyclic_split, duplicate_keys,
+	       count_operations> cached;
+	for (int i = 0; i < 127; ++i) { cached.insert({i, i}); }
+	operation_counts before = cached.operations();
+	BOOST_CHECK_EQUAL(127, cached.count_in_range({0, 0}, {126, 126}));
+	std::size_t visited = (cached.operations() - before).visited;
+	for (int i = 0; i < 127; i += 3) { cached.erase(pod2{i, i}); }
+	before = cached.operations();
+	BOOST_CHECK_EQUAL(84, cached.count_in_range({0, 0}, {126, 126}));
+	BOOST_CHECK_EQUAL(visited, (cached.operations() - before).visited);
+}
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, aggregate_cache<sum_a>>,
+	 kdtree<my_indexable2, std::allocator<pod2>,
+	        aggregate_cache<details::count_monoid>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>,
+	 quantized_tree2> update_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_update_queries, Tree, update_trees2)
+{
+	const std::size_t n = 500;
+	std::vector<pod2> values = random_values(n, 1000);
+	Tree tree;
+	for (const pod2& v : values) { tree.insert(v); }
+	// small moves, then moves far enough to leave their sub-trees
+	for (int step : {5, 500})
+	{
+		for (int i = 0; i < 1000; ++i)
+		{
+			pod2& v = values[static_cast<std::size_t>(std::rand()) % n];
+			auto pos = tree.find(v);
+			BOOST_REQUIRE(pos != tree.end());
+			v.a += std::rand() % (2 * step + 1) - step;
+			v.b += std::rand() % (2 * step + 1) - step;
+			auto moved = tree.update(pos, v);
+			BOOST_REQUIRE(moved != tree.end());
+			BOOST_CHECK(moved->value().a == v.a && moved->value().b == v.b);
+		}
+		BOOST_CHECK_EQUAL(n, tree.size());
+		// values that move too far are erased, and compacted as they accumulate
+		BOOST_CHECK(static_cast<double>(tree.tombstones())
+		            <= 2 * tree.compact_ratio() * static_cast<double>(n) + 1);
+		check_stats(tree);
+		for (const pod2& v : values) { BOOST_CHECK(tree.find(v) != tree.end()); }
+		check_queries(tree, values, {1000, 1000}, {300, 300});
+	}
+	Tree one;
+	auto only = one.insert({1, 1});
+	auto moved = one.update(only, {900, 900});
+	BOOST_CHECK_EQUAL(1, one.size());
+	BOOST_CHECK(moved == one.find({900, 900}));
+	BOOST_CHECK(one.find({1, 1}) == one.end());
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_update)
+{
+	// small moves are mostly written in place
+	counted_tree2 tree;
+	for (int i = 0; i < 1000; ++i) { tree.insert({i, (i * 37) % 1000}); }
+	for (int i = 0; i < 1000; ++i)
+	{
+		pod2 v = {i, (i * 37) % 1000};
+		tree.update(tree.find(v), {v.a, v.b + 1});
+	}
+	BOOST_CHECK(tree.operations().updates > 500);
+	BOOST_CHECK(tree.tombstones() <= 1000 - tree.operations().updates);
+	// with unique keys, moving onto another value erases the moved one
+	unique_tree2 unique;
+	unique.insert({1, 1});
+	auto other = unique.insert({2, 2});
+	auto kept = unique.update(unique.find({1, 1}), {2, 2});
+	BOOST_CHECK(kept == other);
+	BOOST_CHECK_EQUAL(1, unique.size());
+	BOOST_CHECK(unique.find({1, 1}) == unique.end());
+	BOOST_CHECK(unique.update(kept, {3, 3}) == kept);
+	BOOST_CHECK(unique.find({3, 3}) == kept);
+}
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>,
+	 counted_tree2> parallel_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_parallel_queries, Tree, parallel_trees2)
+{
+	Tree empty;
+	std::vector<typename Tree::const_iterator> none;
+	empty.parallel_range({0, 0}, {1, 1}, std::back_inserter(none));
+	empty.parallel_nearest({0, 0}, 3, my_quadrance2(), std::back_inserter(none));
+	BOOST_CHECK(none.empty());
+	my_quadrance2 metric;
+	auto by_position = [](typename Tree::const_iterator a,
+	                      typename Tree::const_iterator b) { return a - b < 0; };
+	for (std::size_t n : {std::size_t(1), std::size_t(3000)})
+	{
+		Tree tree;
+		for (const pod2& v : random_values(n, 1000)) { tree.insert(v); }
+		erase_random(tree, n / 10, 1000);
+		// the threads find what a single one does, whatever the depth at which
+		// sub-trees are handed out, from the root to below the leaves
+		for (int i = 0; i < 20; ++i)
+		{
+			pod2 low = {std::rand() % 1000, std::rand() % 1000};
+			pod2 high = {low.a + std::rand() % 500, low.b + std::rand() % 500};
+			std::vector<typename Tree::const_iterator> expect;
+			tree.range(low, high, std::back_inserter(expect));
+			std::sort(expect.begin(), expect.end(), by_position);
+			for (unsigned threads : {1u, 3u, 8u})
+			{
+				for (std::size_t depth : {std::size_t(0), std::size_t(1),
+				                          std::size_t(5), std::size_t(40)})
+				{
+					std::vector<typename Tree::const_iterator> found;
+					tree.parallel_range(low, high, std::back_inserter(found), threads,
+					                    depth);
+					std::sort(found.begin(), found.end(), by_position);
+					BOOST_CHECK(expect == found);
+					std::size_t k = std::min(tree.size(), std::size_t(10));
+					std::vector<typename Tree::const_iterator> near, pnear;
+					tree.nearest(low, k, metric, std::back_inserter(near));
+					tree.parallel_nearest(low, k, metric, std::back_inserter(pnear),
+					                      threads, depth);
+					BOOST_REQUIRE_EQUAL(near.size(), pnear.size());
+					for (std::size_t j = 0; j < near.size(); ++j)
+					{
+						BOOST_CHECK_EQUAL(metric.distance_to_key(low, near[j]->value()),
+						                  metric.distance_to_key(low, pnear[j]->value()));
+						BOOST_CHECK(!tree.erased(pnear[j]));
+					}
+					// the candidates of the workers are merged without repeats
+					std::sort(pnear.begin(), pnear.end(), by_position);
+					BOOST_CHECK(std::adjacent_find(pnear.begin(), pnear.end())
+					            == pnear.end());
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_knn_join_queries, Tree, parallel_trees2)
+{
+	// k nearest neighbors for each slot of queries, and the end of the
+	// other tree for slots without a live value, or past the values found
+	for (auto sizes : {std::make_pair(std::size_t(1), std::size_t(1)),
+	                   std::make_pair(std::size_t(2000), std::size_t(5)),
+	                   std::make_pair(std::size_t(2000), std::size_t(3000))})
+	{
+		std::size_t n = sizes.first, m = sizes.second;
+		Tree queries, reference;
+		for (const pod2& v : random_values(n, 1000)) { queries.insert(v); }
+		for (const pod2& v : random_values(m, 1000)) { reference.insert(v); }
+		erase_random(queries, n / 10, 1000);
+		erase_random(reference, m / 10, 1000);
+		my_quadrance2 metric;
+		std::size_t slots
+			= static_cast<std::size_t>(queries.end() - queries.begin());
+		for (std::size_t k : {std::size_t(1), std::size_t(4), std::size_t(9)})
+		{
+			for (unsigned threads : {1u, 3u})
+			{
+				std::vector<typename Tree::const_iterator> join(k * slots);
+				std::vector<typename Tree::const_iterator> self(k * slots);
+				BOOST_CHECK(queries.knn_join(reference, k, metric, join.begin(),
+				                             threads) == join.end());
+				BOOST_CHECK(queries.self_knn(k, metric, self.begin(), threads)
+				            == self.end());
+				for (auto q = queries.cbegin(); q != queries.cend(); ++q)
+				{
+					std::size_t row
+						= static_cast<std::size_t>(q - queries.cbegin()) * k;
+					if (!q->is_valid() || queries.erased(q))
+					{
+						for (std::size_t j = 0; j < k; ++j)
+						{
+							BOOST_CHECK(join[row + j] == reference.cend());
+							BOOST_CHECK(self[row + j] == queries.cend());
+						}
+						continue;
+					}
+					std::vector<typename Tree::const_iterator> expect;
+					reference.nearest(q->value(), k, metric,
+					                  std::back_inserter(expect));
+					expect.resize(k, reference.cend());
+					for (std::size_t j = 0; j < k; ++j)
+					{
+						BOOST_REQUIRE((join[row + j] == reference.cend())
+						              == (expect[j] == reference.cend()));
+						if (expect[j] == reference.cend()) { continue; }
+						BOOST_CHECK_EQUAL
+							(metric.distance_to_key(q->value(), join[row + j]->value()),
+							 metric.distance_to_key(q->value(), expect[j]->value()));
+						BOOST_CHECK(!reference.erased(join[row + j]));
+					}
+					const pod2* self_value = &q->value();
+					expect.clear();
+					queries.nearest_if(q->value(), k, metric,
+					                   [self_value](const pod2& v)
+					                   { return &v != self_value; },
+					                   std::back_inserter(expect));
+					expect.resize(k, queries.cend());
+					for (std::size_t j = 0; j < k; ++j)
+					{
+						BOOST_REQUIRE((self[row + j] == queries.cend())
+						              == (expect[j] == queries.cend()));
+						if (expect[j] == queries.cend()) { continue; }
+						BOOST_CHECK(self[row + j] != q);
+						BOOST_CHECK_EQUAL
+							(metric.distance_to_key(q->value(), self[row + j]->value()),
+							 metric.distance_to_key(q->value(), expect[j]->value()));
+					}
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_knn_join)
+{
+	kdtree<my_indexable2> empty, one;
+	one.insert({1, 1});
+	std::vector<kdtree<my_indexable2>::const_iterator> found(2);
+	BOOST_CHECK(one.knn_join(empty, 2, my_quadrance2(), found.begin())
+	            == found.end());
+	BOOST_CHECK(found[0] == empty.cend() && found[1] == empty.cend());
+	BOOST_CHECK(one.self_knn(2, my_quadrance2(), found.begin()) == found.end());
+	BOOST_CHECK(found[0] == one.cend() && found[1] == one.cend());
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_radius_join_queries, Tree, parallel_trees2)
+{
+	using const_iterator = typename Tree::const_iterator;
+	using pair_type = std::pair<const_iterator, const_iterator>;
+	// a shifted reference gives nearly disjoint sets, where most query
+	// sub-trees are skipped
+	for (auto sizes : {std::make_tuple(std::size_t(1), std::size_t(1), 0),
+	                   std::make_tuple(std::size_t(700), std::size_t(5), 0),
+	                   std::make_tuple(std::size_t(700), std::size_t(900), 0),
+	                   std::make_tuple(std::size_t(700), std::size_t(900), 980)})
+	{
+		std::size_t n = std::get<0>(sizes), m = std::get<1>(sizes);
+		int shift = std::get<2>(sizes);
+		Tree queries, reference;
+		for (const pod2& v : random_values(n, 1000)) { queries.insert(v); }
+		for (const pod2& v : random_values(m, 1000, shift))
+		{ reference.insert(v); }
+		erase_random(queries, n / 10, 1000);
+		erase_random(reference, m / 10, 1000, shift);
+		my_quadrance2 metric;
+		auto by_position = [&](const pair_type& a, const pair_type& b)
+		{
+			return a.first - b.first < 0
+				|| (a.first == b.first && a.second - b.second < 0);
+		};
+		for (int radius : {0, 100, 2500})
+		{
+			std::vector<pair_type> expect;
+			for (auto q = queries.cbegin(); q != queries.cend(); ++q)
+			{
+				if (!q->is_valid() || queries.erased(q)) { continue; }
+				std::vector<const_iterator> within;
+				reference.within_radius(q->value(), radius, metric,
+				                        std::back_inserter(within));
+				std::size_t brute = 0;
+				for (auto r = reference.cbegin(); r != reference.cend(); ++r)
+				{
+					if (!r->is_valid() || reference.erased(r)
+					    || metric.distance_to_key(q->value(), r->value())
+					       > radius)
+					{ continue; }
+					expect.push_back(pair_type(q, r));
+					++brute;
+				}
+				BOOST_CHECK_EQUAL(within.size(), brute);
+			}
+			std::sort(expect.begin(), expect.end(), by_position);
+			for (unsigned threads : {1u, 3u})
+			{
+				for (std::size_t batch : {std::size_t(1), std::size_t(7),
+				                          std::size_t(1024)})
+				{
+					std::vector<pair_type> found;
+					std::size_t calls = 0;
+					auto sink = [&](const pair_type* first,
+					                const pair_type* last)
+					{
+						BOOST_CHECK(first != last);
+						BOOST_CHECK(static_cast<std::size_t>(last - first)
+						            <= batch);
+						found.insert(found.end(), first, last);
+						++calls;
+					};
+					std::size_t pairs = (threads == 1)
+						? queries.radius_join(reference, radius, metric, sink,
+						                      batch)
+						: queries.parallel_radius_join(reference, radius, metric,
+						                               sink, threads, batch);
+					BOOST_CHECK_EQUAL(pairs, found.size());
+					BOOST_CHECK(calls >= (found.size() + batch - 1) / batch);
+					std::sort(found.begin(), found.end(), by_position);
+					BOOST_CHECK(expect == found);
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_radius_join)
+{
+	kdtree<my_indexable2> empty, one;
+	one.insert({1, 1});
+	auto never = [](const std::pair<kdtree<my_indexable2>::const_iterator,
+	                                kdtree<my_indexable2>::const_iterator>*,
+	                const std::pair<kdtree<my_indexable2>::const_iterator,
+	                                kdtree<my_indexable2>::const_iterator>*)
+	{ BOOST_ERROR("unexpected batch"); };
+	BOOST_CHECK_EQUAL(one.radius_join(empty, 10, my_quadrance2(), never), 0u);
+	BOOST_CHECK_EQUAL(empty.radius_join(one, 10, my_quadrance2(), never), 0u);
+	std::size_t self = 0;
+	one.radius_join(one, 0, my_quadrance2(),
+	                [&](const std::pair<kdtree<my_indexable2>::const_iterator,
+	                                    kdtree<my_indexable2>::const_iterator>* f,
+	                    const std::pair<kdtree<my_indexable2>::const_iterator,
+	                                    kdtree<my_indexable2>::const_iterator>* l)
+	                { self += static_cast<std::size_t>(l - f); });
+	BOOST_CHECK_EQUAL(self, 1u);
+}
+
+typedef boost::mpl::list
+	<kdtree<my_indexable2>,
+	 kdtree<my_indexable2, std::allocator<pod2>, box_cache<>>,
+	 kdtree<my_indexable2, std::allocator<pod2>,
+	        aggregate_cache<details::count_monoid>>,
+	 kdtree<my_indexable2, std::allocator<pod2>, null_type, my_spread2>,
+	 counted_tree2> parallel_insert_trees2;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(kdtree_parallel_insert_queries, Tree,
+                              parallel_insert_trees2)
+{
+	// batches within [0, spread) fill a few sub-trees only
+	for (auto sizes : {std::make_tuple(std::size_t(0), std::size_t(100), 1000),
+	                   std::make_tuple(std::size_t(3000), std::size_t(300), 1000),
+	                   std::make_tuple(std::size_t(3000), std::size_t(300), 50),
+	                   std::make_tuple(std::size_t(3000), std::size_t(1500), 1000),
+	                   std::make_tuple(std::size_t(100), std::size_t(1000), 1000)})
+	{
+		std::size_t n = std::get<0>(sizes), m = std::get<1>(sizes);
+		int spread = std::get<2>(sizes);
+		Tree tree;
+		for (const pod2& v : random_values(n, 1000)) { tree.insert(v); }
+		erase_random(tree, n / 10, 1000);
+		for (unsigned threads : {1u, 3u})
+		{
+			for (std::size_t depth : {std::size_t(0), std::size_t(1),
+			                          std::size_t(40)})
+			{
+				std::vector<pod2> batch = random_values(m, spread);
+				std::size_t size = tree.size();
+				std::size_t slots = tree.stats().slots;
+				BOOST_CHECK_EQUAL(m, tree.parallel_insert(batch.begin(),
+				                                          batch.end(),
+				                                          threads, depth));
+				BOOST_CHECK_EQUAL(size + m, tree.size());
+				check_stats(tree);
+				// a batch that neither fits nor is outnumbered by the tree
+				// rebuilds it, with no tombstone and no extra level
+				if (m > slots && m >= size)
+				{
+					tree_stats s = tree.stats();
+					BOOST_CHECK_EQUAL(0, s.erased);
+					BOOST_CHECK_EQUAL(s.optimal_depth(), s.depth);
+				}
+				check_queries(tree, live_values(tree), {1000, 1000},
+				              {500, 500});
+			}
+		}
+		// inserts and erases go on from the tree as it is
+		for (const pod2& v : random_values(m, 1000)) { tree.insert(v); }
+		std::vector<pod2> values = live_values(tree);
+		for (const pod2& v : values) { BOOST_CHECK(tree.find(v) != tree.end()); }
+		for (const pod2& v : values) { tree.erase(v); }
+		BOOST_CHECK_EQUAL(0, tree.size());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(kdtree_parallel_insert)
+{
+	kdtree<my_indexable2> tree;
+	std::vector<pod2> none;
+	BOOST_CHECK_EQUAL(0, tree.parallel_insert(none.begin(), none.end(), 3));
+	BOOST_CHECK(tree.empty());
+	unique_tree2 unique;
+	std::vector<pod2> batch = {{1, 1}, {2, 2}, {1, 1}, {3, 3}};
+	BOOST_CHECK_EQUAL(3, unique.parallel_insert(batch.begin(), batch.end(), 3));
+	for (int i = 4; i < 1000; ++i) { unique.insert({i, i}); }
+	batch = {{1, 1}, {1000, 1000}, {1000, 1000}, {500, 0}};
+	BOOST_CHECK_EQUAL(2, unique.parallel_insert(batch.begin(), batch.end(), 3));
+	BOOST_CHECK_EQUAL(1001, unique.size());
+	BOOST_CHECK_EQUAL(1, unique.count({1000, 1000}));
+}
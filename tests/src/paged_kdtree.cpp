@@ -0,0 +1,227 @@
+/**
+ *  Uses Boost.Test; needs to be compiled with -lboost_unit_test_framework and
+ *  to run it you must have compiled the Boost unit test framework as a shared
+ *  library (DLL - for Windows developers). If you do not have the shared
+ *  library at your disposal, you can remove all occurrences of
+ *  BOOST_TEST_DYN_LINK, and the library will be linked with the static
+ *  library. This still requires that you have compiled the Boost unit test
+ *  framework as a static library.
+ */
+
+#include <cstdlib> // std::rand()
+#include <cstdio> // std::remove()
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "../../include/paged_kdtree.hpp"
+using namespace kdtree_index;
+
+namespace
+{
+	struct point { int x; int y; };
+	struct ac_point
+	{
+		bool operator()(dimension_type d, const point& a, const point& b)
+			const noexcept
+		{ return (d == 0) ? a.x < b.x : a.y < b.y; }
+	};
+	struct minus_point
+	{
+		long operator()(dimension_type d, const point& a, const point& b)
+			const noexcept
+		{ return (d == 0) ? long(a.x) - long(b.x) : long(a.y) - long(b.y); }
+	};
+	typedef indexable<point, 2, ac_point> point_indexable;
+	typedef quadrance<point_indexable, long, minus_point> point_quadrance;
+
+	struct single { int a; };
+	struct ac_single
+	{
+		bool operator()(dimension_type, const single& a, const single& b)
+			const noexcept
+		{ return a.a < b.a; }
+	};
+
+	const char* const paged_file = "paged_kdtree_test.bin";
+
+	bool less_point(const point& a, const point& b)
+	{ return a.x < b.x || (a.x == b.x && a.y < b.y); }
+
+	// fails like an io_uring that can no longer be entered, after a few waits
+	struct failing_reader : details::pread_reader
+	{
+		explicit failing_reader(unsigned depth)
+			: details::pread_reader(depth), waits() { }
+
+		template<typename Completed>
+		void wait(Completed completed)
+		{
+			if (++waits > 3)
+			{ throw std::system_error(EIO, std::generic_category(), "wait"); }
+			details::pread_reader::wait(completed);
+		}
+
+		int waits;
+	};
+}
+
+BOOST_AUTO_TEST_CASE(paged_kdtree_queries)
+{
+	kdtree<point_indexable> tree;
+	for (int i = 0; i < 3000; ++i)
+	{ tree.insert({std::rand() % 1000, std::rand() % 1000}); }
+	write_paged(tree, paged_file, 256);
+	{
+		paged_kdtree<point_indexable> paged(paged_file, 4);
+		BOOST_CHECK_EQUAL(tree.size(), paged.size());
+		BOOST_CHECK(paged.page_elements() > 1);
+		BOOST_CHECK(paged.resident_elements() > 0);
+		BOOST_CHECK_EQUAL(4, paged.cache_pages());
+		for (int i = 0; i < 100; ++i)
+		{
+			point q = {std::rand() % 1000, std::rand() % 1000};
+			point found = {-1, -1};
+			bool in_tree = tree.find(q) != tree.end();
+			BOOST_CHECK_EQUAL(in_tree, paged.find(q, found));
+			if (in_tree) { BOOST_CHECK(found.x == q.x && found.y == q.y); }
+			BOOST_CHECK_EQUAL(in_tree, paged.contains(q));
+			point high = {q.x + std::rand() % 200, q.y + std::rand() % 200};
+			std::vector<kdtree<point_indexable>::iterator> expect_it;
+			tree.range(q, high, std::back_inserter(expect_it));
+			std::vector<point> expect, actual;
+			for (auto it : expect_it) { expect.push_back(it->value()); }
+			paged.range(q, high, std::back_inserter(actual));
+			std::sort(expect.begin(), expect.end(), less_point);
+			std::sort(actual.begin(), actual.end(), less_point);
+			BOOST_REQUIRE_EQUAL(expect.size(), actual.size());
+			for (std::size_t j = 0; j < expect.size(); ++j)
+			{
+				BOOST_CHECK(expect[j].x == actual[j].x
+				            && expect[j].y == actual[j].y);
+			}
+			std::vector<kdtree<point_indexable>::iterator> near_it;
+			std::vector<point> near;
+			tree.nearest(q, 5, point_quadrance(), std::back_inserter(near_it));
+			paged.nearest(q, 5, point_quadrance(), std::back_inserter(near));
+			BOOST_REQUIRE_EQUAL(near_it.size(), near.size());
+			for (std::size_t j = 0; j < near.size(); ++j)
+			{
+				BOOST_CHECK_EQUAL
+					(point_quadrance().distance_to_key(q, near_it[j]->value()),
+					 point_quadrance().distance_to_key(q, near[j]));
+			}
+		}
+		const page_cache_stats& stats = paged.stats();
+		BOOST_CHECK_EQUAL(400, stats.queries);
+		BOOST_CHECK(stats.misses > 0);
+		BOOST_CHECK(stats.hits > 0);
+		BOOST_CHECK(stats.bytes_read >= stats.misses * paged.page_elements());
+		BOOST_CHECK(stats.hit_rate() > 0.0 && stats.hit_rate() < 1.0);
+		paged.reset_stats();
+		BOOST_CHECK_EQUAL(0, paged.stats().queries);
+	}
+	std::remove(paged_file);
+}
+
+BOOST_AUTO_TEST_CASE(paged_kdtree_small)
+{
+	typedef indexable<single, 1, ac_single> single_indexable;
+	kdtree<single_indexable> tree;
+	write_paged(tree, paged_file);
+	{
+		paged_kdtree<single_indexable> paged(paged_file);
+		BOOST_CHECK(paged.empty());
+		BOOST_CHECK(!paged.contains({1}));
+	}
+	tree.insert({1});
+	write_paged(tree, paged_file);
+	{
+		paged_kdtree<single_indexable> paged(paged_file);
+		BOOST_CHECK_EQUAL(1, paged.size());
+		BOOST_CHECK(paged.contains({1}));
+		BOOST_CHECK(!paged.contains({2}));
+		BOOST_CHECK_THROW(paged_kdtree<point_indexable> other(paged_file),
+		                  std::runtime_error);
+	}
+	tree.insert({2});
+	tree.erase(single{1});
+	write_paged(tree, paged_file);
+	{
+		paged_kdtree<single_indexable> paged(paged_file);
+		BOOST_CHECK_EQUAL(1, paged.size());
+		BOOST_CHECK(!paged.contains({1}));
+		BOOST_CHECK(paged.contains({2}));
+	}
+	std::remove(paged_file);
+	BOOST_CHECK_THROW(paged_kdtree<single_indexable> missing(paged_file),
+	                  std::system_error);
+}
+
+template<typename Reader>
+void check_contains_batch(const char* path, const std::vector<point>& queries,
+                          std::size_t cache_pages, std::size_t window)
+{
+	paged_kdtree<point_indexable> paged(path, cache_pages);
+	std::vector<bool> expect;
+	for (const point& q : queries) { expect.push_back(paged.contains(q)); }
+	paged.reset_stats();
+	std::vector<bool> actual;
+	paged.template contains<Reader>(queries.begin(), queries.end(),
+	                                std::back_inserter(actual), window);
+	BOOST_CHECK(expect == actual);
+	BOOST_CHECK_EQUAL(queries.size(), paged.stats().queries);
+	BOOST_CHECK(paged.stats().misses > 0);
+	BOOST_CHECK(paged.stats().waits > 0);
+	BOOST_CHECK(paged.stats().waits <= paged.stats().misses);
+	// the cache is left consistent for single queries
+	for (std::size_t i = 0; i < queries.size(); i += 7)
+	{ BOOST_CHECK_EQUAL(expect[i], paged.contains(queries[i])); }
+}
+
+BOOST_AUTO_TEST_CASE(paged_kdtree_contains_batch)
+{
+	kdtree<point_indexable> tree;
+	std::vector<point> queries;
+	for (int i = 0; i < 3000; ++i)
+	{
+		point p = {std::rand() % 100, std::rand() % 100};
+		tree.insert(p);
+		queries.push_back(p);
+		queries.push_back({std::rand() % 100, std::rand() % 100});
+	}
+	write_paged(tree, paged_file, 256);
+	check_contains_batch<details::pread_reader>(paged_file, queries, 4, 16);
+	check_contains_batch<details::default_page_reader>(paged_file, queries, 4, 16);
+	check_contains_batch<details::default_page_reader>(paged_file, queries, 64, 8);
+	check_contains_batch<details::default_page_reader>(paged_file, queries, 1, 1);
+	{
+		// a failed wait ends the batch, and drops the pages being loaded
+		paged_kdtree<point_indexable> paged(paged_file, 4);
+		std::vector<bool> expect, actual;
+		for (const point& q : queries) { expect.push_back(paged.contains(q)); }
+		BOOST_CHECK_THROW(paged.contains<failing_reader>
+		                  (queries.begin(), queries.end(),
+		                   std::back_inserter(actual), 16), std::system_error);
+		for (std::size_t i = 0; i < queries.size(); i += 7)
+		{ BOOST_CHECK_EQUAL(expect[i], paged.contains(queries[i])); }
+		actual.clear();
+		paged.contains(queries.begin(), queries.end(),
+		               std::back_inserter(actual), 16);
+		BOOST_CHECK(expect == actual);
+	}
+	{
+		paged_kdtree<point_indexable> paged(paged_file);
+		std::vector<bool> none;
+		paged.contains(queries.begin(), queries.begin(), std::back_inserter(none));
+		BOOST_CHECK(none.empty());
+	}
+	std::remove(paged_file);
+}
@@ -0,0 +1,145 @@
+/**
+ *  Uses Boost.Test; needs to be compiled with -lboost_unit_test_framework and
+ *  to run it you must have compiled the Boost unit test framework as a shared
+ *  library (DLL - for Windows developers). If you do not have the shared
+ *  library at your disposal, you can remove all occurrences of
+ *  BOOST_TEST_DYN_LINK, and the library will be linked with the static
+ *  library. This still requires that you have compiled the Boost unit test
+ *  framework as a static library.
+ */
+
+#include <cstdlib> // std::rand()
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "../../include/windowed_kdtree.hpp"
+using namespace kdtree_index;
+
+namespace
+{
+	struct event { int x; int y; int t; };
+	struct ac_event
+	{
+		bool operator()(dimension_type d, const event& a, const event& b)
+			const noexcept
+		{ return (d == 0) ? a.x < b.x : a.y < b.y; }
+	};
+	struct minus_event
+	{
+		long operator()(dimension_type d, const event& a, const event& b)
+			const noexcept
+		{ return (d == 0) ? long(a.x) - long(b.x) : long(a.y) - long(b.y); }
+	};
+	typedef indexable<event, 2, ac_event> event_indexable;
+	typedef quadrance<event_indexable, long, minus_event> event_quadrance;
+	typedef windowed_kdtree<event_indexable> event_window;
+	typedef std::chrono::steady_clock::time_point time_point;
+	typedef std::chrono::seconds seconds;
+}
+
+BOOST_AUTO_TEST_CASE(windowed_kdtree_expiry)
+{
+	const time_point start;
+	// 10 slices of 6 seconds
+	event_window window(seconds(60), 10, start);
+	BOOST_CHECK(window.slice() == seconds(6));
+	BOOST_CHECK(window.empty());
+	BOOST_CHECK_EQUAL(1, window.generations().size());
+	std::vector<event> events;
+	for (int t = 0; t < 200; ++t)
+	{
+		window.advance(start + seconds(t));
+		for (int i = 0; i < 20; ++i)
+		{
+			events.push_back({std::rand() % 1000, std::rand() % 1000, t});
+			window.insert(events.back());
+		}
+		BOOST_CHECK(window.generations().size() <= 11);
+		// all values of the last 60 seconds are there, none older than 66
+		std::size_t expect_min = 0, expect_max = 0;
+		for (const event& e : events)
+		{
+			if (t - e.t < 60) { ++expect_min; }
+			if (t - e.t < 66) { ++expect_max; }
+		}
+		BOOST_CHECK(expect_min <= window.size() && window.size() <= expect_max);
+	}
+	// sealed generations were rebuilt
+	for (std::size_t g = 0; g + 1 < window.generations().size(); ++g)
+	{
+		BOOST_CHECK_EQUAL(0, window.generations()[g].tombstones());
+		BOOST_CHECK(window.generations()[g].stats().invalid_fraction() <= 0.5);
+	}
+	// a long pause expires everything at once
+	BOOST_CHECK_EQUAL(11, window.advance(start + seconds(1000)));
+	BOOST_CHECK(window.empty());
+	BOOST_CHECK_EQUAL(1, window.generations().size());
+	window.insert({1, 2, 1000});
+	BOOST_CHECK_EQUAL(0, window.advance(start + seconds(1001)));
+	BOOST_CHECK_EQUAL(1, window.count({1, 2, 0}));
+	window.clear();
+	BOOST_CHECK(window.empty());
+	BOOST_CHECK_THROW(event_window(seconds(0), 4, start),
+	                  std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(windowed_kdtree_queries)
+{
+	const time_point start;
+	event_window window(seconds(10), 5, start);
+	std::vector<event> events;
+	for (int t = 0; t < 25; ++t)
+	{
+		window.advance(start + seconds(t));
+		for (int i = 0; i < 30; ++i)
+		{
+			events.push_back({std::rand() % 100, std::rand() % 100, t});
+			window.insert(events.back());
+		}
+	}
+	// the values still in the window
+	std::vector<event> live;
+	for (const auto& g : window.generations())
+	{
+		for (auto i = g.begin(); i != g.end(); ++i)
+		{ if (i->is_valid()) { live.push_back(i->value()); } }
+	}
+	BOOST_REQUIRE_EQUAL(window.size(), live.size());
+	event_quadrance metric;
+	for (int i = 0; i < 30; ++i)
+	{
+		event low = {std::rand() % 100, std::rand() % 100, 0};
+		event high = {low.x + std::rand() % 30, low.y + std::rand() % 30, 0};
+		std::size_t inside = 0;
+		std::vector<long> dists;
+		for (const event& e : live)
+		{
+			if (low.x <= e.x && e.x <= high.x && low.y <= e.y && e.y <= high.y)
+			{ ++inside; }
+			dists.push_back(metric.distance_to_key(low, e));
+		}
+		std::sort(dists.begin(), dists.end());
+		std::vector<event_window::const_iterator> found;
+		window.range(low, high, std::back_inserter(found));
+		BOOST_CHECK_EQUAL(inside, found.size());
+		BOOST_CHECK_EQUAL(inside, window.count_in_range(low, high));
+		std::vector<event_window::const_iterator> near;
+		window.nearest(low, 7, metric, std::back_inserter(near));
+		BOOST_REQUIRE_EQUAL(7, near.size());
+		for (std::size_t j = 0; j < near.size(); ++j)
+		{ BOOST_CHECK_EQUAL(dists[j], metric.distance_to_key(low, near[j]->value())); }
+		const event* f = window.find(low);
+		bool in_window = std::any_of(live.begin(), live.end(),
+		                             [&low](const event& e)
+		                             { return e.x == low.x && e.y == low.y; });
+		BOOST_CHECK_EQUAL(in_window, f != nullptr);
+		if (f != nullptr) { BOOST_CHECK(f->x == low.x && f->y == low.y); }
+	}
+}